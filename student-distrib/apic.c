@@ -0,0 +1,369 @@
+#include "apic.h"
+
+#include "lib.h"
+#include "mp.h"
+#include "page.h"
+#include "pit.h"
+#include "i8259.h"
+#include "cmdline.h"
+#include "spinlock.h"
+
+// Reference source: https://wiki.osdev.org/APIC, Intel SDM Vol. 3 chapter 10
+
+#define IO_DELAY_PORT       0x80
+#define IMCR_SELECT_PORT    0x22
+#define IMCR_DATA_PORT      0x23
+#define IMCR_REG            0x70
+#define IMCR_APIC_MODE      0x01
+#define CALIBRATE_HZ        20          // calibrate the timer over 50ms
+
+int32_t lapic_enabled;
+int32_t ioapic_enabled;
+
+/* IOREGSEL/IOWIN is a pair of accesses, one CPU at a time */
+static spinlock_t ioapic_lock;
+uint32_t lapic_timer_freq;
+
+static volatile uint32_t* lapic;
+static volatile uint32_t* ioapic;
+
+static void lapic_timer_calibrate(void);
+static void ioapic_init(void);
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return lapic[reg >> 2];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+    lapic[reg >> 2] = value;
+    // read back so that the write is done before we go on
+    (void) lapic[LAPIC_ID >> 2];
+}
+
+static inline uint32_t ioapic_read(uint32_t reg)
+{
+    ioapic[IOAPIC_REGSEL >> 2] = reg;
+    return ioapic[IOAPIC_WIN >> 2];
+}
+
+static inline void ioapic_write(uint32_t reg, uint32_t value)
+{
+    ioapic[IOAPIC_REGSEL >> 2] = reg;
+    ioapic[IOAPIC_WIN >> 2] = value;
+}
+
+/* 
+ *  io_delay
+ *  DESCRIPTION: busy wait without a calibrated timer, a write to port 0x80
+ *               takes about a microsecond on the ISA bus
+ *  INPUTS: us -- number of microseconds
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void io_delay(uint32_t us)
+{
+    while (us-- > 0) {
+        outb(0, IO_DELAY_PORT);
+    }
+}
+
+/* 
+ *  apic_init
+ *  DESCRIPTION: enable the local APIC of the BSP, calibrate its timer
+ *               and hand the device IRQs from the 8259 to the IOAPIC.
+ *               Booting with apic=0 keeps everything on the 8259.
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ *  SIDE EFFECTS: must run after page_init and before the devices enable their IRQ
+ */
+void apic_init(void)
+{
+    if (!cmdline_get_int("apic", 1, 0, 1)) {
+        return;
+    }
+    lapic_init();
+    if (!lapic_enabled) {
+        return;
+    }
+    lapic_timer_calibrate();
+    ioapic_init();
+}
+
+/* 
+ *  lapic_init
+ *  DESCRIPTION: map the local APIC of the BSP and software enable it. The
+ *               LINT0 setup of the BIOS (virtual wire) is left alone, so the
+ *               8259 keeps delivering the device IRQs.
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ *  SIDE EFFECTS: must run after page_init
+ */
+void lapic_init(void)
+{
+    if (mp_info.lapic_base == 0) {
+        return;
+    }
+    map_mmio(mp_info.lapic_base);
+    lapic = (volatile uint32_t*) mp_info.lapic_base;
+
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_enabled = 1;
+}
+
+/* 
+ *  lapic_timer_calibrate
+ *  DESCRIPTION: count the local APIC timer ticks over a known delay of the
+ *               PIT. All the local APICs share the bus clock, so the result
+ *               holds for the APs too.
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ *  SIDE EFFECTS: sets lapic_timer_freq
+ */
+static void lapic_timer_calibrate(void)
+{
+    uint32_t elapsed;
+
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+
+    pit_oneshot_start(CALIBRATE_HZ);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    while (!pit_oneshot_done()) {
+        asm volatile ("pause");
+    }
+    elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    lapic_timer_freq = elapsed * CALIBRATE_HZ;
+    printf("Local APIC timer: %u Hz (bus / 16)\n", lapic_timer_freq);
+}
+
+/* 
+ *  lapic_timer_start
+ *  DESCRIPTION: run the local APIC timer of the running CPU periodically,
+ *               it raises LAPIC_TIMER_VECTOR
+ *  INPUTS: hz -- rate of the interrupt
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void lapic_timer_start(int32_t hz)
+{
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, lapic_timer_freq / hz);
+}
+
+/* 
+ *  ioapic_init
+ *  DESCRIPTION: route each ISA IRQ to the BSP with the vector the 8259
+ *               used, masked until enable_irq. The interrupt source
+ *               overrides of the firmware give the input and the polarity.
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+static void ioapic_init(void)
+{
+    uint32_t irq, gsi, nr_inputs, entry;
+
+    if (mp_info.ioapic_base == 0) {
+        return;
+    }
+    map_mmio(mp_info.ioapic_base);
+    ioapic = (volatile uint32_t*) mp_info.ioapic_base;
+    spin_lock_init(&ioapic_lock, "ioapic");
+
+    nr_inputs = ((ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+    for (gsi = 0; gsi < nr_inputs; gsi++) {
+        ioapic_write(IOAPIC_REDTBL + 2 * gsi, IOAPIC_MASKED);
+    }
+
+    for (irq = 0; irq < NUM_ISA_IRQS; irq++) {
+        gsi = mp_info.irq_to_gsi[irq];
+        if (gsi >= nr_inputs) {
+            continue;
+        }
+        entry = IOAPIC_MASKED | (IRQ_VECTOR_BASE + irq);
+        if ((mp_info.irq_flags[irq] & INTI_POLARITY_MASK) == INTI_ACTIVE_LOW) {
+            entry |= IOAPIC_ACTIVE_LOW;
+        }
+        if ((mp_info.irq_flags[irq] & INTI_TRIGGER_MASK) == INTI_LEVEL) {
+            entry |= IOAPIC_LEVEL;
+        }
+        ioapic_write(IOAPIC_REDTBL + 2 * gsi + 1, (uint32_t) lapic_id() << 24);
+        ioapic_write(IOAPIC_REDTBL + 2 * gsi, entry);
+    }
+
+    // boards in PIC mode (MP spec 3.6.2.1) wire the 8259 to the BSP through the IMCR
+    outb(IMCR_REG, IMCR_SELECT_PORT);
+    outb(IMCR_APIC_MODE, IMCR_DATA_PORT);
+    i8259_disable();
+    ioapic_enabled = 1;
+}
+
+/* 
+ *  ioapic_mask
+ *  DESCRIPTION: mask an ISA IRQ on the IOAPIC
+ *  INPUTS: irq -- ISA IRQ number
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void ioapic_mask(uint32_t irq)
+{
+    unsigned long flags;
+    uint32_t reg = IOAPIC_REDTBL + 2 * mp_info.irq_to_gsi[irq];
+
+    spin_lock_irqsave(&ioapic_lock, flags);
+    ioapic_write(reg, ioapic_read(reg) | IOAPIC_MASKED);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+/* 
+ *  ioapic_unmask
+ *  DESCRIPTION: unmask an ISA IRQ on the IOAPIC
+ *  INPUTS: irq -- ISA IRQ number
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void ioapic_unmask(uint32_t irq)
+{
+    unsigned long flags;
+    uint32_t reg = IOAPIC_REDTBL + 2 * mp_info.irq_to_gsi[irq];
+
+    spin_lock_irqsave(&ioapic_lock, flags);
+    ioapic_write(reg, ioapic_read(reg) & ~IOAPIC_MASKED);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+/* 
+ *  ioapic_masked
+ *  DESCRIPTION: tell whether an ISA IRQ is masked on the IOAPIC
+ *  INPUTS: irq -- ISA IRQ number
+ *  OUTPUTS: none
+ *  RETURN VALUE: 1 if it is masked, else 0
+ */
+int32_t ioapic_masked(uint32_t irq)
+{
+    unsigned long flags;
+    uint32_t reg = IOAPIC_REDTBL + 2 * mp_info.irq_to_gsi[irq];
+    uint32_t entry;
+
+    spin_lock_irqsave(&ioapic_lock, flags);
+    entry = ioapic_read(reg);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+    return (entry & IOAPIC_MASKED) != 0;
+}
+
+/* 
+ *  lapic_init_ap
+ *  DESCRIPTION: enable the local APIC of an application processor, only
+ *               the BSP takes the 8259 interrupts
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void lapic_init_ap(void)
+{
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    // clear errors (back to back writes) and pending interrupts
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_EOI, 0);
+    lapic_write(LAPIC_TPR, 0);
+}
+
+/* 
+ *  lapic_id
+ *  DESCRIPTION: get the local APIC id of the running processor
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: the APIC id, 0 if the local APIC is not enabled
+ */
+uint8_t lapic_id(void)
+{
+    if (!lapic_enabled) {
+        return 0;
+    }
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+/* 
+ *  lapic_eoi
+ *  DESCRIPTION: acknowledge the local APIC interrupt being served
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void lapic_eoi(void)
+{
+    lapic[LAPIC_EOI >> 2] = 0;
+}
+
+/* wait for the local APIC to accept the last interrupt command */
+static void lapic_wait_icr(void)
+{
+    while (lapic_read(LAPIC_ICR_LO) & ICR_PENDING) {
+        asm volatile ("pause");
+    }
+}
+
+/* 
+ *  lapic_send_ipi
+ *  DESCRIPTION: send a fixed interrupt to another processor
+ *  INPUTS: apic_id -- destination, ignored with a shorthand
+ *          vector -- interrupt vector
+ *          shorthand -- 0 or ICR_ALL_BUT_SELF
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void lapic_send_ipi(uint8_t apic_id, uint32_t vector, uint32_t shorthand)
+{
+    unsigned long flags;
+
+    if (!lapic_enabled) {
+        return;
+    }
+    cli_and_save(flags);
+    lapic_wait_icr();
+    lapic_write(LAPIC_ICR_HI, (uint32_t) apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, shorthand | ICR_FIXED | vector);
+    restore_flags(flags);
+}
+
+/* 
+ *  lapic_start_ap
+ *  DESCRIPTION: INIT-SIPI-SIPI sequence of the MP specification (B.4)
+ *  INPUTS: apic_id -- processor to start
+ *          addr -- real mode entry point, 4KB aligned below 1MB
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void lapic_start_ap(uint8_t apic_id, uint32_t addr)
+{
+    int32_t i;
+
+    // assert then deassert INIT
+    lapic_write(LAPIC_ICR_HI, (uint32_t) apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+    io_delay(200);
+    lapic_write(LAPIC_ICR_LO, ICR_INIT | ICR_LEVEL);
+    io_delay(10000);
+
+    // the startup IPI carries the page number of the entry point
+    for (i = 0; i < 2; i++) {
+        lapic_write(LAPIC_ICR_HI, (uint32_t) apic_id << 24);
+        lapic_write(LAPIC_ICR_LO, ICR_STARTUP | (addr >> 12));
+        io_delay(200);
+        lapic_wait_icr();
+    }
+}
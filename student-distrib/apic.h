@@ -0,0 +1,107 @@
+#ifndef _APIC_H
+#define _APIC_H
+
+#include "types.h"
+
+/* Local APIC registers, offsets from the base address */
+#define LAPIC_ID            0x020
+#define LAPIC_VER           0x030
+#define LAPIC_TPR           0x080
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0
+#define LAPIC_ESR           0x280
+#define LAPIC_ICR_LO        0x300
+#define LAPIC_ICR_HI        0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_LINT0     0x350
+#define LAPIC_LVT_LINT1     0x360
+#define LAPIC_LVT_ERROR     0x370
+#define LAPIC_TIMER_INIT    0x380
+#define LAPIC_TIMER_CUR     0x390
+#define LAPIC_TIMER_DIV     0x3E0
+
+#define LAPIC_SVR_ENABLE    0x100
+#define LAPIC_LVT_MASKED    0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_DIV_16  0x3
+
+/* IOAPIC registers, selected through IOREGSEL and accessed through IOWIN */
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WIN          0x10
+#define IOAPIC_VER          0x01
+#define IOAPIC_REDTBL       0x10        // two registers per input
+
+/* Redirection entry */
+#define IOAPIC_ACTIVE_LOW   0x02000
+#define IOAPIC_LEVEL        0x08000
+#define IOAPIC_MASKED       0x10000
+
+/* MPS INTI flags of an interrupt source override */
+#define INTI_POLARITY_MASK  0x3
+#define INTI_ACTIVE_LOW     0x3
+#define INTI_TRIGGER_MASK   0xC
+#define INTI_LEVEL          0xC
+
+/* Interrupt command register */
+#define ICR_FIXED           0x00000
+#define ICR_INIT            0x00500
+#define ICR_STARTUP         0x00600
+#define ICR_PENDING         0x01000
+#define ICR_ASSERT          0x04000
+#define ICR_LEVEL           0x08000
+#define ICR_ALL_BUT_SELF    0xC0000
+
+/* Vectors of the local APIC interrupts, the IOAPIC keeps the 8259 vectors */
+#define IRQ_VECTOR_BASE     0x20
+#define LAPIC_TIMER_VECTOR  0xF0
+#define IPI_RESCHED_VECTOR  0xF1        // run the scheduler, remap the video page
+#define IPI_TICK_VECTOR     0xF2        // scheduler tick forwarded by the BSP
+#define SPURIOUS_VECTOR     0xFF
+
+#ifndef ASM
+
+/* non-zero once the local APIC is mapped and enabled on the BSP */
+extern int32_t lapic_enabled;
+
+/* non-zero when the IOAPIC delivers the device IRQs instead of the 8259 */
+extern int32_t ioapic_enabled;
+
+/* bus clock of the local APIC timers divided by 16, 0 if not calibrated */
+extern uint32_t lapic_timer_freq;
+
+/* Enable the local APIC of the BSP, calibrate its timer and route the IRQs through the IOAPIC */
+void apic_init(void);
+
+/* Map the local APIC of the BSP and enable it, the 8259 keeps delivering IRQs */
+void lapic_init(void);
+
+/* Enable the local APIC of an application processor */
+void lapic_init_ap(void);
+
+/* Local APIC id of the running processor */
+uint8_t lapic_id(void);
+
+/* End of interrupt of a local APIC interrupt */
+void lapic_eoi(void);
+
+/* Send a fixed interrupt to one processor, or to all others with ICR_ALL_BUT_SELF */
+void lapic_send_ipi(uint8_t apic_id, uint32_t vector, uint32_t shorthand);
+
+/* Wake an application processor at addr (4KB aligned, below 1MB) with INIT-SIPI-SIPI */
+void lapic_start_ap(uint8_t apic_id, uint32_t addr);
+
+/* Run the local APIC timer of the running processor periodically at hz */
+void lapic_timer_start(int32_t hz);
+
+/* Mask (disable) and unmask (enable) an ISA IRQ on the IOAPIC */
+void ioapic_mask(uint32_t irq);
+void ioapic_unmask(uint32_t irq);
+/* 1 if an ISA IRQ is masked on the IOAPIC */
+int32_t ioapic_masked(uint32_t irq);
+
+/* Busy wait, about a microsecond per unit */
+void io_delay(uint32_t us);
+
+#endif /* ASM */
+
+#endif /* _APIC_H */
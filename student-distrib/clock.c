@@ -0,0 +1,108 @@
+#include "clock.h"
+
+#include "lib.h"
+#include "pit.h"
+#include "syscall.h"
+
+#define CALIBRATE_HZ        20          // calibrate the TSC over 50ms
+#define CALIBRATE_ROUNDS    3
+
+uint32_t tsc_khz;
+uint64_t tsc_base;
+uint32_t clock_mult;
+
+/* 
+ *  div_u64_u32
+ *  DESCRIPTION: 64 by 32 bit division without libgcc
+ *  INPUTS: n -- dividend, n / d must fit in 32 bits
+ *          d -- divisor
+ *  OUTPUTS: none
+ *  RETURN VALUE: n / d
+ */
+static inline uint32_t div_u64_u32(uint64_t n, uint32_t d)
+{
+    uint32_t q, r;
+
+    asm ("divl %4"
+         : "=a" (q), "=d" (r)
+         : "a" ((uint32_t) n), "d" ((uint32_t) (n >> 32)), "rm" (d));
+    return q;
+}
+
+/* 
+ *  mul_u64_u32_shr
+ *  DESCRIPTION: (a * mul) >> shift with a 96 bit product, the two halves
+ *               of a are multiplied on their own so nothing overflows
+ *  INPUTS: a -- cycles, mul -- scale, shift -- at most 32
+ *  OUTPUTS: none
+ *  RETURN VALUE: the scaled value
+ */
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift)
+{
+    uint32_t low = (uint32_t) a;
+    uint32_t high = (uint32_t) (a >> 32);
+
+    return (((uint64_t) low * mul) >> shift) + (((uint64_t) high * mul) << (32 - shift));
+}
+
+/* 
+ *  clock_init
+ *  DESCRIPTION: count the TSC cycles of a few PIT one-shots and keep the
+ *               fastest round, a round stretched by an SMI or the host
+ *               only reads too many cycles
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ *  Reference source: https://wiki.osdev.org/TSC
+ */
+void clock_init(void)
+{
+    uint64_t start;
+    uint32_t elapsed, best = 0xFFFFFFFF;
+    int32_t i;
+
+    for (i = 0; i < CALIBRATE_ROUNDS; i++) {
+        pit_oneshot_start(CALIBRATE_HZ);
+        start = rdtsc();
+        while (!pit_oneshot_done()) {
+            asm volatile ("pause");
+        }
+        elapsed = (uint32_t) (rdtsc() - start);
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    tsc_khz = best / (1000 / CALIBRATE_HZ);
+    clock_mult = div_u64_u32((uint64_t) NSEC_PER_MSEC << CLOCK_SHIFT, tsc_khz);
+    tsc_base = rdtsc();
+    printf("TSC clocksource: %u kHz\n", tsc_khz);
+}
+
+/* 
+ *  clock_ns
+ *  DESCRIPTION: read the clock
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: nanoseconds since clock_init
+ */
+uint64_t clock_ns(void)
+{
+    return mul_u64_u32_shr(rdtsc() - tsc_base, clock_mult, CLOCK_SHIFT);
+}
+
+/* 
+ *  gettime
+ *  DESCRIPTION: the gettime system call, read the monotonic clock
+ *  INPUTS: ns -- user buffer receiving the nanoseconds since boot
+ *  OUTPUTS: none
+ *  RETURN VALUE: 0 on success, -1 if ns is not a user address
+ */
+int32_t gettime(uint64_t* ns)
+{
+    if ((uint32_t) ns < USER_MEM || (uint32_t) ns > USER_MEM_END - sizeof(uint64_t)) {
+        return -1;
+    }
+    *ns = clock_ns();
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include "types.h"
+
+#define NSEC_PER_MSEC       1000000
+#define CLOCK_SHIFT         22          // ns = cycles * clock_mult >> CLOCK_SHIFT
+
+/* TSC frequency measured at boot, 0 until clock_init */
+extern uint32_t tsc_khz;
+/* TSC at clock_init, the zero of clock_ns */
+extern uint64_t tsc_base;
+/* nanoseconds per cycle, scaled by 2^CLOCK_SHIFT */
+extern uint32_t clock_mult;
+
+/* Calibrate the TSC against PIT channel 2, before interrupts are enabled */
+void clock_init(void);
+
+/*
+ * Monotonic nanoseconds since clock_init. The TSCs of all the CPUs are
+ * reset together and run at the same rate, so any CPU may read it.
+ */
+uint64_t clock_ns(void);
+
+/* The gettime system call */
+int32_t gettime(uint64_t* ns);
+
+#endif /* _CLOCK_H */
@@ -0,0 +1,67 @@
+#include "cmdline.h"
+
+#include "lib.h"
+
+// copy of the boot command line, the multiboot one is not mapped after paging is on
+static int8_t boot_cmdline[CMDLINE_MAX_LEN];
+
+/* 
+ *  cmdline_init
+ *  DESCRIPTION: keep a copy of the boot command line
+ *  INPUTS: cmdline -- command line from the multiboot info, may be NULL
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ *  SIDE EFFECTS: must be called before paging is enabled
+ */
+void cmdline_init(const int8_t* cmdline)
+{
+    if (cmdline == NULL) {
+        return;
+    }
+    strncpy(boot_cmdline, cmdline, CMDLINE_MAX_LEN - 1);
+    boot_cmdline[CMDLINE_MAX_LEN - 1] = '\0';
+}
+
+/* 
+ *  cmdline_get_int
+ *  DESCRIPTION: get the decimal value of a "key=value" boot option
+ *  INPUTS: key -- name of the option
+ *          def -- value used when the option is absent or malformed
+ *          min, max -- range of valid values
+ *  OUTPUTS: none
+ *  RETURN VALUE: the value of the option, def if it is absent or out of range
+ *  SIDE EFFECTS: none
+ */
+int32_t cmdline_get_int(const int8_t* key, int32_t def, int32_t min, int32_t max)
+{
+    uint32_t key_len = strlen(key);
+    int8_t* s = boot_cmdline;
+    int32_t value;
+
+    while (*s != '\0') {
+        // find the start of the next word
+        while (*s == ' ') {
+            s++;
+        }
+        if (strncmp(s, key, key_len) == 0 && s[key_len] == '=') {
+            s += key_len + 1;
+            if (*s < '0' || *s > '9') {
+                return def;
+            }
+            value = 0;
+            while (*s >= '0' && *s <= '9' && value <= max) {
+                value = value * 10 + (*s++ - '0');
+            }
+            if ((*s != ' ' && *s != '\0') || value < min || value > max) {
+                printf("Invalid boot option %s, using %d\n", key, def);
+                return def;
+            }
+            return value;
+        }
+        // skip the word
+        while (*s != ' ' && *s != '\0') {
+            s++;
+        }
+    }
+    return def;
+}
@@ -0,0 +1,15 @@
+#ifndef _CMDLINE_H
+#define _CMDLINE_H
+
+#include "types.h"
+
+#define CMDLINE_MAX_LEN     256
+
+/*
+ * Boot options are passed by the boot loader as "key=value" words, e.g.
+ * "/bootimg pit_hz=250 quantum=4" in the grub menu entry.
+ */
+void cmdline_init(const int8_t* cmdline);
+int32_t cmdline_get_int(const int8_t* key, int32_t def, int32_t min, int32_t max);
+
+#endif
@@ -135,6 +135,8 @@ int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t lengt
             (void)memcpy(buf + bytes_copied, (uint8_t*)(data_block_start + file_inode.dblock_table[i]), sizeof(data_block_t));
             bytes_copied += sizeof(data_block_t);
         }
+        // a large read may take a while, let a task waiting for the CPU in
+        cond_resched();
     }
 
     // /* end of file has been reached */
@@ -165,13 +167,14 @@ void filesys_init(void* filesys_start) {
  *  DESCRIPTION：
  *      Given a filename, the function sets file_position, flags and inode_idx
  *  INPUT: filename
+ *         fd (not used)
  *  RETURN VALUE:
  *      -1 - cannot open file
  *       0 - opened file successfully
  *  SIDE EFFECTS:
  *      file_descriptor (see filesys.c) is modified.
  */
-int32_t file_open(const uint8_t* filename) {
+int32_t file_open(const uint8_t* filename, int32_t fd) {
     return 0;
 }
 
@@ -237,11 +240,12 @@ int32_t file_write(int32_t fd, const void* buf, int32_t nbytes) {
  *  DESCRIPTION:
  *      Given a directory name, the function opens the directory.
  *  INPUTS: directory name
+ *          fd (not used)
  *  RETURN VALUES：
  *      -1 - cannot open directory (invalid filename, cannot find directory, file type incorrect)
  *       0 - opened directory successfully
  */
-int32_t dir_open(const uint8_t* filename) {
+int32_t dir_open(const uint8_t* filename, int32_t fd) {
     return 0;
 }
 
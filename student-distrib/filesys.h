@@ -11,6 +11,7 @@
 #define DBLOCK_TABLE_SIZE   (1024 - 1)  
 
 #define FD_FLAG_PRESENT     0x00000001
+#define FD_FLAG_NONBLOCK    0x00000002  // reads never wait (O_NONBLOCK)
 
 #define RTC_FILE_TYPE       0
 #define DIR_FILE_TYPE       1
@@ -50,7 +51,7 @@ int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry);
 int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
 
 
-int32_t file_open(const uint8_t* filename);
+int32_t file_open(const uint8_t* filename, int32_t fd);
 
 int32_t file_close(int32_t fd);
 
@@ -58,7 +59,7 @@ int32_t file_read(int32_t fd, void* buf, int32_t nbytes);
 
 int32_t file_write(int32_t fd, const void* buf, int32_t nbytes);
 
-int32_t dir_open(const uint8_t* filename);
+int32_t dir_open(const uint8_t* filename, int32_t fd);
 
 int32_t dir_close(int32_t fd);
 
@@ -3,11 +3,27 @@
 
 #include "types.h"
 
+/* deadline of a read that may wait as long as it takes, in clock_ns time */
+#define NO_DEADLINE         0xFFFFFFFFFFFFFFFFULL
+/* returned by a read with nothing to read by its deadline */
+#define ERR_WOULD_BLOCK     (-2)
+
+/* events of the poll system call */
+#define POLLIN              0x0001      // read would not wait
+#define POLLOUT             0x0004      // write would not wait
+#define POLLNVAL            0x0020      // fd is not open
+
 typedef struct file_op_table_t {
-    int32_t (*open)(const uint8_t* filename);
+    /* fd is the entry of file_desc_array being opened */
+    int32_t (*open)(const uint8_t* filename, int32_t fd);
     int32_t (*close)(int32_t fd);
     int32_t (*read)(int32_t fd, void* buf, int32_t nbytes);
     int32_t (*write)(int32_t fd, const void* buf, int32_t nbytes);
+    /* read waiting until deadline (clock_ns) at most, NULL if read never waits */
+    int32_t (*read_until)(int32_t fd, void* buf, int32_t nbytes, uint64_t deadline);
+    /* POLLIN and POLLOUT if ready, with wait set the current task is also put on the wait
+       list of the file (poll_wait) to be woken up when it gets ready; NULL if always ready */
+    int32_t (*poll)(int32_t fd, int32_t wait);
 } file_op_table_t;
 
 typedef struct file_desc_t {
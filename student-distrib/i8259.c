@@ -3,10 +3,11 @@
  */
 
 #include "i8259.h"
+#include "apic.h"
+#include "spinlock.h"
 
-// #include <linux/spinlock.h>
-
-// static spinlock_t i8259_lock = SPIN_LOCK_UNLOCKED;
+/* the masks below and the PIC ports, shared by all the CPUs */
+static spinlock_t i8259_lock;
 /*cached_irq_mask for master and slave*/ 
 // uint16_t cached_irq_mask = 0xFFFF;
 /* Interrupt masks to determine which interrupts are enabled and disabled */
@@ -33,7 +34,9 @@ void i8259_init(void) {
     */
 
     unsigned long flags;
-    cli_and_save(flags);
+
+    spin_lock_init(&i8259_lock, "i8259");
+    spin_lock_irqsave(&i8259_lock, flags);
 
     //mask both master and slave
     outb(0xFF, MASTER_8259_DATA);
@@ -62,11 +65,26 @@ void i8259_init(void) {
 
     //enable slave IRQ
     enable_irq(NUM_IRQ);
-    restore_flags(flags);
+    spin_unlock_irqrestore(&i8259_lock, flags);
 
     return;
 }
 
+/*
+ *   i8259_disable
+ *   DESCRIPTION: Mask every IRQ on both PICs, the IOAPIC takes over
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: enable_irq, disable_irq and send_eoi go to the APICs from now on
+ */
+void i8259_disable(void) {
+    master_mask = 0xFF;
+    slave_mask = 0xFF;
+    outb(master_mask, MASTER_8259_DATA);
+    outb(slave_mask, SLAVE_8259_DATA);
+}
+
 /*
  *   enable_irq
  *   DESCRIPTION: Enable (unmask) the specified IRQ
@@ -86,7 +104,12 @@ void enable_irq(uint32_t irq_num) {
     //And high means mask, so we use ~
     mask = ~(1 << irq_num);
 
-    cli_and_save(flags);
+    if (ioapic_enabled) {
+        ioapic_unmask(irq_num);
+        return;
+    }
+
+    spin_lock_irqsave(&i8259_lock, flags);
     // MASTER_SLAVE_DIV = 8 in decimal = 1000 in binary
     // So irq_num & MASTER_SLAVE_DIV is to check if irq_num > 8, if bigger, it is slave
     if(irq_num & MASTER_SLAVE_DIV){
@@ -97,7 +120,7 @@ void enable_irq(uint32_t irq_num) {
         master_mask &= mask;
         outb(master_mask,MASTER_8259_DATA);
     }
-    restore_flags(flags);
+    spin_unlock_irqrestore(&i8259_lock, flags);
 }
 
 /*
@@ -118,7 +141,12 @@ void disable_irq(uint32_t irq_num) {
     //Since we are start from bit 0, so we need to shift left 1 to find proper bit.
     mask = (1 << irq_num);
 
-    cli_and_save(flags);
+    if (ioapic_enabled) {
+        ioapic_mask(irq_num);
+        return;
+    }
+
+    spin_lock_irqsave(&i8259_lock, flags);
     // MASTER_SLAVE_DIV = 8 in decimal = 1000 in binary
     // So irq_num & MASTER_SLAVE_DIV is to check if irq_num > 8, if bigger, it is slave
     if(irq_num & MASTER_SLAVE_DIV){
@@ -129,10 +157,29 @@ void disable_irq(uint32_t irq_num) {
         master_mask |= mask;
         outb(master_mask, MASTER_8259_DATA);
     }
-    restore_flags(flags);
+    spin_unlock_irqrestore(&i8259_lock, flags);
     return;
 }
 
+/*
+ *   irq_masked
+ *   DESCRIPTION: Tell whether the specified IRQ is masked, on the IOAPIC
+ *                when it delivers the IRQs
+ *   INPUTS: irq_num - number of IRQ, used to decide if MASTER PIC or SLAVE PIC
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the IRQ is masked, else 0
+ *   SIDE EFFECTS: none
+ */
+int32_t irq_masked(uint32_t irq_num) {
+    if (ioapic_enabled) {
+        return ioapic_masked(irq_num);
+    }
+    if (irq_num & MASTER_SLAVE_DIV) {
+        return (slave_mask >> (irq_num - MASTER_SLAVE_DIV)) & 1;
+    }
+    return (master_mask >> irq_num) & 1;
+}
+
 /*
  *   send_eoi
  *   DESCRIPTION: Send end-of-interrupt signal for the specified IRQ
@@ -145,6 +192,11 @@ void disable_irq(uint32_t irq_num) {
  *   2. https://wiki.osdev.org/8259_PIC
  */
 void send_eoi(uint32_t irq_num) {
+    // a single memory write to the local APIC, no slow port I/O
+    if (ioapic_enabled) {
+        lapic_eoi();
+        return;
+    }
     // MASTER_SLAVE_DIV = 8 in decimal = 1000 in binary
     // So irq_num & MASTER_SLAVE_DIV is to check if irq_num > 8, if bigger, it is slave
     if(irq_num & MASTER_SLAVE_DIV){
@@ -39,10 +39,14 @@
 
 /* Initialize both PICs */
 void i8259_init(void);
+/* Mask both PICs for good when the IOAPIC delivers the IRQs */
+void i8259_disable(void);
 /* Enable (unmask) the specified IRQ */
 void enable_irq(uint32_t irq_num);
 /* Disable (mask) the specified IRQ */
 void disable_irq(uint32_t irq_num);
+/* Tell whether the specified IRQ is masked */
+int32_t irq_masked(uint32_t irq_num);
 /* Send end-of-interrupt signal for the specified IRQ */
 void send_eoi(uint32_t irq_num);
 
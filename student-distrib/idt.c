@@ -4,6 +4,7 @@
 #include "x86_desc.h"
 #include "exception_handler.h"
 #include "intr_wrap.h"
+#include "apic.h"
 
 /* 
  * idt_clear
@@ -150,6 +151,10 @@ void idt_fill_hardware_handler(){
     idt_add_interrupt_handler(KEYBOARD_IDT_INDEX, keyboard_wrap_handler);
     idt_add_interrupt_handler(RTC_IDT_INDEX, rtc_wrap_handler);
     idt_add_interrupt_handler(PIT_IDT_INDEX, pit_wrap_handler);
+    idt_add_interrupt_handler(LAPIC_TIMER_VECTOR, lapic_timer_wrap_handler);
+    idt_add_interrupt_handler(IPI_RESCHED_VECTOR, resched_ipi_wrap_handler);
+    idt_add_interrupt_handler(IPI_TICK_VECTOR, tick_ipi_wrap_handler);
+    idt_add_interrupt_handler(SPURIOUS_VECTOR, spurious_wrap_handler);
 }
 /*
  * idt_fill_system_call
@@ -7,6 +7,14 @@ extern void rtc_wrap_handler();
 
 extern void pit_wrap_handler();
 
+extern void lapic_timer_wrap_handler();
+
 extern void sys_call_handler();
 
+extern void resched_ipi_wrap_handler();
+
+extern void tick_ipi_wrap_handler();
+
+extern void spurious_wrap_handler();
+
 #endif /* _INTR_WRAP_H */
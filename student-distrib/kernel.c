@@ -15,9 +15,18 @@
 #include "pit.h"
 #include "filesys.h"
 #include "terminal.h"
+#include "kmem.h"
 #include "task.h"
 #include "scheduler.h"
 #include "pit.h"
+#include "cmdline.h"
+#include "mp.h"
+#include "smp.h"
+#include "apic.h"
+#include "clock.h"
+#include "vdso.h"
+#include "softirq.h"
+#include "workqueue.h"
 
 #define RUN_TESTS
 
@@ -56,8 +65,10 @@ void entry(unsigned long magic, unsigned long addr) {
         printf("boot_device = 0x%#x\n", (unsigned)mbi->boot_device);
 
     /* Is the command line passed? */
-    if (CHECK_FLAG(mbi->flags, 2))
+    if (CHECK_FLAG(mbi->flags, 2)) {
         printf("cmdline = %s\n", (char *)mbi->cmdline);
+        cmdline_init((int8_t *)mbi->cmdline);
+    }
 
     if (CHECK_FLAG(mbi->flags, 3)) {
         int mod_count = 0;
@@ -156,8 +167,15 @@ void entry(unsigned long magic, unsigned long addr) {
      * PIC, any other initialization stuff... */
     /* Init the PIC */
     i8259_init();
+    /* Find the processors while the firmware tables are reachable */
+    mp_init();
     /* Init Paging */
     page_init();
+    /* Move the IRQs to the IOAPIC when there is one */
+    apic_init();
+    /* Calibrate the TSC clocksource */
+    clock_init();
+    vdso_init();
     /* Init file system */
     filesys_init(filesys_start_addr);
     /* Init RTC*/
@@ -170,7 +188,17 @@ void entry(unsigned long magic, unsigned long addr) {
     pit_init();
     /* Init process control table */
     init_all_pcb();
-    /* open three terminals */
+    /* Init the allocator of kernel memory, past the kernel image */
+    kmem_init();
+    /* Init the scheduler locks */
+    sched_init();
+    /* Init the bottom halves of the interrupt handlers */
+    softirq_init();
+    /* Start the other processors, they wait for the first task */
+    smp_init();
+    /* Start the kernel worker thread */
+    workqueue_init();
+    /* open terminal 0, the others open on their first Alt+Fn */
     terminal_init();
     
     /* Enable interrupts */
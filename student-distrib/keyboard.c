@@ -2,7 +2,9 @@
 
 #include "syscall.h"
 #include "terminal.h"
+#include "scheduler.h"
 #include "i8259.h"
+#include "softirq.h"
 
 static int32_t capslock_f = 0;  //the flag for capslock
 static int32_t left_shift_f = 0;  //the flag for capslock
@@ -15,6 +17,15 @@ static int32_t dir_down_f = 0;
 
 static int32_t function_f = 0;  //the flag bit vector for F1 to F12
 
+/* scancodes read by the interrupt handler, consumed by keyboard_tasklet.
+ * One producer (the CPU taking IRQ 1) and one consumer (the tasklet). */
+static uint8_t scancode_ring[SCANCODE_RING_SIZE];
+static volatile uint32_t scancode_head;    // next slot written by the handler
+static volatile uint32_t scancode_tail;    // next slot read by the tasklet
+
+static void keyboard_bottom_half(uint32_t data);
+static DECLARE_TASKLET(keyboard_tasklet, keyboard_bottom_half, KEYBORAD_IRQ);
+
 uint8_t scancodes_table[MAX_SANCODES][2] = {
     {0x0, 0x0}, {CODE_ESC, CODE_ESC},     
     {'1', '!'}, {'2', '@'},
@@ -122,6 +133,24 @@ void keyboard_init() {
     // printf("Done Initiating Keyboard\n");
 }
 
+/*
+ * function_key:
+ * DESCRIPTION: tell which function key a make code is
+ * INPUTS: scancode -- make code of a key
+ * OUTPUTS: none
+ * RETURN: 0 for F1 to 11 for F12, -1 if it is not a function key
+ * SIDE EFFECTS: none
+ */
+static int32_t function_key(uint8_t scancode){
+    if (scancode >= CODE_F1_PRESS && scancode <= CODE_F10_PRESS) {
+        return scancode - CODE_F1_PRESS;
+    }
+    if (scancode == CODE_F11_PRESS || scancode == CODE_F12_PRESS) {
+        return scancode - CODE_F11_PRESS + 10;
+    }
+    return -1;
+}
+
 /*
  * keyboard_setflag:
  * DESCRIPTION: check the key pressed and set the flags
@@ -131,6 +160,8 @@ void keyboard_init() {
  * SIDE EFFECTS: check whether the key pressed is a functional key
  */
 int32_t keyboard_setflag(uint8_t scancode){
+    int32_t fn;
+
     //determin each flags by the scancode
     //printf("%x",scancode);
     switch(scancode){
@@ -181,48 +212,30 @@ int32_t keyboard_setflag(uint8_t scancode){
         case CODE_DIR_DOWN_R:
             dir_down_f = 0;
             return 0;
-        case CODE_F1_PRESS:
-            function_f |= 1;
-            return 0;
-        case CODE_F2_PRESS:
-            function_f |= 2;
-            return 0;
-        case CODE_F3_PRESS:
-            function_f |= 4;
-            return 0;
-        case CODE_F1_RELEASE:
-            function_f &= -2;
-            return 0;
-        case CODE_F2_RELEASE:
-            function_f &= -3;
-            return 0;
-        case CODE_F3_RELEASE:
-            function_f &= -5;
-            return 0;
-        //if it is not a functional key pressed
+        //if it is not a functional key pressed, it may be one of F1 to F12
         default:
+            fn = function_key(scancode & ~CODE_RELEASE);
+            if (fn == -1) {
+                return 0;
+            }
+            if (scancode & CODE_RELEASE) {
+                function_f &= ~(1 << fn);
+            } else {
+                function_f |= 1 << fn;
+            }
             return 0;
     }
 }
 
 /*
- * keyboard_handler:
- * DESCRIPTION: get the scancode and handle it
- * INPUTS: none
+ * keyboard_handle_scancode:
+ * DESCRIPTION: turn a scancode into a character and hand it to the terminal
+ * INPUTS: scancode -- byte read from the keyboard controller
  * OUTPUTS: none
  * RETURN: none
  * SIDE EFFECTS: handle the history viewing of the terminal by direction key.
  */
-void keyboard_handler(){
-    //printf("handle\n");
-    // if (key_init_f == 0){
-    //     send_eoi(KEYBORAD_IRQ);
-    //     sti();
-    //     return;
-    // }
-
-    uint8_t scancode = inb(KEY_DATA_PORT);
-    //printf("Scan code = %x\n", scancode);
+static void keyboard_handle_scancode(uint8_t scancode){
     uint8_t    curr_ascii_code;
     //check the flag scancodes
     int32_t temp;
@@ -230,19 +243,16 @@ void keyboard_handler(){
     //if a functional key is pressed
     temp = keyboard_setflag(scancode);
     if (temp == 1){
-        send_eoi(KEYBORAD_IRQ);
         return;
     }
 
-    //if the scancode is NOT used for printing something, sti and return
+    //if the scancode is NOT used for printing something, return
     if (scancode > MAX_SANCODES){
-        send_eoi(KEYBORAD_IRQ);
         return;
     }
     //these are unavailable currently
     if (scancode == 0  || scancode == 1  || scancode == 15 ||
         scancode == 29 || scancode == 42  ){
-        send_eoi(KEYBORAD_IRQ);
         return;
     }
     // if the key pressed is controlled by Shift
@@ -256,13 +266,47 @@ void keyboard_handler(){
         curr_ascii_code = scancodes_table[scancode][capslock_f ^ (left_shift_f | right_shift_f)];
     }
 
-    // if (curr_ascii_code == 0){
-    //     send_eoi(KEYBORAD_IRQ);
-    //     return;
-    // }
-
-    send_eoi(KEYBORAD_IRQ);
     terminal_handler(curr_ascii_code);
+}
+
+/*
+ * keyboard_bottom_half:
+ * DESCRIPTION: the keyboard tasklet, handle the scancodes in the ring with
+ *              interrupts on. Echo, redraws and terminal switches are done here.
+ * INPUTS: data -- unused
+ * OUTPUTS: none
+ * RETURN: none
+ */
+static void keyboard_bottom_half(uint32_t data){
+    uint8_t scancode;
+
+    while (scancode_tail != scancode_head) {
+        scancode = scancode_ring[scancode_tail % SCANCODE_RING_SIZE];
+        scancode_tail++;
+        keyboard_handle_scancode(scancode);
+    }
+}
 
-    return;
+/*
+ * keyboard_handler:
+ * DESCRIPTION: the top half, queue the scancode and leave the rest to the
+ *              keyboard tasklet
+ * INPUTS: none
+ * OUTPUTS: none
+ * RETURN: none
+ */
+void keyboard_handler(){
+    uint32_t start = (uint32_t) rdtsc();
+    uint8_t scancode = inb(KEY_DATA_PORT);
+
+    if (scancode_head - scancode_tail < SCANCODE_RING_SIZE) {
+        scancode_ring[scancode_head % SCANCODE_RING_SIZE] = scancode;
+        scancode_head++;
+        tasklet_schedule(&keyboard_tasklet);
+    } else {
+        irq_account_drop(KEYBORAD_IRQ);
+    }
+    send_eoi(KEYBORAD_IRQ);
+    irq_account_top(KEYBORAD_IRQ, start);
+    irq_exit();
 }
@@ -32,16 +32,16 @@
 #define CODE_SPACE           0x20
 
 #define CODE_F1_PRESS        0x3B
-#define CODE_F2_PRESS        0x3C
-#define CODE_F3_PRESS        0x3D
-#define CODE_F1_RELEASE      0xBB
-#define CODE_F2_RELEASE      0xBC
-#define CODE_F3_RELEASE      0xBD
+#define CODE_F10_PRESS       0x44     // F1 to F10 are in a row
+#define CODE_F11_PRESS       0x57
+#define CODE_F12_PRESS       0x58
+#define CODE_RELEASE         0x80     // set in the scancode of a key release
 
 #define KEY_DATA_PORT        0x60
 #define KEYBORAD_IRQ         0x01
 #define EMPTY                0x00
 #define MAX_SANCODES         0x5A
+#define SCANCODE_RING_SIZE   64      // power of 2, scancodes waiting for the bottom half
 
 extern int32_t get_ctrl_f(void);
 
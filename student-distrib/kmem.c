@@ -0,0 +1,49 @@
+#include "kmem.h"
+
+#include "lib.h"
+#include "task.h"
+#include "spinlock.h"
+
+/* end of the kernel image (bss included), from the linker */
+extern uint8_t _end[];
+
+/* the kernel stack of the last pid begins here, see get_kernel_stack */
+#define KMEM_END    (STACK_BASE_8_MB - MAX_TASK_NUM * STACK_SIZE_8_KB)
+
+static spinlock_t kmem_lock;
+static uint32_t kmem_next;          // first free byte
+
+/*
+ *  kmem_init
+ *  DESCRIPTION: start handing out the memory past the kernel image
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void kmem_init(void)
+{
+    spin_lock_init(&kmem_lock, "kmem");
+    kmem_next = ((uint32_t) _end + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1);
+}
+
+/*
+ *  kmem_alloc
+ *  DESCRIPTION: take memory for good, it is never given back
+ *  INPUTS: size -- bytes wanted
+ *  OUTPUTS: none
+ *  RETURN VALUE: the memory, not cleared, NULL if not enough is left
+ */
+void* kmem_alloc(uint32_t size)
+{
+    uint32_t flags;
+    void* mem = NULL;
+
+    size = (size + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1);
+    spin_lock_irqsave(&kmem_lock, flags);
+    if (size <= KMEM_END - kmem_next) {
+        mem = (void*) kmem_next;
+        kmem_next += size;
+    }
+    spin_unlock_irqrestore(&kmem_lock, flags);
+    return mem;
+}
@@ -0,0 +1,18 @@
+#ifndef _KMEM_H
+#define _KMEM_H
+
+#include "types.h"
+
+/*
+ * Memory of the kernel page between the end of the kernel image and the
+ * kernel stacks of the tasks, handed out for good: for state that is
+ * set up when first needed and then stays, like a terminal opened late.
+ */
+void kmem_init(void);
+
+/* size bytes aligned on KMEM_ALIGN, NULL when the memory runs out */
+void* kmem_alloc(uint32_t size);
+
+#define KMEM_ALIGN      16
+
+#endif /* _KMEM_H */
@@ -0,0 +1,88 @@
+#include "kthread.h"
+
+#include "smp.h"
+#include "spinlock.h"
+#include "scheduler.h"
+
+/*
+ *  kthread_start
+ *  DESCRIPTION: first code of a kernel thread, switched to with sched_lock
+ *               held and interrupts off
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: never returns
+ */
+static void kthread_start(void)
+{
+    pcb_t* self = get_current_pcb();
+
+    schedule_tail();
+    sti();
+    self->kthread_fn(self->kthread_arg);
+    kthread_exit();
+}
+
+/*
+ *  kthread_create
+ *  DESCRIPTION: start a function in a new kernel thread, queued on this CPU
+ *  INPUTS: fn -- body of the thread, returning from it ends the thread
+ *          arg -- passed to fn
+ *          name -- shown by top, cut at TASK_NAME_LEN - 1
+ *  OUTPUTS: none
+ *  RETURN VALUE: the pcb of the thread, NULL if no pid is left
+ */
+pcb_t* kthread_create(void (*fn)(void* arg), void* arg, const int8_t* name)
+{
+    pcb_t* pcb;
+    uint32_t* frame;
+    uint32_t flags;
+    int32_t pid;
+
+    pid = allocate_pid();
+    if (pid == -1) {
+        return NULL;
+    }
+    pcb = create_pcb(pid);
+    pcb->kthread = 1;
+    pcb->kthread_fn = fn;
+    pcb->kthread_arg = arg;
+    strncpy((int8_t*) pcb->name, name, TASK_NAME_LEN - 1);
+
+    // switch_to jumps to kthread_start as if called, with a null return address
+    frame = (uint32_t*) get_kernel_stack(pid) - 1;
+    *frame = 0;
+    pcb->context.esp = (uint32_t) frame;
+    pcb->context.eip = (uint32_t) kthread_start;
+
+    spin_lock_irqsave(&sched_lock, flags);
+    pcb->cpu = this_cpu()->id;
+    pcb->state = TASK_RUNNABLE;
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    return pcb;
+}
+
+/*
+ *  kthread_exit
+ *  DESCRIPTION: end the current kernel thread, its pid is given back by the
+ *               next task to run on this CPU (finish_task_switch)
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: never returns
+ */
+void kthread_exit(void)
+{
+    pcb_t* self = get_current_pcb();
+    uint32_t flags;
+
+    spin_lock_irqsave(&sched_lock, flags);
+    self->state = TASK_WAITING;
+    this_cpu()->dead_pid = self->pid;
+    while (1) {
+        switch_to_task(pick_next_task());
+        // nobody can run, wait for an interrupt to wake someone up
+        spin_unlock_no_resched(&sched_lock);
+        sti_hlt_cli();
+        spin_lock(&sched_lock);
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef _KTHREAD_H
+#define _KTHREAD_H
+
+#include "types.h"
+#include "lib.h"
+#include "task.h"
+
+/*
+ * Kernel threads: tasks with a pcb and a kernel stack but no program image
+ * or terminal. The scheduler runs them like any other task, so an idle CPU
+ * may steal them. They run with interrupts on and never return to user mode.
+ */
+
+/* Start fn(arg) in a new kernel thread, NULL if no pid is left */
+pcb_t* kthread_create(void (*fn)(void* arg), void* arg, const int8_t* name);
+
+/* End the current kernel thread, also what returning from its function does */
+void kthread_exit(void);
+
+#endif /* _KTHREAD_H */
@@ -0,0 +1,168 @@
+#include "latency.h"
+
+#include "smp.h"
+#include "task.h"
+#include "syscall.h"
+
+/* Sections being measured on a CPU, and the worst ones seen */
+typedef struct latency_cpu_t {
+    uint8_t  irqs_off;                  // a section with interrupts off is open
+    uint32_t irqs_off_since;
+    uint32_t irqs_off_ip;
+    uint32_t preempt_off_since;
+    uint32_t preempt_off_ip;
+    latency_stats_t stats;
+} latency_cpu_t;
+
+/* written by their own CPU only, with interrupts off */
+static latency_cpu_t lat_cpu[MAX_CPUS];
+
+/* low word of the TSC when a task was woken up, 0 if it is not waiting for a CPU */
+static volatile uint32_t wake_since[MAX_TASK_NUM];
+
+/* the low word of the TSC, never 0 so that 0 can mean "not started" */
+static inline uint32_t tsc_stamp(void)
+{
+    return (uint32_t) rdtsc() | 1;
+}
+
+/*
+ *  trace_hardirqs_off
+ *  DESCRIPTION: open a section with interrupts off on this CPU, unless one is
+ *               open already
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void trace_hardirqs_off(void)
+{
+    latency_cpu_t* lat = &lat_cpu[this_cpu()->id];
+
+    if (!lat->irqs_off) {
+        lat->irqs_off = 1;
+        lat->irqs_off_ip = _RET_IP_;
+        lat->irqs_off_since = tsc_stamp();
+    }
+}
+
+/*
+ *  trace_hardirqs_on
+ *  DESCRIPTION: close the section with interrupts off of this CPU, called
+ *               just before they are turned on again
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void trace_hardirqs_on(void)
+{
+    latency_cpu_t* lat = &lat_cpu[this_cpu()->id];
+    uint32_t len;
+
+    if (!lat->irqs_off) {
+        return;
+    }
+    lat->irqs_off = 0;
+    len = tsc_stamp() - lat->irqs_off_since;
+    if (len > lat->stats.irqsoff_max) {
+        lat->stats.irqsoff_max = len;
+        lat->stats.irqsoff_ip = lat->irqs_off_ip;
+    }
+}
+
+/*
+ *  trace_preempt_off
+ *  DESCRIPTION: the preempt count of this CPU went from 0 to 1
+ *  INPUTS: ip -- code that raised it
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void trace_preempt_off(uint32_t ip)
+{
+    latency_cpu_t* lat = &lat_cpu[this_cpu()->id];
+
+    lat->preempt_off_ip = ip;
+    lat->preempt_off_since = tsc_stamp();
+}
+
+/*
+ *  trace_preempt_on
+ *  DESCRIPTION: the preempt count of this CPU came back to 0
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void trace_preempt_on(void)
+{
+    latency_cpu_t* lat = &lat_cpu[this_cpu()->id];
+    uint32_t len;
+
+    if (lat->preempt_off_since == 0) {
+        return;
+    }
+    len = tsc_stamp() - lat->preempt_off_since;
+    lat->preempt_off_since = 0;
+    if (len > lat->stats.preemptoff_max) {
+        lat->stats.preemptoff_max = len;
+        lat->stats.preemptoff_ip = lat->preempt_off_ip;
+    }
+}
+
+/*
+ *  trace_wakeup
+ *  DESCRIPTION: a sleeping task became runnable, start timing its wait
+ *  INPUTS: pid -- the task
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void trace_wakeup(int32_t pid)
+{
+    wake_since[pid] = tsc_stamp();
+}
+
+/*
+ *  trace_switch_in
+ *  DESCRIPTION: a task got this CPU, charge its wait since task_wake
+ *  INPUTS: pid -- the task
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void trace_switch_in(int32_t pid)
+{
+    latency_stats_t* st = &lat_cpu[this_cpu()->id].stats;
+    uint32_t len;
+
+    if (wake_since[pid] == 0) {
+        return;
+    }
+    len = tsc_stamp() - wake_since[pid];
+    wake_since[pid] = 0;
+    if (len > st->wakeup_max) {
+        st->wakeup_max = len;
+        st->wakeup_pid = pid;
+    }
+}
+
+/*
+ *  latstat
+ *  DESCRIPTION: the latstat system call, copy the worst cases of a CPU
+ *  INPUTS: cpu -- 0 to the number of CPUs - 1
+ *          buf -- user buffer receiving a latency_stats_t
+ *          reset -- non-zero to start measuring again afterwards
+ *  OUTPUTS: none
+ *  RETURN VALUE: 0 on success, -1 if there is no such CPU or buf is not a user address
+ */
+int32_t latstat(int32_t cpu, latency_stats_t* buf, int32_t reset)
+{
+    if (cpu < 0 || cpu >= nr_cpus) {
+        return -1;
+    }
+    if ((uint32_t) buf < USER_MEM || (uint32_t) buf > USER_MEM_END - sizeof(latency_stats_t)) {
+        return -1;
+    }
+    // a snapshot, the CPU may be updating it meanwhile
+    memcpy(buf, &lat_cpu[cpu].stats, sizeof(latency_stats_t));
+    if (reset) {
+        memset(&lat_cpu[cpu].stats, 0, sizeof(latency_stats_t));
+    }
+    return 0;
+}
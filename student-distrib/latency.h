@@ -0,0 +1,43 @@
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include "types.h"
+#include "lib.h"
+
+/* address the function using it returns to, where a traced section began */
+#define _RET_IP_    ((uint32_t) __builtin_return_address(0))
+
+/*
+ * Worst cases of one CPU, times in TSC cycles. A task woken up waits at
+ * most for the longest section with preemption off, and an interrupt
+ * for the longest section with interrupts off.
+ */
+typedef struct latency_stats_t {
+    uint32_t irqsoff_max;               // longest stretch with interrupts off
+    uint32_t irqsoff_ip;                // code that turned them off
+    uint32_t preemptoff_max;            // longest stretch with the preempt count above 0
+    uint32_t preemptoff_ip;             // code that raised the count from 0
+    uint32_t wakeup_max;                // longest task_wake to running on the CPU
+    int32_t  wakeup_pid;                // task that waited for it
+} latency_stats_t;
+
+/*
+ * Interrupts of this CPU turned off and on again. The cli and sti macros of
+ * lib.h and the interrupt entry code call these, a section that nobody
+ * marked as started is not measured.
+ */
+void trace_hardirqs_off(void);
+void trace_hardirqs_on(void);
+
+/* The preempt count of this CPU left 0, and came back to it */
+void trace_preempt_off(uint32_t ip);
+void trace_preempt_on(void);
+
+/* A task became runnable, and got a CPU (sched_lock held) */
+void trace_wakeup(int32_t pid);
+void trace_switch_in(int32_t pid);
+
+/* The latstat system call, copy (and clear) the worst cases of a CPU */
+int32_t latstat(int32_t cpu, latency_stats_t* buf, int32_t reset);
+
+#endif /* _LATENCY_H */
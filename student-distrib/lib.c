@@ -3,14 +3,37 @@
 
 #include "lib.h"
 #include "scheduler.h"
+#include "smp.h"
 
-static int screen_x;
-static int screen_y;
-static int current_show_y;
-static int view_history_show_y;
-static char* video_mem = (char*) VIDEO;
-static char* buf_video_mem = terminal_info_array[0].buf_video_mem;
+/*
+ * The terminal whose screen putc/printf currently draw on (the running
+ * terminal, or the active one while the keyboard echoes input), one per CPU.
+ * Finding this CPU reads its local APIC ID, so every entry point below looks
+ * the terminal up once and the helpers get it as t.
+ */
+static inline terminal_info_t* screen_term(void)
+{
+    return this_cpu()->screen;
+}
 
+/* address of the cell (x, y) of the screen of t in video memory */
+#define SCREEN_CELL(t, x, y)    ((t)->video_mem + ((NUM_COLS * ((t)->video_top + (y)) + (x)) << 1))
+
+/* address of the cell (x, y) of the screen of t in its buffer */
+#define BUF_CELL(t, x, y)       ((t)->buf_video_mem + ((NUM_COLS * (((t)->current_show_y + (y)) % NUM_ROWS) + (x)) << 1))
+
+/* offset in cells of a screen cell from the start of VGA text memory */
+#define DISPLAY_POS(t, x, y)    ((uint16_t) ((SCREEN_CELL(t, x, y) - (char*) VIDEO) >> 1))
+
+static void term_update_cursor(terminal_info_t* t);
+static void term_update_screen_start(terminal_info_t* t);
+static void term_screen_refresh(terminal_info_t* t);
+static void term_putc(terminal_info_t* t, uint8_t c);
+static int32_t term_puts(terminal_info_t* t, int8_t* s);
+static void term_vt_reset(terminal_info_t* t);
+static void move_screen(terminal_info_t* t, int32_t rows);
+static void draw_rows(terminal_info_t* t, int32_t top, int32_t bottom);
+static void new_line(terminal_info_t* t);
 
 /* void update_cursor(void);
  * Inputs: void
@@ -20,7 +43,13 @@ static char* buf_video_mem = terminal_info_array[0].buf_video_mem;
  */
 void update_cursor(void)
 {
-    uint16_t pos = screen_y * NUM_COLS + screen_x;
+    term_update_cursor(screen_term());
+}
+
+/* update_cursor on the screen of t */
+static void term_update_cursor(terminal_info_t* t)
+{
+    uint16_t pos = DISPLAY_POS(t, t->screen_x, t->screen_y);
     outb(0x0E, CURSOR_LOW);
     outb((uint8_t)((pos >> 8) & LOWER_MASK), CURSOR_HIGH);
     outb(0x0F, CURSOR_LOW);
@@ -35,44 +64,139 @@ void update_cursor(void)
  */
 void init_cursor(void)
 {
-    uint16_t pos = 0;
-    screen_x = 0;
-    screen_y = 0;
+    terminal_info_t* t = screen_term();
+    uint16_t pos;
+    t->screen_x = 0;
+    t->screen_y = 0;
+    pos = DISPLAY_POS(t, 0, 0);
     outb(0x0E, CURSOR_LOW);
     outb((uint8_t)((pos >> 8) & LOWER_MASK), CURSOR_HIGH);
     outb(0x0F, CURSOR_LOW);
     outb((uint8_t)(pos & LOWER_MASK), CURSOR_HIGH);
 }
 
+/* void update_screen_start(void);
+ * Inputs: void
+ * Return Value: none
+ * Function: display the screen of the screen terminal (the terminal on display) from its
+ *           top row on, by moving the CRTC start address
+ * refrence: http://www.osdever.net/FreeVGA/vga/crtcreg.htm
+ */
+void update_screen_start(void)
+{
+    term_update_screen_start(screen_term());
+}
+
+/* update_screen_start for the screen of t */
+static void term_update_screen_start(terminal_info_t* t)
+{
+    uint16_t pos = DISPLAY_POS(t, 0, 0);
+    outb(VGA_START_HIGH, CURSOR_LOW);
+    outb((uint8_t)((pos >> 8) & LOWER_MASK), CURSOR_HIGH);
+    outb(VGA_START_LOW, CURSOR_LOW);
+    outb((uint8_t)(pos & LOWER_MASK), CURSOR_HIGH);
+}
+
+/* screen of t is on display */
+static int32_t on_display(terminal_info_t* t)
+{
+    return t == terminal_info_array[curr_active_terminal];
+}
+
+/* a program drew on the screen of t through vidmap, which maps only its first rows */
+static int32_t screen_pinned(terminal_info_t* t)
+{
+    return t->vidmap_pid != -1 && t->vidmap_pid == t->curr_pid;
+}
+
+/* the screen of t is hidden and left behind its buffer (lazy_render, or
+ * its video memory is shared), marked stale for screen_refresh if so */
+static int32_t screen_deferred(terminal_info_t* t)
+{
+    if (on_display(t) || screen_pinned(t) || (!lazy_render && !t->video_shared)) {
+        return 0;
+    }
+    t->screen_stale = 1;
+    return 1;
+}
+
+/* void screen_refresh(void);
+ * Inputs: void
+ * Return Value: none
+ * Function: draw the screen of the screen terminal again from its buffer, at the first rows
+ *           of its video memory, if output to it was deferred
+ */
+void screen_refresh(void)
+{
+    term_screen_refresh(screen_term());
+}
+
+/* screen_refresh of the screen of t */
+static void term_screen_refresh(terminal_info_t* t)
+{
+    if (!t->screen_stale) {
+        return;
+    }
+    t->screen_stale = 0;
+    t->video_top = 0;
+    t->view_history_show_y = t->current_show_y;
+    show_screen(t, t->current_show_y);
+    t->stats.redraws++;
+}
+
+/* void screen_home(void);
+ * Inputs: void
+ * Return Value: none
+ * Function: move the screen of the screen terminal back to the first rows of its video
+ *           memory, where vidmap maps it
+ */
+void screen_home(void)
+{
+    terminal_info_t* t = screen_term();
+
+    term_screen_refresh(t);
+    if (t->video_top == 0) {
+        return;
+    }
+    memmove(t->video_mem, SCREEN_CELL(t, 0, 0), SCREEN_BYTES);
+    t->video_top = 0;
+    if (on_display(t)) {
+        term_update_screen_start(t);
+        term_update_cursor(t);
+    }
+}
+
 /* void backspace_handler(void);
  * Inputs: none
  * Return Value: none
  * Function: Clear the current character which is triggered by pressing backspace */
 void backspace_handler(){
+    terminal_info_t* t = screen_term();
+
     //firstly, if any character is printed, recover the terminal from the view history mode
-    if (current_show_y != view_history_show_y){
-        show_screen(current_show_y);
-        view_history_show_y = current_show_y;
+    if (t->current_show_y != t->view_history_show_y){
+        show_screen(t, t->current_show_y);
+        t->view_history_show_y = t->current_show_y;
     }
 
     //in the case the character is at the new line
-    if (screen_x == 0){
-        if (screen_y == 0){
+    if (t->screen_x == 0){
+        if (t->screen_y == 0){
             //if no character typed, do nothing and simply return
             return;
         }
-        screen_y--; //back to last row
-        screen_x = NUM_COLS - 1;
+        t->screen_y--; //back to last row
+        t->screen_x = NUM_COLS - 1;
         //clear the current character
-        buffered_memload(current_show_y, screen_x, screen_y, ' ');
-        buffered_showchar(current_show_y, screen_x, screen_y);
+        buffered_memload(t, t->current_show_y, t->screen_x, t->screen_y, ' ');
+        buffered_showchar(t, t->current_show_y, t->screen_x, t->screen_y);
         //*(uint8_t *)(video_mem + ((NUM_COLS * screen_y + screen_x) << 1) + 1) = ATTRIB;
         return;
     }
     //if both of them are not zero
-    screen_x--;
-    buffered_memload(current_show_y, screen_x, screen_y, ' ');
-    buffered_showchar(current_show_y, screen_x, screen_y);
+    t->screen_x--;
+    buffered_memload(t, t->current_show_y, t->screen_x, t->screen_y, ' ');
+    buffered_showchar(t, t->current_show_y, t->screen_x, t->screen_y);
 
     return;
 }
@@ -80,17 +204,25 @@ void backspace_handler(){
 /* void clear(void);
  * Inputs: void
  * Return Value: none
- * Function: Clears video memory and buffer video memory*/
+ * Function: Clears video memory and buffer video memory, and the scrollback*/
 void clear(void) {
+    terminal_info_t* t = screen_term();
     int32_t i;
-    for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
-        *(uint8_t *)(video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(video_mem + (i << 1) + 1) = ATTRIB;
+    t->video_top = 0;
+    if (!screen_deferred(t)) {
+        for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
+            *(uint8_t *)(t->video_mem + (i << 1)) = ' ';
+            *(uint8_t *)(t->video_mem + (i << 1) + 1) = ATTRIB;
+        }
+        if (on_display(t)) {
+            term_update_screen_start(t);
+        }
     }
-    for (i = 0; i < 10* NUM_ROWS * NUM_COLS; i++) {
-        *(uint8_t *)(buf_video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(buf_video_mem + (i << 1) + 1) = ATTRIB;
+    for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
+        *(uint8_t *)(t->buf_video_mem + (i << 1)) = ' ';
+        *(uint8_t *)(t->buf_video_mem + (i << 1) + 1) = ATTRIB;
     }
+    scrollback_clear(&t->history, t->current_show_y);
 }
 
 /*
@@ -101,11 +233,12 @@ void clear(void) {
  *  SIDE EFFECTS: none
  */
 void blue_screen() {
+    terminal_info_t* t = screen_term();
     int32_t i;  /* index variable */
 
     for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
-        *(uint8_t *)(video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(video_mem + (i << 1) + 1) = 0x1F; // 0x1F - blue color  
+        *(uint8_t *)(SCREEN_CELL(t, 0, 0) + (i << 1)) = ' ';
+        *(uint8_t *)(SCREEN_CELL(t, 0, 0) + (i << 1) + 1) = 0x1F; // 0x1F - blue color  
     }
 
 }
@@ -120,24 +253,26 @@ void blue_screen() {
  */
 
 void scroll_and_view_history(int32_t dir_up, int32_t dir_down){
+    terminal_info_t* t = screen_term();
+
     //if no direction, do nothing and return
     if (dir_down == dir_up){
         return;
     }
     //move up towards the history
     if (dir_up == 1){
-        if (view_history_show_y > 0){
-            view_history_show_y--;
-            show_screen(view_history_show_y);
+        if (t->view_history_show_y > t->history.first){
+            t->view_history_show_y--;
+            show_screen(t, t->view_history_show_y);
         }else{
             return;
         }       
     }
     //move down towards the current
     if (dir_down == 1){
-        if (view_history_show_y < current_show_y){  //if it do not exceed the current row
-            view_history_show_y++;
-            show_screen(view_history_show_y);
+        if (t->view_history_show_y < t->current_show_y){  //if it do not exceed the current row
+            t->view_history_show_y++;
+            show_screen(t, t->view_history_show_y);
         }else{
             return;
         }
@@ -148,65 +283,221 @@ void scroll_and_view_history(int32_t dir_up, int32_t dir_down){
 /*
  * buffered_showchar
  *  DESCRIPTION: show the scrolled screen according to y coordinate in the buffer
- *  INPUTS: scroll_y, the top line to show
+ *  INPUTS: t, the terminal
+ *          scroll_y, the top line to show
  *          x, y - the coordinate
  *  RETURN VALUES: none
  *  SIDE EFFECTS: none
  */
-void buffered_showchar(int32_t scroll_y, int32_t x, int32_t y){
-    *(uint8_t *)(video_mem + ((NUM_COLS * (y) + x) << 1)) = 
-    *(uint8_t *)(buf_video_mem + ((NUM_COLS * ((scroll_y + y) % BUF_LEN) + x) << 1));
-    *(uint8_t *)(video_mem + ((NUM_COLS * (y) + x) << 1) + 1) = 
-    *(uint8_t *)(buf_video_mem + ((NUM_COLS * ((scroll_y + y) % BUF_LEN) + x) << 1) + 1);
+void buffered_showchar(terminal_info_t* t, int32_t scroll_y, int32_t x, int32_t y){
+    *(uint8_t *)(SCREEN_CELL(t, x, y)) = 
+    *(uint8_t *)(t->buf_video_mem + ((NUM_COLS * ((scroll_y + y) % NUM_ROWS) + x) << 1));
+    *(uint8_t *)(SCREEN_CELL(t, x, y) + 1) = 
+    *(uint8_t *)(t->buf_video_mem + ((NUM_COLS * ((scroll_y + y) % NUM_ROWS) + x) << 1) + 1);
 }
 
 
 /*
  * buffered_memload
  *  DESCRIPTION: load the character into the buffer
- *  INPUTS: scroll_y, the top line to show
+ *  INPUTS: t, the terminal
+ *          scroll_y, the top line to show
  *          x, y - the coordinate
  *  RETURN VALUES: none
  *  SIDE EFFECTS: none
  */
-void buffered_memload(int32_t scroll_y, int32_t x, int32_t y, uint8_t c){
-    *(uint8_t *)(buf_video_mem + ((NUM_COLS * ((scroll_y + y) % BUF_LEN) + x) << 1)) = c;
-    *(uint8_t *)(buf_video_mem + ((NUM_COLS * ((scroll_y + y) % BUF_LEN) + x) << 1) + 1) = ATTRIB;
+void buffered_memload(terminal_info_t* t, int32_t scroll_y, int32_t x, int32_t y, uint8_t c){
+    *(uint8_t *)(t->buf_video_mem + ((NUM_COLS * ((scroll_y + y) % NUM_ROWS) + x) << 1)) = c;
+    *(uint8_t *)(t->buf_video_mem + ((NUM_COLS * ((scroll_y + y) % NUM_ROWS) + x) << 1) + 1) = t->vt.attrib;
 }
 
 /*
  * show_screen
  *  DESCRIPTION: show the scrolled screen
- *  INPUTS: scroll_y, the top line to show
+ *  INPUTS: t, the terminal
+ *          scroll_y, the top line to show
  *  RETURN VALUES: none
  *  SIDE EFFECTS: none
  */
-void show_screen(int32_t scroll_y) {
-    int32_t x, y;  /* index variable */
+void show_screen(terminal_info_t* t, int32_t scroll_y) {
+    int32_t y;  /* index variable */
 
-    for (x = 0; x < NUM_COLS; x++){
-        for (y = 0; y < NUM_ROWS; y++){
-            buffered_showchar(scroll_y, x, y);
-        }
+    for (y = 0; y < NUM_ROWS; y++){
+        show_row(t, scroll_y, y);
     }
 
 }
 
+/*
+ * show_row
+ *  DESCRIPTION: show one row of the scrolled screen, from the rows of the
+ *               screen in the buffer or from the scrollback above them
+ *  INPUTS: t, the terminal
+ *          scroll_y, the top line to show
+ *          y - the row
+ *  RETURN VALUES: none
+ *  SIDE EFFECTS: none
+ */
+void show_row(terminal_info_t* t, int32_t scroll_y, int32_t y) {
+    int32_t line = scroll_y + y;
+
+    if (line >= t->current_show_y) {
+        memcpy(SCREEN_CELL(t, 0, y), BUF_CELL(t, 0, line - t->current_show_y), ROW_BYTES);
+    } else {
+        scrollback_get(&t->history, line, (uint8_t*) SCREEN_CELL(t, 0, y));
+    }
+}
 
 /*
- * clear_curr_line
- *  DESCRIPTION: clear the current line in the buffer
- *  INPUTS: scroll_y, the top line to show
+ * move_screen
+ *  DESCRIPTION: scroll the screen of t up by rows, the rows coming in
+ *               are left for the caller to draw. The screen moves down over
+ *               the rows of its video memory (the CRTC start address follows
+ *               it on display, see update_screen_start), and is only copied
+ *               back to the first rows when it reaches the last one.
+ *  INPUTS: t - the terminal
+ *          rows - rows to scroll, NUM_ROWS or more leaves nothing to keep
  *  RETURN VALUES: none
  *  SIDE EFFECTS: none
  */
-void clear_curr_line(int32_t scroll_y, int32_t y) {
-    int32_t x;  /* index variable */
+static void move_screen(terminal_info_t* t, int32_t rows) {
+    // a vidmap program only sees the first rows, its screen scrolls in place
+    int32_t video_rows = screen_pinned(t) ? NUM_ROWS : t->video_rows;
 
-    for (x = 0; x < NUM_COLS; x++){
-        buffered_memload(scroll_y, x, y, ' ');
+    if (rows > NUM_ROWS) {
+        rows = NUM_ROWS;
     }
+    if (t->video_top + rows + NUM_ROWS <= video_rows) {
+        t->video_top += rows;
+    } else {
+        memmove(t->video_mem, SCREEN_CELL(t, 0, rows), SCREEN_BYTES - rows * ROW_BYTES);
+        t->video_top = 0;
+    }
+}
 
+/*
+ * draw_rows
+ *  DESCRIPTION: draw rows of the screen of t from its buffer, unless the
+ *               screen is hidden (see screen_deferred)
+ *  INPUTS: t - the terminal
+ *          top, bottom - the first and the last row
+ *  RETURN VALUES: none
+ *  SIDE EFFECTS: none
+ */
+static void draw_rows(terminal_info_t* t, int32_t top, int32_t bottom) {
+    if (screen_deferred(t)) {
+        return;
+    }
+    for (; top <= bottom; top++) {
+        show_row(t, t->current_show_y, top);
+    }
+}
+
+/*
+ * scroll_rows
+ *  DESCRIPTION: scroll rows of the screen of t, in its buffer only (the
+ *               scrollback does not see it), and draw them. The rows coming
+ *               in are empty.
+ *  INPUTS: t - the terminal
+ *          top, bottom - the first and the last row scrolled
+ *          n - rows to scroll up by, down if negative
+ *  RETURN VALUES: none
+ *  SIDE EFFECTS: none
+ */
+static void scroll_rows(terminal_info_t* t, int32_t top, int32_t bottom, int32_t n) {
+    int32_t y;
+    int32_t rows = bottom - top + 1;
+
+    if (n > rows) {
+        n = rows;
+    } else if (n < -rows) {
+        n = -rows;
+    }
+    if (n > 0) {
+        for (y = top; y + n <= bottom; y++) {
+            memcpy(BUF_CELL(t, 0, y), BUF_CELL(t, 0, y + n), ROW_BYTES);
+        }
+        for (; y <= bottom; y++) {
+            clear_curr_line(t, t->current_show_y, y);
+        }
+    } else if (n < 0) {
+        for (y = bottom; y + n >= top; y--) {
+            memcpy(BUF_CELL(t, 0, y), BUF_CELL(t, 0, y + n), ROW_BYTES);
+        }
+        for (; y >= top; y--) {
+            clear_curr_line(t, t->current_show_y, y);
+        }
+    }
+    draw_rows(t, top, bottom);
+}
+
+/* the scroll region of t is the whole screen */
+static int32_t full_region(terminal_info_t* t) {
+    return t->vt.top == 0 && t->vt.bottom == NUM_ROWS - 1;
+}
+
+/*
+ * next_line
+ *  DESCRIPTION: move the position of t to the start of the next line.
+ *               On the last one, the top line goes to the scrollback and
+ *               the buffer gets a new empty line, the screen is left to
+ *               the caller. At the bottom of a smaller
+ *               scroll region, the region scrolls instead (and is drawn).
+ *  INPUTS: t - the terminal
+ *  RETURN VALUES: 1 if the screen has to scroll by a row, 0 otherwise
+ *  SIDE EFFECTS: none
+ */
+static int32_t next_line(terminal_info_t* t) {
+    t->screen_x = 0;
+    if (t->screen_y == t->vt.bottom && !full_region(t)) {
+        scroll_rows(t, t->vt.top, t->vt.bottom, 1);
+        return 0;
+    }
+    if (t->screen_y < NUM_ROWS - 1) {
+        t->screen_y++;
+        return 0;
+    }
+    if (!full_region(t)) {
+        // below the scroll region, the last line is written over
+        return 0;
+    }
+    // the top row leaves the screen, its place in the buffer is the new last one
+    scrollback_push(&t->history, (uint8_t*) BUF_CELL(t, 0, 0));
+    t->current_show_y++;
+    clear_curr_line(t, t->current_show_y, t->screen_y);
+    return 1;
+}
+
+/*
+ * new_line
+ *  DESCRIPTION: move the position of t to the start of the next line,
+ *               scroll when it is on the last one
+ *  INPUTS: t - the terminal
+ *  RETURN VALUES: none
+ *  SIDE EFFECTS: none
+ */
+static void new_line(terminal_info_t* t) {
+    if (next_line(t) && !screen_deferred(t)) {
+        move_screen(t, 1);
+        // the new row is drawn before the display moves onto it
+        show_row(t, t->current_show_y, NUM_ROWS - 1);
+        if (on_display(t)) {
+            term_update_screen_start(t);
+        }
+    }
+}
+
+
+/*
+ * clear_curr_line
+ *  DESCRIPTION: clear the current line in the buffer
+ *  INPUTS: t, the terminal
+ *          scroll_y, the top line to show
+ *  RETURN VALUES: none
+ *  SIDE EFFECTS: none
+ */
+void clear_curr_line(terminal_info_t* t, int32_t scroll_y, int32_t y) {
+    memset_word(t->buf_video_mem + NUM_COLS * ((scroll_y + y) % NUM_ROWS) * 2, (t->vt.attrib << 8) | ' ', NUM_COLS);
 }
 
 
@@ -228,6 +519,7 @@ void clear_curr_line(int32_t scroll_y, int32_t y) {
  *       Also note: %x is the only conversion specifier that can use
  *       the "#" modifier to alter output. */
 int32_t printf(int8_t *format, ...) {
+    terminal_info_t* t = screen_term();
 
     /* Pointer to the format string */
     int8_t* buf = format;
@@ -248,7 +540,7 @@ format_char_switch:
                     switch (*buf) {
                         /* Print a literal '%' character */
                         case '%':
-                            putc('%');
+                            term_putc(t, '%');
                             break;
 
                         /* Use alternate formatting */
@@ -266,7 +558,7 @@ format_char_switch:
                                 int8_t conv_buf[64];
                                 if (alternate == 0) {
                                     itoa(*((uint32_t *)esp), conv_buf, 16);
-                                    puts(conv_buf);
+                                    term_puts(t, conv_buf);
                                 } else {
                                     int32_t starting_index;
                                     int32_t i;
@@ -276,7 +568,7 @@ format_char_switch:
                                         conv_buf[i] = '0';
                                         i++;
                                     }
-                                    puts(&conv_buf[starting_index]);
+                                    term_puts(t, &conv_buf[starting_index]);
                                 }
                                 esp++;
                             }
@@ -287,7 +579,7 @@ format_char_switch:
                             {
                                 int8_t conv_buf[36];
                                 itoa(*((uint32_t *)esp), conv_buf, 10);
-                                puts(conv_buf);
+                                term_puts(t, conv_buf);
                                 esp++;
                             }
                             break;
@@ -303,20 +595,20 @@ format_char_switch:
                                 } else {
                                     itoa(value, conv_buf, 10);
                                 }
-                                puts(conv_buf);
+                                term_puts(t, conv_buf);
                                 esp++;
                             }
                             break;
 
                         /* Print a single character */
                         case 'c':
-                            putc((uint8_t) *((int32_t *)esp));
+                            term_putc(t, (uint8_t) *((int32_t *)esp));
                             esp++;
                             break;
 
                         /* Print a NULL-terminated string */
                         case 's':
-                            puts(*((int8_t **)esp));
+                            term_puts(t, *((int8_t **)esp));
                             esp++;
                             break;
 
@@ -328,7 +620,7 @@ format_char_switch:
                 break;
 
             default:
-                putc(*buf);
+                term_putc(t, *buf);
                 break;
         }
         buf++;
@@ -341,9 +633,14 @@ format_char_switch:
  *   Return Value: Number of bytes written
  *    Function: Output a string to the console */
 int32_t puts(int8_t* s) {
+    return term_puts(screen_term(), s);
+}
+
+/* puts on the screen of t */
+static int32_t term_puts(terminal_info_t* t, int8_t* s) {
     register int32_t index = 0;
     while (s[index] != '\0') {
-        putc(s[index]);
+        term_putc(t, s[index]);
         index++;
     }
     return index;
@@ -373,51 +670,462 @@ int32_t puts(int8_t* s) {
  * Return Value: void
  *  Function: Output a character to the console */
 void putc(uint8_t c) {
+    term_putc(screen_term(), c);
+}
+
+/* putc on the screen of t */
+static void term_putc(terminal_info_t* t, uint8_t c) {
     //firstly, if any character is printed, recover the terminal from the view history mode
-    if (current_show_y != view_history_show_y){
-        show_screen(current_show_y);
-        view_history_show_y = current_show_y;
+    if (t->current_show_y != t->view_history_show_y){
+        t->view_history_show_y = t->current_show_y;
+        if (!screen_deferred(t)) {
+            show_screen(t, t->current_show_y);
+        }
     }
 
     if (c == '\n' || c == '\r'){
-        if (screen_y == NUM_ROWS - 1){
-            //if already in last line, scroll down
-            //if it did not reach the end of the buffer
-            current_show_y++;
-            screen_x = 0;
-            clear_curr_line(current_show_y, screen_y);
-            show_screen(current_show_y);
-        }else{
-            screen_y++;
-            screen_x = 0;
+        new_line(t);
+        return;
+    }
+
+    buffered_memload(t, t->current_show_y, t->screen_x, t->screen_y, c);
+    if (screen_deferred(t)) {
+        t->stats.cells_deferred++;
+    } else {
+        buffered_showchar(t, t->current_show_y, t->screen_x, t->screen_y);
+        t->stats.cells_immediate++;
+    }
+    //if the line reach is right bound, go on with the next one
+    if (++t->screen_x == NUM_COLS){
+        new_line(t);
+    }
+}
+
+/* escape sequence parser states (vt_state_t) */
+#define VT_NORMAL   0
+#define VT_ESC      1           // after ESC
+#define VT_CSI      2           // after ESC [, reading parameters
+#define ESC         0x1B
+
+/* ANSI color number to VGA color, their red and blue bits are swapped */
+static const uint8_t vga_color[8] = {0, 4, 2, 6, 1, 5, 3, 7};
+
+/* void vt_reset(void);
+ * Inputs: void
+ * Return Value: none
+ * Function: forget the escape sequence state of the screen terminal: default colors, the
+ *           whole screen as scroll region, nothing saved */
+void vt_reset(void) {
+    term_vt_reset(screen_term());
+}
+
+/* vt_reset of t */
+static void term_vt_reset(terminal_info_t* t) {
+    memset(&t->vt, 0, sizeof(vt_state_t));
+    t->vt.sgr = ATTRIB;
+    t->vt.attrib = ATTRIB;
+    t->vt.bottom = NUM_ROWS - 1;
+    t->vt.saved_sgr = ATTRIB;
+}
+
+/* parameter i of the sequence of t, def if it is missing or 0 */
+static int32_t vt_param(terminal_info_t* t, int32_t i, int32_t def) {
+    if (i >= t->vt.nparams || t->vt.params[i] == 0) {
+        return def;
+    }
+    return t->vt.params[i];
+}
+
+/* value clamped to min..max */
+static int32_t clamp(int32_t value, int32_t min, int32_t max) {
+    return (value < min) ? min : (value > max) ? max : value;
+}
+
+/*
+ * vt_set_attrib
+ *  DESCRIPTION: the colors of t changed, work out the attribute of the
+ *               cells written from now on
+ *  INPUTS: t - the terminal
+ *  RETURN VALUES: none
+ *  SIDE EFFECTS: none
+ */
+static void vt_set_attrib(terminal_info_t* t) {
+    uint8_t sgr = t->vt.sgr;
+
+    if (sgr & 0x80) {
+        // reverse video, bold stays on the foreground
+        t->vt.attrib = (sgr & 0x08) | ((sgr >> 4) & 0x07) | ((sgr & 0x07) << 4);
+    } else {
+        t->vt.attrib = sgr;
+    }
+}
+
+/*
+ * vt_sgr
+ *  DESCRIPTION: select graphic rendition (CSI m): 0 default colors, 1/22
+ *               bold on/off, 7/27 reverse on/off, 30-37/39 foreground,
+ *               40-47/49 background, 90-97/100-107 bright colors. The VGA
+ *               background has no bright colors (the bit blinks), the normal
+ *               one is used.
+ *  INPUTS: t - the terminal
+ *  RETURN VALUES: none
+ *  SIDE EFFECTS: none
+ */
+static void vt_sgr(terminal_info_t* t) {
+    int32_t i, p;
+    uint8_t sgr = t->vt.sgr;
+
+    for (i = 0; i < t->vt.nparams; i++) {
+        p = t->vt.params[i];
+        if (p == 0) {
+            sgr = ATTRIB;
+        } else if (p == 1) {
+            sgr |= 0x08;
+        } else if (p == 22) {
+            sgr &= ~0x08;
+        } else if (p == 7) {
+            sgr |= 0x80;
+        } else if (p == 27) {
+            sgr &= ~0x80;
+        } else if (p >= 30 && p <= 37) {
+            sgr = (sgr & ~0x07) | vga_color[p - 30];
+        } else if (p == 39) {
+            sgr = (sgr & ~0x07) | (ATTRIB & 0x07);
+        } else if (p >= 40 && p <= 47) {
+            sgr = (sgr & ~0x70) | (vga_color[p - 40] << 4);
+        } else if (p == 49) {
+            sgr = (sgr & ~0x70) | (ATTRIB & 0x70);
+        } else if (p >= 90 && p <= 97) {
+            sgr = (sgr & ~0x07) | vga_color[p - 90] | 0x08;
+        } else if (p >= 100 && p <= 107) {
+            sgr = (sgr & ~0x70) | (vga_color[p - 100] << 4);
         }
-    }else{
-        //if the line reach is right bound
-        if (screen_x == NUM_COLS - 1){
-            //if already in the last place
-            if (screen_y == NUM_ROWS - 1){
-                //if it did not reach the end of the buffer
-                current_show_y++;
-                screen_x = 0;
-                clear_curr_line(current_show_y, screen_y);
-                buffered_memload(current_show_y, screen_x, screen_y, c);
-                show_screen(current_show_y);
-            }else{
-                //if not in the last place
-                buffered_memload(current_show_y, screen_x, screen_y, c);
-                buffered_showchar(current_show_y, screen_x, screen_y);
-                screen_y++;
-                screen_x = 0;
+    }
+    t->vt.sgr = sgr;
+    vt_set_attrib(t);
+}
+
+/*
+ * vt_erase
+ *  DESCRIPTION: fill cells of a row of t with blanks in the current
+ *               colors, and draw it
+ *  INPUTS: t - the terminal
+ *          y - the row
+ *          from, to - the first cell, and the one after the last
+ *  RETURN VALUES: none
+ *  SIDE EFFECTS: none
+ */
+static void vt_erase(terminal_info_t* t, int32_t y, int32_t from, int32_t to) {
+    memset_word(BUF_CELL(t, from, y), (t->vt.attrib << 8) | ' ', to - from);
+    draw_rows(t, y, y);
+}
+
+/*
+ * vt_csi
+ *  DESCRIPTION: carry out the control sequence ending with final on t:
+ *               cursor movement (A B C D G H f d, s u), erasing (J K),
+ *               inserting and deleting lines (L M), scrolling (S T), colors
+ *               (m) and the scroll region (r). Others are ignored.
+ *  INPUTS: t - the terminal
+ *          final - the last byte of the sequence
+ *  RETURN VALUES: none
+ *  SIDE EFFECTS: none
+ */
+static void vt_csi(terminal_info_t* t, uint8_t final) {
+    vt_state_t* vt = &t->vt;
+    int32_t n = vt_param(t, 0, 1);
+    int32_t y;
+
+    switch (final) {
+        case 'A':
+            t->screen_y = clamp(t->screen_y - n, (t->screen_y >= vt->top) ? vt->top : 0, NUM_ROWS - 1);
+            break;
+        case 'B':
+            t->screen_y = clamp(t->screen_y + n, 0, (t->screen_y <= vt->bottom) ? vt->bottom : NUM_ROWS - 1);
+            break;
+        case 'C':
+            t->screen_x = clamp(t->screen_x + n, 0, NUM_COLS - 1);
+            break;
+        case 'D':
+            t->screen_x = clamp(t->screen_x - n, 0, NUM_COLS - 1);
+            break;
+        case 'G':
+            t->screen_x = clamp(n - 1, 0, NUM_COLS - 1);
+            break;
+        case 'd':
+            t->screen_y = clamp(n - 1, 0, NUM_ROWS - 1);
+            break;
+        case 'H':
+        case 'f':
+            t->screen_y = clamp(n - 1, 0, NUM_ROWS - 1);
+            t->screen_x = clamp(vt_param(t, 1, 1) - 1, 0, NUM_COLS - 1);
+            break;
+        case 'J':
+            // 0: cursor to the end of the screen, 1: start of the screen to the cursor, 2: all of it
+            n = vt_param(t, 0, 0);
+            if (n == 0) {
+                vt_erase(t, t->screen_y, t->screen_x, NUM_COLS);
+                for (y = t->screen_y + 1; y < NUM_ROWS; y++) {
+                    vt_erase(t, y, 0, NUM_COLS);
+                }
+            } else if (n == 1) {
+                for (y = 0; y < t->screen_y; y++) {
+                    vt_erase(t, y, 0, NUM_COLS);
+                }
+                vt_erase(t, t->screen_y, 0, t->screen_x + 1);
+            } else if (n == 2) {
+                for (y = 0; y < NUM_ROWS; y++) {
+                    vt_erase(t, y, 0, NUM_COLS);
+                }
             }
-        }else{
-            //the normal case, simply increment x
-            buffered_memload(current_show_y, screen_x, screen_y, c);
-            buffered_showchar(current_show_y, screen_x, screen_y);
-            screen_x++;
+            break;
+        case 'K':
+            // the same within the line of the cursor
+            n = vt_param(t, 0, 0);
+            if (n == 0) {
+                vt_erase(t, t->screen_y, t->screen_x, NUM_COLS);
+            } else if (n == 1) {
+                vt_erase(t, t->screen_y, 0, t->screen_x + 1);
+            } else if (n == 2) {
+                vt_erase(t, t->screen_y, 0, NUM_COLS);
+            }
+            break;
+        case 'L':
+        case 'M':
+            // lines inserted or deleted at the cursor push the rest of the region
+            if (t->screen_y >= vt->top && t->screen_y <= vt->bottom) {
+                scroll_rows(t, t->screen_y, vt->bottom, (final == 'L') ? -n : n);
+                t->screen_x = 0;
+            }
+            break;
+        case 'S':
+            scroll_rows(t, vt->top, vt->bottom, n);
+            break;
+        case 'T':
+            scroll_rows(t, vt->top, vt->bottom, -n);
+            break;
+        case 'm':
+            vt_sgr(t);
+            break;
+        case 'r':
+            // a region of two rows at least, the cursor goes home
+            n = clamp(vt_param(t, 0, 1), 1, NUM_ROWS);
+            y = clamp(vt_param(t, 1, NUM_ROWS), 1, NUM_ROWS);
+            if (n < y) {
+                vt->top = n - 1;
+                vt->bottom = y - 1;
+                t->screen_x = 0;
+                t->screen_y = 0;
+            }
+            break;
+        case 's':
+            vt->saved_x = t->screen_x;
+            vt->saved_y = t->screen_y;
+            vt->saved_sgr = vt->sgr;
+            break;
+        case 'u':
+            t->screen_x = vt->saved_x;
+            t->screen_y = vt->saved_y;
+            vt->sgr = vt->saved_sgr;
+            vt_set_attrib(t);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * vt_input
+ *  DESCRIPTION: feed a byte of an escape sequence to the parser of t.
+ *               Besides ESC [, it knows ESC 7 / ESC 8 (save / restore the
+ *               cursor and colors), ESC D / ESC M (line feed / reverse line
+ *               feed, scrolling at the edges of the region), ESC E (next
+ *               line) and ESC c (reset, and clear the screen).
+ *  INPUTS: t - the terminal
+ *          c - the byte, ESC or part of the sequence it started
+ *  RETURN VALUES: none
+ *  SIDE EFFECTS: none
+ */
+static void vt_input(terminal_info_t* t, uint8_t c) {
+    vt_state_t* vt = &t->vt;
+    int32_t x;
+
+    if (c == ESC) {
+        vt->state = VT_ESC;
+        return;
+    }
+    if (vt->state == VT_ESC) {
+        vt->state = VT_NORMAL;
+        switch (c) {
+            case '[':
+                vt->state = VT_CSI;
+                vt->private = 0;
+                vt->nparams = 1;
+                vt->params[0] = 0;
+                break;
+            case '7':
+                vt->saved_x = t->screen_x;
+                vt->saved_y = t->screen_y;
+                vt->saved_sgr = vt->sgr;
+                break;
+            case '8':
+                t->screen_x = vt->saved_x;
+                t->screen_y = vt->saved_y;
+                vt->sgr = vt->saved_sgr;
+                vt_set_attrib(t);
+                break;
+            case 'D':
+                x = t->screen_x;
+                new_line(t);
+                t->screen_x = x;
+                break;
+            case 'E':
+                new_line(t);
+                break;
+            case 'M':
+                if (t->screen_y == vt->top) {
+                    scroll_rows(t, vt->top, vt->bottom, -1);
+                } else if (t->screen_y > 0) {
+                    t->screen_y--;
+                }
+                break;
+            case 'c':
+                term_vt_reset(t);
+                for (x = 0; x < NUM_ROWS; x++) {
+                    vt_erase(t, x, 0, NUM_COLS);
+                }
+                t->screen_x = 0;
+                t->screen_y = 0;
+                break;
+            default:
+                break;
+        }
+        return;
+    }
+
+    // VT_CSI: parameters separated by ';', then a final byte
+    if (c >= '0' && c <= '9') {
+        if (vt->params[vt->nparams - 1] < 10000) {
+            vt->params[vt->nparams - 1] = vt->params[vt->nparams - 1] * 10 + (c - '0');
+        }
+    } else if (c == ';') {
+        if (vt->nparams < VT_MAX_PARAMS) {
+            vt->params[vt->nparams++] = 0;
+        }
+    } else if (c == '?') {
+        vt->private = 1;
+    } else if (c >= 0x40 && c <= 0x7E) {
+        vt->state = VT_NORMAL;
+        if (!vt->private) {
+            vt_csi(t, c);
         }
     }
 }
 
+/*
+ * screen_catch_up
+ *  DESCRIPTION: bring the screen of t up to date with a run of output
+ *               stored into its buffer by putbuf: scroll it by the lines
+ *               that scrolled and draw the rows written, once for the run
+ *  INPUTS: t - the terminal
+ *          first_y - row of the cursor when the run began
+ *          scrolled - lines the screen scrolled by meanwhile
+ *          cells - cells written
+ *  RETURN VALUES: none
+ *  SIDE EFFECTS: none
+ */
+static void screen_catch_up(terminal_info_t* t, int32_t first_y, int32_t scrolled, int32_t cells) {
+    int32_t y;
+
+    if (scrolled == 0 && cells == 0) {
+        return;
+    }
+    if (screen_deferred(t)) {
+        t->stats.cells_deferred += cells;
+        return;
+    }
+    t->stats.cells_immediate += cells;
+
+    // rows written before the scroll moved up with it, or off the screen
+    move_screen(t, scrolled);
+    first_y = (first_y > scrolled) ? first_y - scrolled : 0;
+    for (y = first_y; y <= t->screen_y; y++) {
+        show_row(t, t->current_show_y, y);
+    }
+    if (scrolled != 0 && on_display(t)) {
+        term_update_screen_start(t);
+    }
+}
+
+/* void putbuf(const uint8_t* buf, int32_t n);
+ * Inputs: buf = characters to print, NUL bytes are skipped
+ *         n = number of bytes in buf
+ * Return Value: void
+ *  Function: Output a buffer to the console like putc on each byte, but a
+ *            run of characters is stored into the buffer at once, and the
+ *            screen catches up once at the end: it scrolls by all the new
+ *            lines together and only the rows written are drawn. A hidden
+ *            screen is not drawn at all (see screen_deferred). VT100 escape
+ *            sequences are carried out (see vt_input), a control character
+ *            in the middle of one cancels it. The cursor is left to the
+ *            caller. */
+void putbuf(const uint8_t* buf, int32_t n) {
+    terminal_info_t* t = screen_term();
+    int32_t i = 0;
+    int32_t len, room, first_y, scrolled = 0, cells = 0;
+    uint8_t* cell;
+    uint8_t attr = t->vt.attrib;    // only an escape sequence changes it
+
+    //firstly, if any character is printed, recover the terminal from the view history mode
+    if (t->current_show_y != t->view_history_show_y){
+        t->view_history_show_y = t->current_show_y;
+        if (!screen_deferred(t)) {
+            show_screen(t, t->current_show_y);
+        }
+    }
+    first_y = t->screen_y;
+
+    while (i < n) {
+        if (buf[i] == ESC || t->vt.state != VT_NORMAL) {
+            if (buf[i] < ' ' && buf[i] != ESC) {
+                t->vt.state = VT_NORMAL;
+            } else {
+                // sequences draw what they change themselves, after the run so far
+                screen_catch_up(t, first_y, scrolled, cells);
+                scrolled = cells = 0;
+                vt_input(t, buf[i++]);
+                attr = t->vt.attrib;
+                first_y = t->screen_y;
+                continue;
+            }
+        }
+        if (buf[i] == '\n' || buf[i] == '\r') {
+            scrolled += next_line(t);
+            i++;
+            continue;
+        }
+        if (buf[i] == '\0') {
+            i++;
+            continue;
+        }
+
+        // the run of characters up to the end of the line or of the row
+        room = NUM_COLS - t->screen_x;
+        cell = (uint8_t*) BUF_CELL(t, t->screen_x, t->screen_y);
+        for (len = 0; len < room && i < n && buf[i] != '\n' && buf[i] != '\r' && buf[i] != '\0' && buf[i] != ESC; len++) {
+            cell[len << 1] = buf[i++];
+            cell[(len << 1) + 1] = attr;
+        }
+        t->screen_x += len;
+        cells += len;
+        if (t->screen_x == NUM_COLS) {
+            scrolled += next_line(t);
+        }
+    }
+
+    screen_catch_up(t, first_y, scrolled, cells);
+}
+
 /* int8_t* itoa(uint32_t value, int8_t* buf, int32_t radix);
  * Inputs: uint32_t value = number to convert
  *            int8_t* buf = allocated buffer to place string in
@@ -709,39 +1417,17 @@ int8_t* strncpy(int8_t* dest, const int8_t* src, uint32_t n) {
 void test_interrupts(void) {
     int32_t i;
     for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
-        video_mem[i << 1]++;
+        screen_term()->video_mem[i << 1]++;
     }
 }
 
-int get_screen_x() {
-    return screen_x;
-}
-int get_screen_y() {
-    return screen_y;
-}
-int get_current_show_y() {
-    return current_show_y;
-};
-int get_view_history_show_y() {
-    return view_history_show_y;
-};
-
-char* get_video_mem() {
-    return video_mem;
-}
-
-
-void set_all_x_y(int screen_x_n, int screen_y_n, int current_show_y_n, int view_history_show_y_n) {
-    screen_x = screen_x_n;
-    screen_y = screen_y_n;
-    current_show_y = current_show_y_n;
-    view_history_show_y = view_history_show_y_n;
-};
-
-void set_video_mem(char* video_mem_n){
-    video_mem = video_mem_n;
-}
-
-void set_buf_video_mem(char* buf_video_mem_n) {
-    buf_video_mem = buf_video_mem_n;
+/*
+ * set_screen_terminal
+ *  DESCRIPTION: select the terminal that screen output is drawn on
+ *  INPUTS: t - the terminal
+ *  RETURN VALUES: none
+ *  SIDE EFFECTS: every following putc/printf goes to t
+ */
+void set_screen_terminal(terminal_info_t* t) {
+    this_cpu()->screen = t;
 }
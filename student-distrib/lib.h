@@ -14,18 +14,32 @@
 #define CURSOR_HIGH      0x3D5
 #define CURSOR_LOW       0x3D4
 #define LOWER_MASK  0xFF
-#define BUF_LEN     (10 * NUM_ROWS)
+#define ROW_BYTES       (NUM_COLS * 2)
+#define SCREEN_BYTES    (NUM_ROWS * ROW_BYTES)
+/* CRTC registers (through CURSOR_LOW/CURSOR_HIGH) holding the first cell displayed */
+#define VGA_START_HIGH  0x0C
+#define VGA_START_LOW   0x0D
+#define VGA_TEXT_PAGES  8           // 4KB pages of text memory from VIDEO on, one screen fits in each
+
+struct terminal_info_t;
 
 void update_cursor(void);
 void init_cursor(void);
+void update_screen_start(void);
+void screen_home(void);
+void screen_refresh(void);
 void backspace_handler(void);
-void buffered_showchar(int32_t scroll_y, int32_t x, int32_t y);
+void buffered_showchar(struct terminal_info_t* t, int32_t scroll_y, int32_t x, int32_t y);
 void scroll_and_view_history(int32_t dir_up, int32_t dir_down);
-void buffered_memload(int32_t scroll_y, int32_t x, int32_t y, uint8_t c);
-void show_screen(int32_t scroll_y);
+void buffered_memload(struct terminal_info_t* t, int32_t scroll_y, int32_t x, int32_t y, uint8_t c);
+void show_screen(struct terminal_info_t* t, int32_t scroll_y);
+void show_row(struct terminal_info_t* t, int32_t scroll_y, int32_t y);
+void clear_curr_line(struct terminal_info_t* t, int32_t scroll_y, int32_t y);
 void test_interrupts(void);
 int32_t printf(int8_t *format, ...);
 void putc(uint8_t c);
+void putbuf(const uint8_t* buf, int32_t n);
+void vt_reset(void);
 int32_t puts(int8_t *s);
 int8_t *itoa(uint32_t value, int8_t* buf, int32_t radix);
 int8_t *strrev(int8_t* s);
@@ -46,16 +60,13 @@ int8_t* strncpy(int8_t* dest, const int8_t*src, uint32_t n);
 int32_t bad_userspace_addr(const void* addr, int32_t len);
 int32_t safe_strncpy(int8_t* dest, const int8_t* src, int32_t n);
 
-/* */
-int get_screen_x();
-int get_screen_y();
-int get_current_show_y();
-int get_view_history_show_y();
-char* get_video_mem();
+/* Select the terminal (see scheduler.h) that screen output is drawn on */
+void set_screen_terminal(struct terminal_info_t* t);
 
-void set_all_x_y(int screen_x_n, int screen_y_n, int current_show_y_n, int view_history_show_y_n);
-void set_video_mem(char* video_mem_n);
-void set_buf_video_mem(char* buf_video_mem_n);
+/* Sections with interrupts off are measured (see latency.h) */
+#define EFLAGS_IF   0x200
+void trace_hardirqs_off(void);
+void trace_hardirqs_on(void);
 
 /* Port read functions */
 /* Inb reads a byte and returns its value as a zero-extended 32-bit
@@ -101,6 +112,17 @@ static inline uint32_t inl(port) {
     return val;
 }
 
+/* Reads the time-stamp counter, the number of cycles since reset */
+static inline uint64_t rdtsc(void) {
+    uint64_t val;
+    asm volatile ("rdtsc"
+            : "=A"(val)
+            :
+            : "memory"
+    );
+    return val;
+}
+
 /* Writes a byte to a port */
 #define outb(data, port)                \
 do {                                    \
@@ -139,6 +161,7 @@ do {                                    \
             :                           \
             : "memory", "cc"            \
     );                                  \
+    trace_hardirqs_off();               \
 } while (0)
 
 /* Save flags and then clear interrupt flag
@@ -155,11 +178,15 @@ do {                                    \
             :                           \
             : "memory", "cc"            \
     );                                  \
+    if ((flags) & EFLAGS_IF) {          \
+        trace_hardirqs_off();           \
+    }                                   \
 } while (0)
 
 /* Set interrupt flag - enable interrupts on this processor */
 #define sti()                           \
 do {                                    \
+    trace_hardirqs_on();                \
     asm volatile ("sti"                 \
             :                           \
             :                           \
@@ -172,6 +199,9 @@ do {                                    \
  * after a cli_and_save_flags(flags) */
 #define restore_flags(flags)            \
 do {                                    \
+    if ((flags) & EFLAGS_IF) {          \
+        trace_hardirqs_on();            \
+    }                                   \
     asm volatile ("                   \n\
             pushl %0                  \n\
             popfl                     \n\
@@ -182,4 +212,17 @@ do {                                    \
     );                                  \
 } while (0)
 
+/* Enable interrupts, wait for one and disable them again. sti takes effect
+ * after hlt, so an interrupt arriving in between still wakes us up */
+#define sti_hlt_cli()                   \
+do {                                    \
+    trace_hardirqs_on();                \
+    asm volatile ("sti; hlt; cli"       \
+            :                           \
+            :                           \
+            : "memory", "cc"            \
+    );                                  \
+    trace_hardirqs_off();               \
+} while (0)
+
 #endif /* _LIB_H */
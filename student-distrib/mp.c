@@ -0,0 +1,314 @@
+#include "mp.h"
+
+#include "lib.h"
+
+// Reference source: Intel MultiProcessor Specification 1.4, ACPI 1.0b (MADT)
+
+#define BDA_EBDA_SEG        0x40E       // segment of the extended BIOS data area
+#define BDA_BASE_MEM_KB     0x413       // size of base memory in KB
+#define BIOS_ROM_START      0xE0000
+#define BIOS_ROM_END        0x100000
+#define DEFAULT_LAPIC_BASE  0xFEE00000
+
+/* MP floating pointer structure */
+typedef struct __attribute__((packed)) mp_fps_t {
+    uint8_t  signature[4];              // "_MP_"
+    uint32_t config;                    // physical address of the configuration table
+    uint8_t  length;                    // in 16 bytes
+    uint8_t  spec_rev;
+    uint8_t  checksum;
+    uint8_t  features[5];               // features[0] != 0 means a default configuration
+} mp_fps_t;
+
+/* MP configuration table header, the entries follow */
+typedef struct __attribute__((packed)) mp_config_t {
+    uint8_t  signature[4];              // "PCMP"
+    uint16_t length;
+    uint8_t  spec_rev;
+    uint8_t  checksum;
+    uint8_t  oem_id[8];
+    uint8_t  product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_size;
+    uint16_t entry_count;
+    uint32_t lapic_base;
+    uint16_t ext_length;
+    uint8_t  ext_checksum;
+    uint8_t  reserved;
+} mp_config_t;
+
+#define MP_ENTRY_PROC       0           // 20 bytes, the others are 8
+#define MP_ENTRY_BUS        1
+#define MP_ENTRY_IOAPIC     2
+#define MP_ENTRY_IOINTR     3
+#define MP_PROC_ENABLED     0x1
+#define MP_PROC_BSP         0x2
+
+/* ACPI root system description pointer */
+typedef struct __attribute__((packed)) acpi_rsdp_t {
+    uint8_t  signature[8];              // "RSD PTR "
+    uint8_t  checksum;
+    uint8_t  oem_id[6];
+    uint8_t  revision;
+    uint32_t rsdt;
+} acpi_rsdp_t;
+
+/* ACPI system description table header */
+typedef struct __attribute__((packed)) acpi_header_t {
+    uint8_t  signature[4];
+    uint32_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    uint8_t  oem_id[6];
+    uint8_t  oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} acpi_header_t;
+
+#define MADT_LAPIC          0
+#define MADT_IOAPIC         1
+#define MADT_OVERRIDE       2
+#define MADT_LAPIC_ENABLED  0x1
+
+mp_info_t mp_info;
+
+/* sum of the bytes of a table, 0 for a valid table */
+static uint8_t checksum(const uint8_t* addr, uint32_t len)
+{
+    uint8_t sum = 0;
+    while (len-- > 0) {
+        sum += *addr++;
+    }
+    return sum;
+}
+
+/* look for a signature on a 16-byte boundary of [start, start + len) */
+static void* scan(uint32_t start, uint32_t len, const int8_t* sig, uint32_t sig_len, uint32_t table_len)
+{
+    uint32_t addr;
+    for (addr = start; addr + table_len <= start + len; addr += 16) {
+        if (strncmp((int8_t*) addr, sig, sig_len) == 0 && checksum((uint8_t*) addr, table_len) == 0) {
+            return (void*) addr;
+        }
+    }
+    return NULL;
+}
+
+/* search the EBDA, the last KB of base memory and the BIOS ROM, as both specs ask */
+static void* scan_bios(const int8_t* sig, uint32_t sig_len, uint32_t table_len)
+{
+    uint32_t ebda = (uint32_t) (*(uint16_t*) BDA_EBDA_SEG) << 4;
+    uint32_t base_top = (uint32_t) (*(uint16_t*) BDA_BASE_MEM_KB) << 10;
+    void* found = NULL;
+
+    if (ebda != 0) {
+        found = scan(ebda, 1024, sig, sig_len, table_len);
+    }
+    if (found == NULL && base_top >= 1024) {
+        found = scan(base_top - 1024, 1024, sig, sig_len, table_len);
+    }
+    if (found == NULL) {
+        found = scan(BIOS_ROM_START, BIOS_ROM_END - BIOS_ROM_START, sig, sig_len, table_len);
+    }
+    return found;
+}
+
+/* record a processor, the BSP always takes cpu 0 */
+static void add_cpu(uint8_t lapic_id, int32_t is_bsp)
+{
+    if (mp_info.nr_cpus >= MAX_CPUS) {
+        return;
+    }
+    if (is_bsp) {
+        mp_info.lapic_id[mp_info.nr_cpus] = mp_info.lapic_id[0];
+        mp_info.lapic_id[0] = lapic_id;
+    } else {
+        mp_info.lapic_id[mp_info.nr_cpus] = lapic_id;
+    }
+    mp_info.nr_cpus++;
+}
+
+/* the id of the local APIC running this code, read before paging is on */
+static uint8_t boot_lapic_id(void)
+{
+    return *(volatile uint32_t*) (mp_info.lapic_base + 0x20) >> 24;
+}
+
+/* 
+ *  acpi_parse
+ *  DESCRIPTION: fill mp_info from the ACPI multiple APIC description table
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: 0 on success, -1 if there is no usable MADT
+ */
+static int32_t acpi_parse(void)
+{
+    acpi_rsdp_t* rsdp;
+    acpi_header_t* rsdt;
+    acpi_header_t* madt = NULL;
+    uint32_t* tables;
+    uint8_t* entry;
+    uint8_t* end;
+    uint8_t bsp_id;
+    int32_t i, n;
+
+    rsdp = scan_bios("RSD PTR ", 8, sizeof(acpi_rsdp_t));
+    if (rsdp == NULL) {
+        return -1;
+    }
+    rsdt = (acpi_header_t*) rsdp->rsdt;
+    if (strncmp((int8_t*) rsdt->signature, "RSDT", 4) != 0 || checksum((uint8_t*) rsdt, rsdt->length) != 0) {
+        return -1;
+    }
+
+    tables = (uint32_t*) (rsdt + 1);
+    n = (rsdt->length - sizeof(acpi_header_t)) / 4;
+    for (i = 0; i < n; i++) {
+        acpi_header_t* table = (acpi_header_t*) tables[i];
+        if (strncmp((int8_t*) table->signature, "APIC", 4) == 0 && checksum((uint8_t*) table, table->length) == 0) {
+            madt = table;
+            break;
+        }
+    }
+    if (madt == NULL) {
+        return -1;
+    }
+
+    // local APIC address and flags follow the header
+    mp_info.lapic_base = *(uint32_t*) (madt + 1);
+    bsp_id = boot_lapic_id();
+    entry = (uint8_t*) (madt + 1) + 8;
+    end = (uint8_t*) madt + madt->length;
+    for (; entry < end && entry[1] != 0; entry += entry[1]) {
+        switch (entry[0]) {
+            case MADT_LAPIC:
+                // processor id, APIC id, flags
+                if (*(uint32_t*) (entry + 4) & MADT_LAPIC_ENABLED) {
+                    add_cpu(entry[3], entry[3] == bsp_id);
+                }
+                break;
+            case MADT_IOAPIC:
+                // the first IOAPIC serves the ISA IRQs
+                if (mp_info.ioapic_base == 0 && *(uint32_t*) (entry + 8) == 0) {
+                    mp_info.ioapic_id = entry[2];
+                    mp_info.ioapic_base = *(uint32_t*) (entry + 4);
+                }
+                break;
+            case MADT_OVERRIDE:
+                // bus, source IRQ, global system interrupt, flags
+                if (entry[2] == 0 && entry[3] < NUM_ISA_IRQS) {
+                    mp_info.irq_to_gsi[entry[3]] = *(uint32_t*) (entry + 4);
+                    mp_info.irq_flags[entry[3]] = *(uint16_t*) (entry + 8);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return 0;
+}
+
+/* 
+ *  mps_parse
+ *  DESCRIPTION: fill mp_info from the Intel MP configuration table
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: 0 on success, -1 if there is no usable table
+ */
+static int32_t mps_parse(void)
+{
+    mp_fps_t* fps;
+    mp_config_t* config;
+    uint8_t* entry;
+    int32_t i;
+    int32_t isa_bus = -1;
+
+    fps = scan_bios("_MP_", 4, sizeof(mp_fps_t));
+    if (fps == NULL || fps->config == 0 || fps->features[0] != 0) {
+        // default configurations are not supported
+        return -1;
+    }
+    config = (mp_config_t*) fps->config;
+    if (strncmp((int8_t*) config->signature, "PCMP", 4) != 0 || checksum((uint8_t*) config, config->length) != 0) {
+        return -1;
+    }
+
+    mp_info.lapic_base = config->lapic_base;
+    entry = (uint8_t*) (config + 1);
+    for (i = 0; i < config->entry_count; i++) {
+        switch (entry[0]) {
+            case MP_ENTRY_PROC:
+                // type, APIC id, version, flags
+                if (entry[3] & MP_PROC_ENABLED) {
+                    add_cpu(entry[1], entry[3] & MP_PROC_BSP);
+                }
+                entry += 20;
+                break;
+            case MP_ENTRY_BUS:
+                // type, bus id, bus type string
+                if (strncmp((int8_t*) entry + 2, "ISA", 3) == 0) {
+                    isa_bus = entry[1];
+                }
+                entry += 8;
+                break;
+            case MP_ENTRY_IOAPIC:
+                // type, id, version, flags, address
+                if (mp_info.ioapic_base == 0) {
+                    mp_info.ioapic_id = entry[1];
+                    mp_info.ioapic_base = *(uint32_t*) (entry + 4);
+                }
+                entry += 8;
+                break;
+            case MP_ENTRY_IOINTR:
+                // type, interrupt type, flags, source bus, source IRQ, dest IOAPIC, dest pin
+                if (entry[1] == 0 && entry[4] == isa_bus && entry[5] < NUM_ISA_IRQS) {
+                    mp_info.irq_to_gsi[entry[5]] = entry[7];
+                    mp_info.irq_flags[entry[5]] = *(uint16_t*) (entry + 2);
+                }
+                entry += 8;
+                break;
+            default:
+                entry += 8;
+                break;
+        }
+    }
+    return 0;
+}
+
+/* 
+ *  mp_init
+ *  DESCRIPTION: find the processors and the interrupt controllers
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: number of processors, 1 when there are no tables
+ *  SIDE EFFECTS: must run before paging is enabled
+ */
+int32_t mp_init(void)
+{
+    int32_t i;
+
+    memset(&mp_info, 0, sizeof(mp_info_t));
+    mp_info.lapic_base = DEFAULT_LAPIC_BASE;
+    for (i = 0; i < NUM_ISA_IRQS; i++) {
+        mp_info.irq_to_gsi[i] = i;
+    }
+
+    if (acpi_parse() == -1) {
+        mp_info.nr_cpus = 0;
+        mp_info.ioapic_base = 0;
+        if (mps_parse() == -1) {
+            mp_info.lapic_base = 0;
+        }
+    }
+
+    if (mp_info.nr_cpus == 0) {
+        // no tables, the BSP alone
+        mp_info.nr_cpus = 1;
+        mp_info.lapic_id[0] = 0;
+    }
+
+    printf("Found %d CPU(s), local APIC at 0x%x, IOAPIC at 0x%x\n",
+           mp_info.nr_cpus, mp_info.lapic_base, mp_info.ioapic_base);
+    return mp_info.nr_cpus;
+}
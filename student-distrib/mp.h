@@ -0,0 +1,34 @@
+#ifndef _MP_H
+#define _MP_H
+
+#include "types.h"
+
+#define MAX_CPUS            8
+#define NUM_ISA_IRQS        16
+
+#ifndef ASM
+
+/* What the firmware tells us about the processors and interrupt controllers */
+typedef struct mp_info_t {
+    int32_t  nr_cpus;                   // enabled processors, the BSP is cpu 0
+    uint8_t  lapic_id[MAX_CPUS];        // local APIC id of each processor
+    uint32_t lapic_base;                // physical address of the local APICs
+    uint32_t ioapic_base;               // physical address of the (first) IOAPIC, 0 if none
+    uint8_t  ioapic_id;
+    uint32_t irq_to_gsi[NUM_ISA_IRQS];  // IOAPIC input of each ISA IRQ
+    uint16_t irq_flags[NUM_ISA_IRQS];   // polarity and trigger mode overrides (MPS INTI flags)
+} mp_info_t;
+
+extern mp_info_t mp_info;
+
+/*
+ * Parse the ACPI MADT, or the Intel MP tables if there is no ACPI, into
+ * mp_info. Must be called before paging is enabled, the tables may live
+ * anywhere in physical memory. Returns the number of processors found
+ * (1 when neither table exists).
+ */
+int32_t mp_init(void);
+
+#endif /* ASM */
+
+#endif /* _MP_H */
@@ -1,6 +1,9 @@
 #include "page.h"
 
 #include "x86_desc.h"
+#include "syscall.h"
+#include "smp.h"
+#include "vdso.h"
 
 static void enable_paging();
 
@@ -78,8 +81,8 @@ void page_init() {
 
     /* Initialize first page table */
     for (i = 0; i < NUM_PTE; i++) {
-        /* Video memory page */
-        if (i >= VIDEO_INDEX && i <= VIDEO_INDEX + 3) {
+        /* Video memory page, and the AP trampoline written by the BSP */
+        if ((i >= VIDEO_INDEX && i < VIDEO_INDEX + VIDEO_PAGES) || i == (AP_TRAMPOLINE_ADDR >> 12)) {
             pt_video[i].present = 1;
             pt_video[i].rw = 1;
             pt_video[i].us = 0;
@@ -125,6 +128,21 @@ void page_init() {
             pt_user_video[i].addr_31_12 = VIDEO_INDEX;
         }
 
+        /* Shared kernel data page, read-only */
+        else if (i == VDSO_INDEX) {
+            pt_user_video[i].present = 1;
+            pt_user_video[i].rw = 0;
+            pt_user_video[i].us = 1;
+            pt_user_video[i].pwt = 0;
+            pt_user_video[i].pcd = 0;
+            pt_user_video[i].accessed = 0;
+            pt_user_video[i].dirty = 0;
+            pt_user_video[i].pat = 0;
+            pt_user_video[i].global = 0;
+            pt_user_video[i].ignored = 0;
+            pt_user_video[i].addr_31_12 = (uint32_t) vdso >> 12;
+        }
+
         else {
             pt_user_video[i].present = 0;
             pt_user_video[i].rw = 0;
@@ -183,5 +201,78 @@ static void enable_paging() {
  * Set the map to user video memory
  */
 void set_user_video_mem(void* user_video_mem){
-    pt_user_video[0].addr_31_12 = (uint32_t)user_video_mem >> 12;
+    this_cpu()->pt_user_video[0].addr_31_12 = (uint32_t)user_video_mem >> 12;
+}
+
+/* map_user_program
+ *
+ * Map the 4MB program page at 128MB to the image of the given task
+ * (the per-process 4MB images start from 8MB in physical memory)
+ * in the page directory of the running CPU
+ */
+void map_user_program(uint32_t pid) {
+    uint32_t pd_idx = (uint32_t) (USER_IMG_ADDR >> PAGE_4MB_SHIFT);  //the index of the page directory should be 32 (128 MB)
+    pde_t* cpu_pd = this_cpu()->pd;
+
+    cpu_pd[pd_idx].pde_4m.present = 1;
+    cpu_pd[pd_idx].pde_4m.rw = 1;
+    cpu_pd[pd_idx].pde_4m.us = 1;
+    cpu_pd[pd_idx].pde_4m.pwt = 0;
+    cpu_pd[pd_idx].pde_4m.pcd = 0;
+    cpu_pd[pd_idx].pde_4m.accessed = 0;
+    cpu_pd[pd_idx].pde_4m.dirty = 0;
+    cpu_pd[pd_idx].pde_4m.entry_type = 1;
+    cpu_pd[pd_idx].pde_4m.global = 0;
+    cpu_pd[pd_idx].pde_4m.ignored = 0;
+    cpu_pd[pd_idx].pde_4m.pat = 0;
+    cpu_pd[pd_idx].pde_4m.addr_39_32 = 0;
+    cpu_pd[pd_idx].pde_4m.reserved = 0;
+    cpu_pd[pd_idx].pde_4m.addr_31_22 = pid + 2;
+    flush_tlb();
+}
+
+/* map_mmio
+ *
+ * Identity map the 4MB region holding a device (local APIC, IOAPIC)
+ * as an uncached kernel page. Call before the APs copy the directory.
+ */
+void map_mmio(uint32_t addr) {
+    uint32_t pd_idx = addr >> PAGE_4MB_SHIFT;
+
+    pd[pd_idx].pde_4m.present = 1;
+    pd[pd_idx].pde_4m.rw = 1;
+    pd[pd_idx].pde_4m.us = 0;
+    pd[pd_idx].pde_4m.pwt = 1;
+    pd[pd_idx].pde_4m.pcd = 1;
+    pd[pd_idx].pde_4m.accessed = 0;
+    pd[pd_idx].pde_4m.dirty = 0;
+    pd[pd_idx].pde_4m.entry_type = 1;
+    pd[pd_idx].pde_4m.global = 1;
+    pd[pd_idx].pde_4m.ignored = 0;
+    pd[pd_idx].pde_4m.pat = 0;
+    pd[pd_idx].pde_4m.addr_39_32 = 0;
+    pd[pd_idx].pde_4m.reserved = 0;
+    pd[pd_idx].pde_4m.addr_31_22 = pd_idx;
+    flush_tlb();
+}
+
+/* page_init_cpu
+ *
+ * Copy the kernel mappings of the BSP into the page directory of an AP.
+ * The program page and the vidmap page table are private to each CPU,
+ * so that each CPU can run a different task.
+ */
+void page_init_cpu(pde_t* cpu_pd, pte_t* cpu_pt_user_video) {
+    memcpy(cpu_pd, pd, SIZE_PD);
+    memcpy(cpu_pt_user_video, pt_user_video, SIZE_PT);
+    cpu_pd[USER_VIDEO_INDEX].pde_table.addr_31_12 = (unsigned long)cpu_pt_user_video >> 12;
+    cpu_pd[USER_IMG_ADDR >> PAGE_4MB_SHIFT].pde_4m.present = 0;
+}
+
+/* load_page_directory
+ *
+ * Set CR3 to the given page directory (paging is on already)
+ */
+void load_page_directory(pde_t* cpu_pd) {
+    asm volatile("movl %0, %%cr3" : : "r" (cpu_pd) : "memory");
 }
@@ -1,8 +1,12 @@
 #ifndef _PAGE_H
 #define _PAGE_H
 
+#include "types.h"
+#include "x86_desc.h"
+
 #define VIDEO           0xB8000
 #define VIDEO_INDEX     0xB8
+#define VIDEO_PAGES     8           // VGA text memory, 0xB8000 to 0xBFFFF (VGA_TEXT_PAGES)
 // #define USER_PROGRAM    0x8000000
 // #define USER_PROGRAM_INDEX  0x20
 #define USER_VIDEO          0x8400000
@@ -15,7 +19,19 @@ void page_init();
 /* Translation lookaside buffers will be automatically flushed */
 void flush_tlb();
 
+/* Map the 4MB program page at 128MB to the image of the given task */
+void map_user_program(uint32_t pid);
+
 /* Set the map to user video memory */
 void set_user_video_mem(void* user_video_mem);
 
+/* Map the 4MB region of a memory mapped device (uncached, kernel only) */
+void map_mmio(uint32_t addr);
+
+/* Build the page directory of an AP from the one of the BSP */
+void page_init_cpu(pde_t* cpu_pd, pte_t* cpu_pt_user_video);
+
+/* Load a page directory into CR3 */
+void load_page_directory(pde_t* cpu_pd);
+
 #endif /* _PAGE_H */
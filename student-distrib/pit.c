@@ -3,24 +3,70 @@
 #include "i8259.h"
 #include "syscall.h"
 #include "scheduler.h"
+#include "task.h"
+#include "cmdline.h"
+#include "smp.h"
+#include "vdso.h"
+#include "softirq.h"
+
+// current frequency of the tick
+static int32_t pit_freq;
+
+// non-zero when the local APIC timer of each CPU drives its own tick
+static int32_t lapic_tick;
+
+// the PIT command and channel 0 ports, settimer may run on any CPU
+static spinlock_t pit_lock;
 
 //Reference source: https://wiki.osdev.org/Programmable_Interval_Timer
 /* 
  *  pit_handler()
- *  DESCRIPTION: set pit handler
- *  INPUTS:  none
+ *  DESCRIPTION: set pit handler, account the tick and run the scheduler
+ *  INPUTS:  cs -- code segment of the interrupted code
  *  OUTPUTS: none
  *  RETURN VALUE: none
  *  SIDE EFFECTS: none
  *  Reference source: none
  */
-void pit_handler(){
+void pit_handler(uint32_t cs){
+    uint32_t start = (uint32_t) rdtsc();
+
     send_eoi(PIT_IRQ);
-    scheduler_round_robin();
-    if (get_halt_flag(curr_running_terminal)) {
-        clear_halt_flag(curr_running_terminal);
-        halt(255);
+    vdso->ticks++;
+    // without the local APIC timers the APs get the tick from us
+    if (nr_cpus > 1) {
+        lapic_send_ipi(0, IPI_TICK_VECTOR, ICR_ALL_BUT_SELF);
     }
+    task_account_tick(cs);
+    irq_account_top(PIT_IRQ, start);
+    scheduler_tick();
+    // bottom halves left over by code that held a lock when they were raised
+    irq_exit();
+}
+
+/* 
+ *  lapic_timer_handler()
+ *  DESCRIPTION: tick of the local APIC timer of the running CPU, used
+ *               instead of the PIT when the timers are calibrated
+ *  INPUTS:  cs -- code segment of the interrupted code
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void lapic_timer_handler(uint32_t cs){
+    cpu_t* cpu = this_cpu();
+
+    lapic_eoi();
+    // settimer changed the rate, each CPU follows on its next tick
+    if (cpu->timer_hz != pit_freq) {
+        lapic_timer_start(pit_freq);
+        cpu->timer_hz = pit_freq;
+    }
+    if (cpu->id == 0) {
+        vdso->ticks++;
+    }
+    task_account_tick(cs);
+    scheduler_tick();
+    irq_exit();
 }
 
 /* 
@@ -28,24 +74,103 @@ void pit_handler(){
  *  DESCRIPTION: set pit frequency
  *  INPUTS:  hz -- the frequency we want to set, unit is HZ
  *  OUTPUTS: none
- *  RETURN VALUE: none
+ *  RETURN VALUE: 0 -- success, -1 -- hz is out of range
  *  Reference source: http://www.osdever.net/bkerndev/Docs/pit.htm
  */
-void pit_set_freq(int32_t hz){
-    int32_t divisor = PIT_DIV / hz; /* Calculate our divisor */
+int32_t pit_set_freq(int32_t hz){
+    unsigned long flags;
+    int32_t divisor;
+
+    if (hz < PIT_MIN_FREQ || hz > PIT_MAX_FREQ) {
+        return -1;
+    }
+    divisor = PIT_DIV / hz; /* Calculate our divisor */
+    spin_lock_irqsave(&pit_lock, flags);
     outb(PIT_MODE3_CMD, PIT_CMD_REG); /* Set our command byte 0x36 */
     outb(divisor & 0xFF, PIT_CHL0_REG); /* Set low byte of divisor */
     outb(divisor >> 8, PIT_CHL0_REG); /* Set high byte of divisor */
+    pit_freq = hz;
+    vdso->tick_hz = hz;
+    spin_unlock_irqrestore(&pit_lock, flags);
+    return 0;
+}
+
+/* 
+ *  pit_get_freq()
+ *  DESCRIPTION: get pit frequency
+ *  INPUTS:  none
+ *  OUTPUTS: none
+ *  RETURN VALUE: the frequency of the tick, unit is HZ
+ */
+int32_t pit_get_freq(){
+    return pit_freq;
 }
+
+/* 
+ *  pit_oneshot_start(int hz)
+ *  DESCRIPTION: start a one-shot count of 1/hz second on channel 2, the
+ *               speaker stays off. Poll pit_oneshot_done for the end.
+ *  INPUTS:  hz -- inverse of the delay, at least PIT_MIN_FREQ
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ *  Reference source: https://wiki.osdev.org/APIC_timer
+ */
+void pit_oneshot_start(int32_t hz){
+    int32_t count = PIT_DIV / hz;
+    uint8_t gate = inb(PIT_GATE_REG) & ~(PIT_GATE_CHL2 | PIT_SPEAKER);
+
+    outb(gate, PIT_GATE_REG);
+    outb(PIT_CHL2_ONESHOT, PIT_CMD_REG);
+    outb(count & 0xFF, PIT_CHL2_REG);
+    outb(count >> 8, PIT_CHL2_REG);
+    // the count starts on the rising edge of the gate
+    outb(gate | PIT_GATE_CHL2, PIT_GATE_REG);
+}
+
+/* 
+ *  pit_oneshot_done()
+ *  DESCRIPTION: check the count started by pit_oneshot_start
+ *  INPUTS:  none
+ *  OUTPUTS: none
+ *  RETURN VALUE: non-zero once the delay elapsed
+ */
+int32_t pit_oneshot_done(){
+    return inb(PIT_GATE_REG) & PIT_CHL2_OUT;
+}
+
 /* 
  *  pit_init
- *  DESCRIPTION: initialize pit and set frequency into 100 HZ
+ *  DESCRIPTION: initialize pit and set frequency into 100 HZ, or the pit_hz boot option.
+ *               The local APIC timer gives the tick instead when it is calibrated,
+ *               unless booted with lapic_timer=0.
  *  INPUTS:  none
  *  OUTPUTS: none
  *  RETURN VALUE: none
  *  Reference source: http://www.osdever.net/bkerndev/Docs/pit.htm
  */
 void pit_init(){
-    pit_set_freq(PIT_DEFAULT_FREQ); /*In the reference, it recommends setting to 100Hz(PIT_DEFAULT_FREQ) in a real kernel. Every 10ms, an interrupt will be raised for scheduler*/
-    enable_irq(PIT_IRQ);
+    spin_lock_init(&pit_lock, "pit");
+    pit_set_freq(cmdline_get_int("pit_hz", PIT_DEFAULT_FREQ, PIT_MIN_FREQ, PIT_MAX_FREQ)); /*In the reference, it recommends setting to 100Hz(PIT_DEFAULT_FREQ) in a real kernel. Every 10ms, an interrupt will be raised for scheduler*/
+    lapic_tick = lapic_timer_freq != 0 && cmdline_get_int("lapic_timer", 1, 0, 1);
+    if (lapic_tick) {
+        lapic_timer_start(pit_freq);
+        this_cpu()->timer_hz = pit_freq;
+    } else {
+        enable_irq(PIT_IRQ);
+    }
+}
+
+/* 
+ *  pit_init_ap
+ *  DESCRIPTION: start the tick of an application processor, nothing to do
+ *               when the BSP forwards the PIT ticks
+ *  INPUTS:  none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void pit_init_ap(){
+    if (lapic_tick) {
+        lapic_timer_start(pit_freq);
+        this_cpu()->timer_hz = pit_freq;
+    }
 }
@@ -9,11 +9,26 @@
 #define PIT_CMD_REG        0x43
 #define PIT_CHL0_REG       0x40
 #define PIT_DEFAULT_FREQ   100
+#define PIT_MIN_FREQ       19      // the divisor has 16 bits
+#define PIT_MAX_FREQ       10000
 #define PIT_MODE3_CMD      0x36 /*Square Wave */
+#define PIT_CHL2_REG       0x42
+#define PIT_CHL2_ONESHOT   0xB0 /* channel 2, interrupt on terminal count */
+#define PIT_GATE_REG       0x61 /* keyboard controller port B */
+#define PIT_GATE_CHL2      0x01
+#define PIT_SPEAKER        0x02
+#define PIT_CHL2_OUT       0x20
 
 
-void pit_handler();
-void pit_set_freq(int32_t hz);
+void pit_handler(uint32_t cs);
+int32_t pit_set_freq(int32_t hz);
+int32_t pit_get_freq();
 void pit_init();
+void pit_init_ap();
+void lapic_timer_handler(uint32_t cs);
+
+/* Time a delay on channel 2 without interrupts, used to calibrate other clocks */
+void pit_oneshot_start(int32_t hz);
+int32_t pit_oneshot_done();
 
 #endif
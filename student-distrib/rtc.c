@@ -2,16 +2,14 @@
 
 #include "i8259.h"
 #include "task.h"
+#include "scheduler.h"
+#include "softirq.h"
+#include "syscall.h"
 
 // Reference Source: https://wiki.osdev.org/RTC
-#define REG_A       0x8A
-#define REG_B       0x8B
-#define REG_C       0x0C
-
 #define RTC_REG_PORT   0x70
 #define RTC_DATA_PORT  0x71
 #define BIT_6          0x40
-#define RTC_IRQ_NUM    8
 #define DEFAULT_LEVEL   6  // 1024Hz
 #define TEST_LEVEL      15 // 2Hz
 #define MAX_FRQ_RATE    15
@@ -19,12 +17,44 @@
 #define NULL            0
 #define REAL_FREQ       1024
 
-file_op_table_t rtc_op_table = {.open = rtc_open, .close = rtc_close, .read = rtc_read, .write = rtc_write};
+file_op_table_t rtc_op_table = {.open = rtc_open, .close = rtc_close, .read = rtc_read, .write = rtc_write,
+                               .read_until = rtc_read_until, .poll = rtc_poll};
 
 // The flag to indicate if there is any interrupt occur
 // volatile static int8_t RTC_INT_FLAG;
 
-uint8_t pid;
+// RTC time in 1/REAL_FREQ seconds, the time base of deadlines and rtc_read latencies.
+// It only runs while the rtc is open somewhere.
+static uint32_t rtc_now;
+// RTC time of one hardware interrupt at the current rate
+static uint32_t rtc_step;
+// rate programmed into register A, 0 while the IRQ is masked
+static int8_t rtc_hw_rate;
+
+// The virtual RTC of an open rtc file, each fd ticks on its own
+typedef struct rtc_handle_t {
+    pcb_t*              pcb;        // task the fd belongs to
+    int32_t             freq;       // Virtual frequency, -1 when the fd is not an open rtc
+    uint32_t            deadline;   // RTC time of the next virtual interrupt
+    int32_t             heap_idx;   // slot in the RTC deadline heap, -1 if not queued
+    volatile int32_t    int_flag;   // 1 once the virtual interrupt fired, until rtc_read
+    uint32_t            release;    // RTC time when int_flag was set
+    wait_list_t         pollers;    // tasks polling this fd
+} rtc_handle_t;
+
+// Handles by pid and fd
+static rtc_handle_t rtc_handles[MAX_TASK_NUM][FD_ARRAY_SIZE];
+
+// Open rtc handles by rate, the fastest one sets the hardware rate
+static int32_t rtc_rate_users[MAX_FRQ_RATE + 1];
+static int32_t rtc_nr_open;
+
+// Min-heap of the handles waiting for a virtual interrupt, by deadline
+static rtc_handle_t* rtc_heap[MAX_TASK_NUM * FD_ARRAY_SIZE];
+static int32_t rtc_heap_size;
+
+// Guards the RTC ports and every handle
+static spinlock_t rtc_lock;
 /* 
  *  rtc_set_reg
  *  DESCRIPTION: set an RTC register
@@ -32,7 +62,7 @@ uint8_t pid;
   *         value - the value to be set into the register
  *  OUTPUTS: none
  *  RETURN VALUE: none
- *  SIDE EFFECTS: set the value in selected register
+ *  SIDE EFFECTS: set the value in selected register, the caller holds rtc_lock
  *  Reference source: https://wiki.osdev.org/RTC
  */
 void rtc_set_reg(int8_t reg, int8_t value)
@@ -51,7 +81,7 @@ void rtc_set_reg(int8_t reg, int8_t value)
  *  INPUTS: reg - the register ng to be get
  *  OUTPUTS: none
  *  RETURN VALUE: int8_t - the value in the selected register
- *  SIDE EFFECTS: get the value of the selected RTC register
+ *  SIDE EFFECTS: get the value of the selected RTC register, the caller holds rtc_lock
  *  Reference source: https://wiki.osdev.org/RTC
  */
 int8_t rtc_get_reg(int8_t reg)
@@ -74,21 +104,28 @@ int8_t rtc_get_reg(int8_t reg)
 void rtc_init()
 {
     unsigned long flags;
-    cli_and_save(flags);
+    int32_t pid, fd;
+
+    spin_lock_init(&rtc_lock, "rtc");
+    spin_lock_irqsave(&rtc_lock, flags);
+    for (pid = 0; pid < MAX_TASK_NUM; pid++) {
+        for (fd = 0; fd < FD_ARRAY_SIZE; fd++) {
+            rtc_handles[pid][fd].freq = -1;
+            rtc_handles[pid][fd].heap_idx = -1;
+        }
+    }
 
     //Turning on IRQ 8 
     int8_t prev;
     prev = rtc_get_reg(REG_B);
     rtc_set_reg(REG_B, prev | BIT_6);
-    // pic unmask
-    enable_irq(RTC_IRQ_NUM);
     //select register C
     //just throw away contents
     //allow next irq
     rtc_get_reg(REG_C);
-    //SET frequency to 1024 HZ
+    //SET frequency to 1024 HZ, the IRQ stays masked until the rtc is opened
     set_freq(DEFAULT_LEVEL);
-    restore_flags(flags);
+    spin_unlock_irqrestore(&rtc_lock, flags);
     printf("Done Initiating RTC\n");
 }
 
@@ -98,13 +135,12 @@ void rtc_init()
  *  INPUTS: freq_rate - the frequency rate of rtc
  *  OUTPUTS: none
  *  RETURN VALUE: none
- *  SIDE EFFECTS: set the frequency of rtc
+ *  SIDE EFFECTS: set the frequency of rtc, the caller holds rtc_lock
  *  Source: https://wiki.osdev.org/RTC
  */
 
 void set_freq(int8_t freq_rate)
 {   
-    unsigned long flags;
     //frequency =  32768 >> (rate-1);
     //So rate - 1 = freq_rate should be from MIN_FRQ_RATE:1 to MAX_FRQ_RATE:15
     //And the frequency range from 2^1 = 2 to 2^15 = 32768 
@@ -112,15 +148,163 @@ void set_freq(int8_t freq_rate)
     if(freq_rate < MIN_FRQ_RATE) return;
     // use &0x0F to limited below 15
     int8_t rate = freq_rate & 0x0F;
-    cli_and_save(flags);
     int8_t prev = rtc_get_reg(REG_A);
 
     //reset index to A and write to A
     rtc_set_reg(REG_A, (prev & 0xF0) | rate);
-    restore_flags(flags);
     return;
 }
 
+/* true if deadline a comes before b, RTC time wraps around */
+static inline int32_t rtc_before(uint32_t a, uint32_t b)
+{
+    return (int32_t) (a - b) < 0;
+}
+
+/* put a handle in a heap slot */
+static inline void rtc_heap_set(int32_t idx, rtc_handle_t* h)
+{
+    rtc_heap[idx] = h;
+    h->heap_idx = idx;
+}
+
+/* move the handle at idx towards the root while its deadline is earlier */
+static void rtc_heap_up(int32_t idx)
+{
+    rtc_handle_t* h = rtc_heap[idx];
+    int32_t parent;
+
+    while (idx > 0) {
+        parent = (idx - 1) / 2;
+        if (!rtc_before(h->deadline, rtc_heap[parent]->deadline)) {
+            break;
+        }
+        rtc_heap_set(idx, rtc_heap[parent]);
+        idx = parent;
+    }
+    rtc_heap_set(idx, h);
+}
+
+/* move the handle at idx towards the leaves while a child is earlier */
+static void rtc_heap_down(int32_t idx)
+{
+    rtc_handle_t* h = rtc_heap[idx];
+    int32_t child;
+
+    while ((child = 2 * idx + 1) < rtc_heap_size) {
+        if (child + 1 < rtc_heap_size &&
+            rtc_before(rtc_heap[child + 1]->deadline, rtc_heap[child]->deadline)) {
+            child++;
+        }
+        if (!rtc_before(rtc_heap[child]->deadline, h->deadline)) {
+            break;
+        }
+        rtc_heap_set(idx, rtc_heap[child]);
+        idx = child;
+    }
+    rtc_heap_set(idx, h);
+}
+
+/* 
+ *  rtc_arm
+ *  DESCRIPTION: queue the next virtual interrupt of a handle
+ *  INPUTS: h - an open handle, the caller holds rtc_lock
+ *          deadline - RTC time of the interrupt
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+static void rtc_arm(rtc_handle_t* h, uint32_t deadline)
+{
+    h->deadline = deadline;
+    if (h->heap_idx < 0) {
+        rtc_heap_set(rtc_heap_size++, h);
+        rtc_heap_up(h->heap_idx);
+    } else {
+        // a new frequency, the deadline may move either way
+        rtc_heap_up(h->heap_idx);
+        rtc_heap_down(h->heap_idx);
+    }
+}
+
+/* 
+ *  rtc_disarm
+ *  DESCRIPTION: take a handle out of the deadline heap
+ *  INPUTS: h - handle, queued or not, the caller holds rtc_lock
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+static void rtc_disarm(rtc_handle_t* h)
+{
+    int32_t idx = h->heap_idx;
+    rtc_handle_t* moved;
+
+    if (idx < 0) {
+        return;
+    }
+    h->heap_idx = -1;
+    if (--rtc_heap_size == idx) {
+        return;
+    }
+    // the last handle fills the hole, then finds its place
+    moved = rtc_heap[rtc_heap_size];
+    rtc_heap_set(idx, moved);
+    rtc_heap_up(idx);
+    rtc_heap_down(moved->heap_idx);
+}
+
+/* the handle of fd of the current task, NULL if fd is out of range */
+static rtc_handle_t* rtc_handle(int32_t fd)
+{
+    pcb_t* cur_pcb = get_current_pcb();
+
+    if (fd < 0 || fd >= FD_ARRAY_SIZE || cur_pcb->pid < 0 || cur_pcb->pid >= MAX_TASK_NUM) {
+        return NULL;
+    }
+    return &rtc_handles[cur_pcb->pid][fd];
+}
+
+/* add delta to the number of open handles at a frequency */
+static inline void rtc_count_rate(uint32_t freq, int32_t delta)
+{
+    rtc_rate_users[(uint8_t) get_rate(freq)] += delta;
+}
+
+/* 
+ *  rtc_update_rate
+ *  DESCRIPTION: run the hardware at the fastest frequency an open rtc asks
+ *               for, and mask the IRQ while nobody has the rtc open
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ *  SIDE EFFECTS: the caller holds rtc_lock
+ */
+static void rtc_update_rate(void)
+{
+    int32_t rate;
+
+    if (rtc_nr_open == 0) {
+        if (rtc_hw_rate != 0) {
+            disable_irq(RTC_IRQ_NUM);
+            rtc_hw_rate = 0;
+        }
+        return;
+    }
+
+    for (rate = DEFAULT_LEVEL; rate < MAX_FRQ_RATE && rtc_rate_users[rate] == 0; rate++);
+    if (rate == rtc_hw_rate) {
+        return;
+    }
+    set_freq(rate);
+    // one interrupt at 32768 >> (rate - 1) Hz is 2^(rate - DEFAULT_LEVEL) RTC time units
+    rtc_step = 1 << (rate - DEFAULT_LEVEL);
+    if (rtc_hw_rate == 0) {
+        // drop an interrupt left pending while masked, or the RTC never raises another
+        rtc_get_reg(REG_C);
+        enable_irq(RTC_IRQ_NUM);
+    }
+    rtc_hw_rate = rate;
+}
+
 /* 
  *  rtc_handler
  *  DESCRIPTION: handle rtc interrupt & support virtual RTC
@@ -131,91 +315,211 @@ void set_freq(int8_t freq_rate)
  */
 void rtc_handler()
 {
-    // Loop every pcb to check if it is opened or present
-    // If not, just skip. If yes, update tick_count
-    // If tick_count = 0, set int_flag into 1
-    for(pid = 0; pid < MAX_TASK_NUM; pid++){
-        pcb_t* cur_pcb = get_pcb_by_pid(pid);
-        //if the pcb is not present or pcb is not open, continue for next
-        if(cur_pcb->present == 0 || cur_pcb->pcb_freq < 0){
-            continue;
-        }
-        //update pcb tick_count and check if there is an interrupt flag
-        //If there is an interrupt, reset every thing & set int_flag to 1
-        if (cur_pcb->tick_count > 0) {
-            cur_pcb->tick_count -= cur_pcb->pcb_freq;
-        } else {
-            cur_pcb->int_flag = 1;
-        }
+    uint32_t start = (uint32_t) rdtsc();
+    rtc_handle_t* h;
+
+    spin_lock(&rtc_lock);
+    rtc_now += rtc_step;
+    // Only the handles whose deadline passed are touched, earliest first.
+    // A handle leaves the heap when its virtual interrupt fires, rtc_read queues it again.
+    while (rtc_heap_size > 0 && !rtc_before(rtc_now, rtc_heap[0]->deadline)) {
+        h = rtc_heap[0];
+        rtc_disarm(h);
+        // deadline keeps the period boundary, rtc_read counts from it
+        h->int_flag = 1;
+        h->release = rtc_now;
+        poll_wake(&h->pollers);
+        task_wake(h->pcb->pid);
     }
 
     // select register C
     // just throw away contents
     // allow next irq
     rtc_get_reg(REG_C);
+    spin_unlock_no_resched(&rtc_lock);
     send_eoi(RTC_IRQ_NUM);
+    irq_account_top(RTC_IRQ_NUM, start);
+    // a real-time task woken above runs right now
+    irq_exit();
 }
 
 /* 
  *  rtc_open()
- *  DESCRIPTION: Set the freq of RTC into 2HZ
- *  INPUTS: none
+ *  DESCRIPTION: Set the freq of a new rtc fd into 2HZ
+ *  INPUTS: fd -- the fd opened
  *  OUTPUTS: none
- *  RETURN VALUE: 0
- *  SIDE EFFECTS: initializes RTC frequency to 2HZ
+ *  RETURN VALUE: 0, -1 for a bad fd
+ *  SIDE EFFECTS: initializes the virtual RTC of the fd to 2HZ
  */
-int32_t rtc_open(const uint8_t* filename){
+int32_t rtc_open(const uint8_t* filename, int32_t fd){
     //Set virtual frequency into 2HZ
-    //Set tick_count as real_freq for virtual interrupt calculation
-    //e.g. The current RTC is 1024, and virtual freq is 2 HZ
-    //Every real interrupt, we will use tick_count to minus virtual frequency
-    //The time for virtual interrupt is when the tick_count equal to 0
-    pcb_t* cur_pcb = get_current_pcb();
-    cur_pcb->pcb_freq = 2;
-    cur_pcb->tick_count = REAL_FREQ;
-    cur_pcb->int_flag = 0;
+    //The virtual interrupt is due one period from now in RTC time,
+    //e.g. 1024 / 2 = 512 units for 2 HZ. The deadline heap keeps the
+    //earliest one on top, so the handler never looks at the others.
+    unsigned long flags;
+    rtc_handle_t* h = rtc_handle(fd);
+
+    if (h == NULL) {
+        return -1;
+    }
+    spin_lock_irqsave(&rtc_lock, flags);
+    if (h->freq < 0) {
+        rtc_nr_open++;
+    } else {
+        // opened again, it starts over at 2HZ
+        rtc_count_rate(h->freq, -1);
+    }
+    h->pcb = get_current_pcb();
+    h->freq = 2;
+    rtc_count_rate(h->freq, 1);
+    h->int_flag = 0;
+    h->pollers = 0;
+    rtc_update_rate();
+    rtc_arm(h, rtc_now + REAL_FREQ / h->freq);
+    spin_unlock_irqrestore(&rtc_lock, flags);
     return 0;
 }
 /* 
  *  rtc_close()
- *  DESCRIPTION: Reset PCB infomation into closed states
- *  INPUTS: none
+ *  DESCRIPTION: Reset the virtual RTC of an fd into closed states
+ *  INPUTS: fd -- the fd closed
  *  OUTPUTS: none
- *  RETURN VALUE: 0
+ *  RETURN VALUE: 0, -1 if the fd is not an open rtc
  *  SIDE EFFECTS: None
  */
 int32_t rtc_close(int32_t fd){
-    //Get the current PCB & Reset virtual frequency(pcb_freq) into -1, 
-    //which indicates the current pcb is not opened.
-    //Reset tick_count into -1, which indicates the current pcb is not opened(closed)
-    //Also reset interrupt flag back to 0
-    pcb_t* cur_pcb = get_current_pcb();
-    cur_pcb->pcb_freq = -1;
-    cur_pcb->tick_count = -1;
-    cur_pcb->int_flag = 0;
+    //Reset virtual frequency into -1, which indicates the fd is not opened.
+    //Take it out of the deadline heap, the hardware may slow down or stop.
+    //The other fds of the task keep ticking.
+    unsigned long flags;
+    rtc_handle_t* h = rtc_handle(fd);
+
+    if (h == NULL) {
+        return -1;
+    }
+    spin_lock_irqsave(&rtc_lock, flags);
+    if (h->freq < 0) {
+        spin_unlock_irqrestore(&rtc_lock, flags);
+        return -1;
+    }
+    rtc_disarm(h);
+    rtc_count_rate(h->freq, -1);
+    rtc_nr_open--;
+    h->freq = -1;
+    h->int_flag = 0;
+    rtc_update_rate();
+    spin_unlock_irqrestore(&rtc_lock, flags);
     return 0;
 }
+/* 
+ *  rtc_account_latency
+ *  DESCRIPTION: add the delay between the virtual interrupt and its rtc_read
+ *               return to the jitter histogram of a task
+ *  INPUTS: h - handle read by the task
+ *          periods - periods elapsed since the previous rtc_read
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ *  SIDE EFFECTS: every period skipped over counts as a deadline miss
+ */
+static void rtc_account_latency(rtc_handle_t* h, uint32_t periods)
+{
+    pcb_t* cur_pcb = h->pcb;
+    uint32_t latency = rtc_now - h->release;
+    int32_t bucket = 0;
+
+    while (latency >> bucket && bucket < RT_HIST_BUCKETS - 1) {
+        bucket++;
+    }
+    cur_pcb->stats.rt_latency[bucket]++;
+    cur_pcb->stats.rt_misses += periods - 1;
+}
+
 /* 
  *  rtc_read()
  *  DESCRIPTION: block until next interrupt occur
- *  INPUTS: none
+ *  INPUTS: buf -- a user buffer: if nbytes is at least 4, it receives the number of periods
+ *                 elapsed since the previous rtc_read (more than 1 when the
+ *                 task fell behind)
  *  OUTPUTS: none
- *  RETURN VALUE: 0
+ *  RETURN VALUE: 0, -1 if fd is not an open rtc
  *  SIDE EFFECTS: block until next interrupt occur
  */
 int32_t rtc_read(int32_t fd, void* buf, int32_t nbytes){
+    return rtc_read_until(fd, buf, nbytes, NO_DEADLINE);
+}
+
+/* 
+ *  rtc_read_until()
+ *  DESCRIPTION: rtc_read, giving up if the next interrupt is not due by the deadline
+ *  INPUTS: buf -- as rtc_read
+ *          deadline -- clock_ns time, 0 not to wait at all
+ *  OUTPUTS: none
+ *  RETURN VALUE: 0, ERR_WOULD_BLOCK past the deadline, -1 if fd is not an open rtc
+ *  SIDE EFFECTS: block until next interrupt occur or the deadline
+ */
+int32_t rtc_read_until(int32_t fd, void* buf, int32_t nbytes, uint64_t deadline){
     unsigned long flags;
+    uint32_t period, periods;
+    rtc_handle_t* h = rtc_handle(fd);
 
-    pcb_t* cur_pcb = get_current_pcb();
-    //Block current PCB until next virtual interrupt occur.
-    while(!cur_pcb->int_flag);
-    //Next interrupt come, reset interrupt flag back to 0 and set tick_count to real freq.
-    cli_and_save(flags); 
-    cur_pcb->int_flag = 0;
-    cur_pcb->tick_count = REAL_FREQ;
-    restore_flags(flags);
+    //a closed fd is never armed, it would sleep for good
+    if (h == NULL || h->freq < 0) {
+        return -1;
+    }
+    //Block current task until next virtual interrupt of the fd occur, the interrupt stays due.
+    if (sleep_until_deadline(&h->int_flag, deadline) == -1) {
+        return ERR_WOULD_BLOCK;
+    }
+    //Next interrupt come, reset interrupt flag back to 0 and queue the next one.
+    spin_lock_irqsave(&rtc_lock, flags);
+    if (h->freq < 0) {
+        spin_unlock_irqrestore(&rtc_lock, flags);
+        return -1;
+    }
+    h->int_flag = 0;
+    // periods are kept on absolute boundaries, the time spent before
+    // this read does not push the next one back
+    period = REAL_FREQ / h->freq;
+    periods = (rtc_now - h->deadline) / period + 1;
+    rtc_account_latency(h, periods);
+    rtc_arm(h, h->deadline + periods * period);
+    spin_unlock_irqrestore(&rtc_lock, flags);
+
+    // only a user buffer receives the count, the others are left alone
+    if (nbytes >= sizeof(uint32_t) &&
+        (uint32_t) buf >= USER_MEM && (uint32_t) buf <= USER_MEM_END - sizeof(uint32_t)) {
+        *(uint32_t*) buf = periods;
+    }
     return 0;
 }
+/* 
+ *  rtc_poll()
+ *  DESCRIPTION: the poll op of the rtc, writes never wait
+ *  INPUTS: wait -- put the caller on the wait list of its virtual interrupt
+ *  OUTPUTS: none
+ *  RETURN VALUE: POLLOUT, and POLLIN once the virtual interrupt fired,
+ *                POLLNVAL if fd is not an open rtc
+ *  SIDE EFFECTS: none
+ */
+int32_t rtc_poll(int32_t fd, int32_t wait){
+    unsigned long flags;
+    int32_t mask = POLLOUT;
+    rtc_handle_t* h = rtc_handle(fd);
+
+    if (h == NULL || h->freq < 0) {
+        return POLLNVAL;
+    }
+    //rtc_handler wakes the list up after setting int_flag under rtc_lock
+    spin_lock_irqsave(&rtc_lock, flags);
+    if (wait) {
+        poll_wait(&h->pollers);
+    }
+    if (h->int_flag) {
+        mask |= POLLIN;
+    }
+    spin_unlock_irqrestore(&rtc_lock, flags);
+    return mask;
+}
 /* 
  *  rtc_write()
  *  DESCRIPTION: set new frequency
@@ -228,8 +532,8 @@ int32_t rtc_read(int32_t fd, void* buf, int32_t nbytes){
 int32_t rtc_write(int32_t fd, const void* buf, int32_t nbytes){
     unsigned long flags;
     //Check if set_freq_value is valid.
-    pcb_t* cur_pcb = get_current_pcb();
-    if(buf == NULL){
+    rtc_handle_t* h = rtc_handle(fd);
+    if(buf == NULL || h == NULL){
         return -1;
     }
     //frequency is from 2^1 = 2 to 2^15 = 32768
@@ -242,9 +546,20 @@ int32_t rtc_write(int32_t fd, const void* buf, int32_t nbytes){
         return -1;
     }
     // If val is valid, update current PCB's virtual RTC.
-    cli_and_save(flags);
-    cur_pcb->pcb_freq = val;
-    restore_flags(flags);
+    spin_lock_irqsave(&rtc_lock, flags);
+    if (h->freq < 0) {
+        spin_unlock_irqrestore(&rtc_lock, flags);
+        return -1;
+    }
+    rtc_count_rate(h->freq, -1);
+    h->freq = val;
+    rtc_count_rate(val, 1);
+    rtc_update_rate();
+    // a virtual interrupt already fired waits for rtc_read, the others restart at the new period
+    if (h->heap_idx >= 0) {
+        rtc_arm(h, rtc_now + REAL_FREQ / val);
+    }
+    spin_unlock_irqrestore(&rtc_lock, flags);
     //for success return 0
     return 0;
 }
@@ -5,15 +5,23 @@
 #include "lib.h"
 #include "filesys_struct.h"
 
+// Reference Source: https://wiki.osdev.org/RTC
+#define REG_A       0x8A
+#define REG_B       0x8B
+#define REG_C       0x0C
+#define RTC_IRQ_NUM    8
+
 void rtc_set_reg(int8_t reg, int8_t value);
 int8_t rtc_get_reg(int8_t reg);
 void rtc_init();
 void set_freq(int8_t freq_rate);
 void rtc_handler();
-int32_t rtc_open(const uint8_t* filename);
+int32_t rtc_open(const uint8_t* filename, int32_t fd);
 int32_t rtc_close(int32_t fd);
 int32_t rtc_read(int32_t fd, void* buf, int32_t nbytes);
+int32_t rtc_read_until(int32_t fd, void* buf, int32_t nbytes, uint64_t deadline);
 int32_t rtc_write(int32_t fd, const void* buf, int32_t nbytes);
+int32_t rtc_poll(int32_t fd, int32_t wait);
 int8_t get_rate(uint32_t val);
 
 extern file_op_table_t rtc_op_table;
@@ -4,66 +4,81 @@
 #include "page.h"
 #include "task.h"
 #include "syscall.h"
+#include "pit.h"
+#include "cmdline.h"
+#include "vdso.h"
+#include "latency.h"
+#include "kmem.h"
+#include "workqueue.h"
+#include "clock.h"
 
 int32_t curr_active_terminal;
-int32_t curr_running_terminal;
-terminal_info_t terminal_info_array[3];
+int32_t nr_terminals = DEFAULT_TERMINAL_NUM;
+// terminal 0 draws straight to the screen, even before terminal_init
+terminal_info_t boot_terminal = {
+    .video_mem = (char*) VIDEO, .video_rows = NUM_ROWS, .vidmap_pid = -1, .raw_pid = -1,
+    .vt = {.sgr = ATTRIB, .attrib = ATTRIB, .bottom = NUM_ROWS - 1}};
+terminal_info_t* terminal_info_array[MAX_TERMINAL_NUM] = {[0] = &boot_terminal};
+
+/* 4KB pages of VGA text memory of each terminal, one if there are more terminals than pages */
+static int32_t term_video_pages = 1;
+
+/* terminals to open and then show, a bit each, see show_terminal */
+static volatile uint32_t open_requests;
+static void open_terminal_work(work_t* work);
+static DECLARE_WORK(open_work, open_terminal_work);
+
+spinlock_t sched_lock;
+
+/* PIT ticks in a time slice */
+static int32_t sched_quantum = SCHED_DEFAULT_QUANTUM;
+
+int32_t lazy_render = 1;
+
+/* earliest timeout of the tasks in sleep_until_deadline, NO_DEADLINE if none (sched_lock) */
+static uint64_t next_timeout = NO_DEADLINE;
+static void check_timeouts(void);
+
+/* priority of a task against all others, SCHED_NORMAL tasks are all equal */
+static int32_t task_rank(pcb_t* pcb) {
+    return (pcb->policy == SCHED_RT) ? pcb->rt_priority : 0;
+}
+
+/* halt the current task if Ctrl+C was pressed on its terminal while it was away */
+void serve_ctrl_c() {
+    pcb_t* curr = get_pcb_by_pid(get_curr_pid());
+
+    // a kernel thread has no terminal, the one left over is not its own
+    if (curr != NULL && !curr->kthread && get_halt_flag(curr_running_terminal)) {
+        clear_halt_flag(curr_running_terminal);
+        halt(255);
+    }
+}
 
 /*
  * set_active_terminal()
  *  DESCRIPTION:
- *     set up information of active terminals.
+ *     Draw screen output on the terminal being displayed.
  *  INPUTS:
  *      None
  *  OUTPUTS:
  *      None
  */
 void set_active_terminal() {
-    terminal_info_t* curr_active_terminal_ptr = &terminal_info_array[curr_active_terminal];
-    terminal_info_t* curr_running_terminal_ptr = &terminal_info_array[curr_running_terminal];
-
-    if (curr_active_terminal != curr_running_terminal) {
-        curr_running_terminal_ptr->screen_x = get_screen_x();
-        curr_running_terminal_ptr->screen_y = get_screen_y();
-        curr_running_terminal_ptr->current_show_y = get_current_show_y();
-        curr_running_terminal_ptr->view_history_show_y = get_view_history_show_y();
-        curr_running_terminal_ptr->enter_flag = get_enter_flag();
-        curr_running_terminal_ptr->curr_string_len = get_curr_string_len();
-        set_all_x_y(curr_active_terminal_ptr->screen_x, curr_active_terminal_ptr->screen_y, curr_active_terminal_ptr->current_show_y, curr_active_terminal_ptr->view_history_show_y);
-        set_video_mem(curr_active_terminal_ptr->video_mem);
-        set_buf_video_mem(curr_active_terminal_ptr->buf_video_mem);
-        set_enter_flag(curr_active_terminal_ptr->enter_flag);
-        set_curr_string_len(curr_active_terminal_ptr->curr_string_len);
-        set_keyboard_buffer(curr_active_terminal_ptr->keyboard_buffer);
-    }
+    set_screen_terminal(terminal_info_array[curr_active_terminal]);
 }
 /*
  * restore_running_terminal()
  *  DESCRIPTION:
- *     Restore information of running terminals.
+ *     Draw screen output on the terminal being run.
  *  INPUTS:
  *      None
  *  OUTPUTS:
  *      None
  */
 void restore_running_terminal() {
-    terminal_info_t* curr_active_terminal_ptr = &terminal_info_array[curr_active_terminal];
-    terminal_info_t* curr_running_terminal_ptr = &terminal_info_array[curr_running_terminal];
-
-    if (curr_active_terminal != curr_running_terminal) {
-        curr_active_terminal_ptr->screen_x = get_screen_x();
-        curr_active_terminal_ptr->screen_y = get_screen_y();
-        curr_active_terminal_ptr->current_show_y = get_current_show_y();
-        curr_active_terminal_ptr->view_history_show_y = get_view_history_show_y();
-        curr_active_terminal_ptr->enter_flag = get_enter_flag();
-        curr_active_terminal_ptr->curr_string_len = get_curr_string_len();
-        set_all_x_y(curr_running_terminal_ptr->screen_x, curr_running_terminal_ptr->screen_y, curr_running_terminal_ptr->current_show_y, curr_running_terminal_ptr->view_history_show_y);
-        set_video_mem(curr_running_terminal_ptr->video_mem);
-        set_buf_video_mem(curr_running_terminal_ptr->buf_video_mem);
-        set_enter_flag(curr_running_terminal_ptr->enter_flag);
-        set_curr_string_len(curr_running_terminal_ptr->curr_string_len);
-        set_keyboard_buffer(curr_running_terminal_ptr->keyboard_buffer);
-    }
+    // a CPU that has not run a task yet draws on terminal 0
+    set_screen_terminal((curr_running_terminal == -1) ? &boot_terminal : terminal_info_array[curr_running_terminal]);
 }
 
 /*
@@ -79,203 +94,839 @@ void restore_running_terminal() {
 int32_t switch_active_terminal(int32_t tid){
     /* Below are steps to be done
      1. Input sanity check
-     2. Store current video memory to the buffered area
-     3. Save keyboard buffer
-     4. Perform Context Switch
+     2. Point the display at the screen of the next terminal, which stays
+        where it is in video memory (so does the vidmap page of its programs),
+        drawing it first if output to it was deferred
      */
+    unsigned long flags;
+    int32_t prev = curr_active_terminal;
+
     // input sanity check
-    if (tid < 0 || tid >= MAX_TERMINAL_NUM || tid == curr_active_terminal) {
+    if (tid < 0 || tid >= nr_terminals || terminal_info_array[tid] == NULL || tid == prev) {
         return -1;
     }
 
-    terminal_info_t* curr_terminal_ptr = &terminal_info_array[curr_active_terminal];
-    terminal_info_t* next_terminal_ptr = &terminal_info_array[tid];
-
-    // save video memory into buffer
-    curr_terminal_ptr->video_mem = (char*) VIDEO + (1 + curr_active_terminal) * (1 << 12);
-    memcpy(curr_terminal_ptr->video_mem, (char*) VIDEO, NUM_COLS * NUM_ROWS * 2);   // NUM_COLS * NUM_ROWS * 2BYTE - SIZE OF ONE FRAME
+    terminal_info_t* curr_terminal_ptr = terminal_info_array[prev];
+    terminal_info_t* next_terminal_ptr = terminal_info_array[tid];
 
-    memcpy((char*) VIDEO, next_terminal_ptr->video_mem, NUM_COLS * NUM_ROWS * 2);   // NUM_COLS * NUM_ROWS * 2BYTE - SIZE OF ONE FRAME
-    next_terminal_ptr->video_mem = (char*) VIDEO;
+    // both screens move, lock them in index order
+    if (tid < prev) {
+        spin_lock_irqsave(&next_terminal_ptr->lock, flags);
+        spin_lock(&curr_terminal_ptr->lock);
+    } else {
+        spin_lock_irqsave(&curr_terminal_ptr->lock, flags);
+        spin_lock(&next_terminal_ptr->lock);
+    }
 
+    // writers check whether their terminal is on display under its lock
     curr_active_terminal = tid;
+    vdso->active_terminal = tid;
 
+    // the video memory of a shared screen was drawn on by the other terminal
+    if (next_terminal_ptr->video_shared) {
+        next_terminal_ptr->screen_stale = 1;
+    }
     set_active_terminal();
+    screen_refresh();
+    update_screen_start();
     update_cursor();
     restore_running_terminal();
 
+    if (prev < tid) {
+        spin_unlock(&next_terminal_ptr->lock);
+        spin_unlock_irqrestore(&curr_terminal_ptr->lock, flags);
+    } else {
+        spin_unlock(&curr_terminal_ptr->lock);
+        spin_unlock_irqrestore(&next_terminal_ptr->lock, flags);
+    }
+
     return 0;
 }
 
 /*
- * switch_running_terminal(int32_t tid)
+ * switch_to_task(pcb_t* next)
  *  DESCRIPTION:
- *      Switch the terminal currently being run 
-        (This is the scheduler function to be called inside pit interrupt handler) 
+ *      Run the given task now. The terminal being run follows the task.
+ *      The caller holds sched_lock, and serves a pending Ctrl+C of its
+ *      terminal (serve_ctrl_c) once it dropped the lock.
  *  INPUTS:
- *      tid - terminal Id
+ *      next - a present task that is not waiting for a child
  *  OUTPUTS:
- *       0 - succeeded
- *      -1 - failed
+ *      None
  */
-void switch_running_terminal(int32_t tid){
-    // 1. input sanity check
-    if (tid < 0 || tid >= MAX_TERMINAL_NUM || tid == curr_running_terminal) {
+void switch_to_task(pcb_t* next){
+    int32_t prev_pid;
+    context_t* prev_context;
+    terminal_info_t* next_terminal_ptr;
+
+    prev_pid = get_curr_pid();
+    // a task running on another CPU cannot be taken
+    if (next == NULL || next->pid == prev_pid || next->on_cpu != -1) {
         return;
     }
-    
-    terminal_info_t* curr_sched_terminal_ptr = &terminal_info_array[curr_running_terminal];
-    terminal_info_t* next_sched_terminal_ptr = &terminal_info_array[tid];
-
-    // save current terminal's esp and ebp
-    asm volatile("        \n\
-        movl %%esp, %0    \n\
-        movl %%ebp, %1    \n\
-        "
-        : "=r"(terminal_info_array[curr_running_terminal].esp), "=r"(terminal_info_array[curr_running_terminal].ebp)
-        :
-        : "memory"
-    );
-
-    // save current terminal info
-    curr_sched_terminal_ptr->screen_x = get_screen_x();
-    curr_sched_terminal_ptr->screen_y = get_screen_y();
-    curr_sched_terminal_ptr->current_show_y = get_current_show_y();
-    curr_sched_terminal_ptr->view_history_show_y = get_view_history_show_y();
-    curr_sched_terminal_ptr->enter_flag = get_enter_flag();
-    curr_sched_terminal_ptr->curr_string_len = get_curr_string_len();
-
-    // load next terminal info
-    set_all_x_y(next_sched_terminal_ptr->screen_x, next_sched_terminal_ptr->screen_y, next_sched_terminal_ptr->current_show_y, next_sched_terminal_ptr->view_history_show_y);
-    set_video_mem(next_sched_terminal_ptr->video_mem);
-    set_buf_video_mem(next_sched_terminal_ptr->buf_video_mem);
-    set_user_video_mem(next_sched_terminal_ptr->video_mem);
-    set_enter_flag(next_sched_terminal_ptr->enter_flag);
-    set_curr_string_len(next_sched_terminal_ptr->curr_string_len);
-    set_keyboard_buffer(next_sched_terminal_ptr->keyboard_buffer);
-
-    // 3. Modify current running terminal
-    curr_running_terminal = tid;
-
-    // 4. Perform Context Switch
-    int32_t next_task_pid = next_sched_terminal_ptr->curr_pid;
-
-    // curr_task = get_pcb_by_pid(curr_task_pid);
-    if (next_task_pid == -1) {
-        clear();
-        execute((uint8_t*)"shell");
-    } else {
-        // next_task = get_pcb_by_pid(next_task_pid);
-
-        // modify program page
-        uint32_t pd_idx = (uint32_t) (USER_IMG_ADDR  >> PAGE_4MB_SHIFT);  //the index of the page directory should be 32 (128 MB)
-
-        pd[pd_idx].pde_4m.present = 1;
-        pd[pd_idx].pde_4m.rw = 1;
-        pd[pd_idx].pde_4m.us = 1;
-        pd[pd_idx].pde_4m.pwt = 0;
-        pd[pd_idx].pde_4m.pcd = 0;
-        pd[pd_idx].pde_4m.accessed = 0;
-        pd[pd_idx].pde_4m.dirty = 0;
-        pd[pd_idx].pde_4m.entry_type = 1;
-        pd[pd_idx].pde_4m.global = 0;
-        pd[pd_idx].pde_4m.ignored = 0;
-        pd[pd_idx].pde_4m.pat = 0;
-        pd[pd_idx].pde_4m.addr_39_32 = 0;
-        pd[pd_idx].pde_4m.reserved = 0;
-        pd[pd_idx].pde_4m.addr_31_22 = next_task_pid + 2;  // the per-process 4MB space starts from 8MB in the physical address   
-        flush_tlb();
-
-        // modify tss
-        tss.ss0 = KERNEL_DS;
-        tss.esp0 = STACK_BASE_8_MB - next_task_pid * STACK_SIZE_8_KB - sizeof(uint32_t);
-
-        // restore next terminal's esp and ebp
-        asm volatile("     \n\
-        movl %%ebx, %%esp  \n\
-        movl %%ecx, %%ebp  \n\
-        leave     \n\
-        ret       \n\
-        "
-        :
-        : "b" (terminal_info_array[curr_running_terminal].esp), "c" (terminal_info_array[curr_running_terminal].ebp)
-        : "esp","ebp"
-        );
+
+    // the task being switched away saves its registers into its own pcb
+    prev_context = (prev_pid == -1) ? &this_cpu()->idle_context : &get_pcb_by_pid(prev_pid)->context;
+
+    // Modify current running terminal, screen output follows it
+    if (!next->kthread && next->terminal_id != curr_running_terminal) {
+        next_terminal_ptr = terminal_info_array[next->terminal_id];
+        curr_running_terminal = next->terminal_id;
+        set_screen_terminal(next_terminal_ptr);
+        set_user_video_mem(next_terminal_ptr->video_mem);
+    }
+
+    // Perform Context Switch
+    this_cpu()->need_resched = 0;
+    next->stats.nr_switches++;
+    task_switch(prev_context, next);
+}
+
+/*
+ * steal_task()
+ *  DESCRIPTION:
+ *    Work stealing of an idle CPU: take the best waiting task from the run
+ *    queue of the busiest other CPU (sched_lock held).
+ *  INPUTS:
+ *      None
+ *  OUTPUTS:
+ *      the task to run next, NULL when every CPU has at most its current task
+ */
+static pcb_t* steal_task() {
+    int32_t i;
+    int32_t queued[MAX_CPUS] = {0};
+    int32_t busiest = -1;
+    pcb_t* pcb;
+    pcb_t* best = NULL;
+
+    // runnable tasks waiting in each run queue
+    for (i = 0; i < MAX_TASK_NUM; i++) {
+        pcb = get_pcb_by_pid(i);
+        if (pcb->present && pcb->state == TASK_RUNNABLE && pcb->on_cpu == -1) {
+            queued[pcb->cpu]++;
+        }
+    }
+    for (i = 0; i < nr_cpus; i++) {
+        if (&cpus[i] != this_cpu() && queued[i] > 0 && (busiest == -1 || queued[i] > queued[busiest])) {
+            busiest = i;
+        }
+    }
+    if (busiest == -1) {
+        return NULL;
+    }
+
+    for (i = 0; i < MAX_TASK_NUM; i++) {
+        pcb = get_pcb_by_pid(i);
+        if (pcb->present && pcb->state == TASK_RUNNABLE && pcb->on_cpu == -1 && pcb->cpu == busiest &&
+            (best == NULL || task_rank(pcb) > task_rank(best))) {
+            best = pcb;
+        }
+    }
+    // task_switch moves it into our run queue
+    return best;
+}
+
+/*
+ * pick_next_task()
+ *  DESCRIPTION:
+ *    The run queue of a CPU is the set of runnable tasks it owns. The
+ *    task of the highest rank wins, round robin among tasks of the same
+ *    rank, starting after the current one. An empty queue steals work.
+ *    The caller holds sched_lock.
+ *  INPUTS:
+ *      None
+ *  OUTPUTS:
+ *      the task to run next, NULL when no task can run
+ */
+pcb_t* pick_next_task() {
+    int32_t i;
+    cpu_t* cpu = this_cpu();
+    int32_t curr_pid = cpu->curr_pid;
+    pcb_t* pcb;
+    pcb_t* best = NULL;
+
+    for (i = 1; i <= MAX_TASK_NUM; i++) {
+        // i == MAX_TASK_NUM comes back to the current task itself
+        pcb = get_pcb_by_pid((curr_pid + i + MAX_TASK_NUM) % MAX_TASK_NUM);
+        if (pcb->present && pcb->state == TASK_RUNNABLE && pcb->cpu == cpu->id &&
+            (pcb->on_cpu == -1 || pcb->on_cpu == cpu->id) &&
+            (best == NULL || task_rank(pcb) > task_rank(best))) {
+            best = pcb;
+        }
+    }
+    if (best == NULL) {
+        best = steal_task();
+    }
+    return best;
+}
+
+/*
+ * schedule_locked(int32_t forced)
+ *  DESCRIPTION:
+ *    Switch to the next runnable task, if it is not the current one.
+ *    The caller holds sched_lock.
+ *  INPUTS:
+ *      forced - the current task is preempted rather than giving up the CPU
+ *  OUTPUTS:
+ *      None
+ */
+static void schedule_locked(int32_t forced) {
+    pcb_t* curr = get_pcb_by_pid(get_curr_pid());
+    pcb_t* next;
+
+    this_cpu()->need_resched = 0;
+    next = pick_next_task();
+    if (next != NULL && next != curr) {
+        if (curr != NULL && !forced) {
+            curr->stats.nr_voluntary++;
+        } else if (curr != NULL && curr->state == TASK_RUNNABLE) {
+            curr->stats.nr_forced++;
+        }
+        switch_to_task(next);
+    }
+}
+
+/*
+ * schedule()
+ *  DESCRIPTION:
+ *    Give up the CPU to the next runnable task (called by yield and by
+ *    the idle loop of the APs). Returns at once when no other task can run.
+ *  INPUTS:
+ *      None
+ *  OUTPUTS:
+ *      None
+ */
+void schedule() {
+    uint32_t flags;
+
+    spin_lock_irqsave(&sched_lock, flags);
+    schedule_locked(0);
+    spin_unlock_irqrestore(&sched_lock, flags);
+    serve_ctrl_c();
+}
+
+/*
+ * preempt()
+ *  DESCRIPTION:
+ *    Take the CPU away from the current task at the end of its time slice
+ *    (scheduler_tick) or when a task of higher rank
+ *    was woken up (check_preempt). A task holding a lock keeps the CPU
+ *    until preempt_enable.
+ *  INPUTS:
+ *      None
+ *  OUTPUTS:
+ *      None
+ */
+void preempt() {
+    uint32_t flags;
+
+    if (!preemptible()) {
+        this_cpu()->need_resched = 1;
+        return;
+    }
+
+    spin_lock_irqsave(&sched_lock, flags);
+    schedule_locked(1);
+    spin_unlock_irqrestore(&sched_lock, flags);
+    serve_ctrl_c();
+}
+
+/*
+ * schedule_tail()
+ *  DESCRIPTION:
+ *    First code run by a new task (from ret_to_user), on the way to user
+ *    mode: release the sched_lock held by whoever switched to us.
+ *  INPUTS:
+ *      None
+ *  OUTPUTS:
+ *      None
+ */
+void schedule_tail() {
+    finish_task_switch();
+    spin_unlock_no_resched(&sched_lock);
+}
+
+/*
+ * grant_slice(pcb_t* pcb)
+ *  DESCRIPTION:
+ *    Start a new time slice of a task being switched in.
+ *  INPUTS:
+ *      pcb - task to run
+ *  OUTPUTS:
+ *      None
+ */
+void grant_slice(pcb_t* pcb) {
+    pcb->slice_left = sched_quantum;
+    pcb->stats.slice_granted += sched_quantum;
+}
+
+/*
+ * scheduler_tick()
+ *  DESCRIPTION:
+ *    Charge a PIT tick to the time slice of the current task, preempt it
+ *    when the slice runs out (called by the pit interrupt handler).
+ *  INPUTS:
+ *      None
+ *  OUTPUTS:
+ *      None
+ */
+void scheduler_tick() {
+    pcb_t* curr = get_pcb_by_pid(get_curr_pid());
+
+    // the timeouts of sleeping tasks are checked on the tick of CPU 0 only
+    if (this_cpu()->id == 0) {
+        check_timeouts();
+    }
+
+    // the CPU is idle in sleep_until, which schedules by itself
+    if (curr == NULL || curr->state != TASK_RUNNABLE) {
+        return;
+    }
+
+    curr->stats.slice_used++;
+    if (--curr->slice_left > 0) {
+        check_preempt();
+        return;
+    }
+
+    preempt();
+    // nobody else could run, go on with a new slice
+    if (curr->slice_left <= 0) {
+        grant_slice(curr);
+    }
+}
+
+/*
+ * check_preempt()
+ *  DESCRIPTION:
+ *    Preempt the current task if an interrupt woke up a task of higher rank,
+ *    called by interrupt handlers after send_eoi.
+ *  INPUTS:
+ *      None
+ *  OUTPUTS:
+ *      None
+ */
+void check_preempt() {
+    if (this_cpu()->need_resched) {
+        preempt();
+    }
+}
+
+/*
+ * sleep_until(volatile int32_t* cond)
+ *  DESCRIPTION:
+ *    Block the current task until *cond becomes non-zero. The driver setting
+ *    *cond calls task_wake. The CPU idles in hlt while no task is runnable.
+ *  INPUTS:
+ *      cond - condition to wait for
+ *  OUTPUTS:
+ *      None
+ */
+void sleep_until(volatile int32_t* cond) {
+    sleep_until_deadline(cond, NO_DEADLINE);
+}
+
+/*
+ * sleep_until_deadline(volatile int32_t* cond, uint64_t deadline)
+ *  DESCRIPTION:
+ *    sleep_until, except that the task is woken up by the tick once
+ *    clock_ns passes deadline. A deadline already passed does not block.
+ *  INPUTS:
+ *      cond - condition to wait for
+ *      deadline - clock_ns time to give up at, NO_DEADLINE to wait forever
+ *  OUTPUTS:
+ *       0 - *cond was set
+ *      -1 - the deadline passed first
+ */
+int32_t sleep_until_deadline(volatile int32_t* cond, uint64_t deadline) {
+    uint32_t flags;
+    int32_t ret;
+    pcb_t* curr = get_pcb_by_pid(get_curr_pid());
+
+    // the waker sets *cond before task_wake takes sched_lock, so checking
+    // it under the lock after going to sleep cannot miss the wake up
+    spin_lock_irqsave(&sched_lock, flags);
+    while (*cond == 0 && (deadline == NO_DEADLINE || clock_ns() < deadline)) {
+        curr->timeout = deadline;
+        if (deadline < next_timeout) {
+            next_timeout = deadline;
+        }
+        curr->state = TASK_SLEEPING;
+        schedule_locked(0);
+        if (*cond == 0 && curr->state == TASK_SLEEPING) {
+            // nobody can run, wait for the next interrupt (sti delays to after hlt)
+            spin_unlock_no_resched(&sched_lock);
+            sti_hlt_cli();
+            spin_lock(&sched_lock);
+        }
+    }
+    curr->timeout = NO_DEADLINE;
+    curr->state = TASK_RUNNABLE;
+    ret = (*cond != 0) ? 0 : -1;
+    spin_unlock_irqrestore(&sched_lock, flags);
+    serve_ctrl_c();
+    return ret;
+}
+
+/* task_wake with sched_lock held */
+static int32_t task_wake_locked(int32_t pid) {
+    pcb_t* pcb = get_pcb_by_pid(pid);
+
+    if (pcb == NULL || !pcb->present || pcb->state != TASK_SLEEPING) {
+        return -1;
     }
+    cpu_t* cpu = &cpus[pcb->cpu];
+    pcb_t* curr = get_pcb_by_pid(cpu->curr_pid);
+
+    pcb->state = TASK_RUNNABLE;
+    trace_wakeup(pid);
+    if (curr != NULL && curr->state == TASK_RUNNABLE && task_rank(pcb) > task_rank(curr)) {
+        cpu->need_resched = 1;
+    }
+    if (cpu != this_cpu()) {
+        smp_send_resched(cpu);
+    } else if (curr != NULL && curr != pcb && curr->state == TASK_RUNNABLE && !cpu->need_resched) {
+        smp_kick_idle();
+    }
+    return 0;
+}
+
+/*
+ * check_timeouts()
+ *  DESCRIPTION:
+ *    Wake up the tasks in sleep_until_deadline whose deadline passed, on
+ *    the tick of CPU 0 with interrupts off.
+ *  INPUTS:
+ *      None
+ *  OUTPUTS:
+ *      None
+ */
+static void check_timeouts(void) {
+    uint64_t now = clock_ns();
+    pcb_t* pcb;
+    int32_t i;
+
+    // read without the lock: a torn value checks for nothing, or a tick late
+    if (now < next_timeout) {
+        return;
+    }
+    spin_lock(&sched_lock);
+    next_timeout = NO_DEADLINE;
+    for (i = 0; i < MAX_TASK_NUM; i++) {
+        pcb = get_pcb_by_pid(i);
+        if (!pcb->present || pcb->timeout == NO_DEADLINE) {
+            continue;
+        }
+        // one already woken up leaves on its own
+        if (pcb->timeout <= now) {
+            task_wake_locked(pcb->pid);
+        } else if (pcb->timeout < next_timeout) {
+            next_timeout = pcb->timeout;
+        }
+    }
+    spin_unlock_no_resched(&sched_lock);
 }
 
+/*
+ * task_wake(int32_t pid)
+ *  DESCRIPTION:
+ *    Make a sleeping task runnable again. A task outranking the current one
+ *    of its CPU asks for preemption at the next check_preempt; another CPU
+ *    is interrupted so that it notices, and an idle CPU may steal the task.
+ *  INPUTS:
+ *      pid - task to wake up
+ *  OUTPUTS:
+ *       0 - succeeded
+ *      -1 - the task is not sleeping
+ */
+int32_t task_wake(int32_t pid) {
+    uint32_t flags;
+    int32_t ret;
+
+    spin_lock_irqsave(&sched_lock, flags);
+    ret = task_wake_locked(pid);
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return ret;
+}
 
 /*
- * scheduler_round_robin()
+ * poll_wait(wait_list_t* list)
  *  DESCRIPTION:
- *    looping through each terminal.
+ *    Put the current task on the wait list of a source, called by the poll
+ *    op of a file under the lock the source is made ready with. The task
+ *    stays there until poll_wake: a stale entry only costs a spurious wake up.
  *  INPUTS:
+ *      list - wait list of the source
+ *  OUTPUTS:
  *      None
+ */
+void poll_wait(wait_list_t* list) {
+    asm volatile ("lock; btsl %1, %0"
+                  : "+m" (*list)
+                  : "r" (get_curr_pid())
+                  : "memory", "cc");
+}
+
+/*
+ * poll_wake(wait_list_t* list)
+ *  DESCRIPTION:
+ *    Wake up the tasks on the wait list of a source that got ready, they
+ *    leave the list and scan their files again.
+ *  INPUTS:
+ *      list - wait list of the source
  *  OUTPUTS:
  *      None
  */
-void scheduler_round_robin() {
-    switch_running_terminal((curr_running_terminal + 1) % MAX_TERMINAL_NUM);
+void poll_wake(wait_list_t* list) {
+    uint32_t pids = 0;
+    uint32_t flags;
+    int32_t pid;
+
+    // polls may put themselves on the list again meanwhile
+    asm volatile ("lock; xchgl %0, %1"
+                  : "+r" (pids), "+m" (*list)
+                  :
+                  : "memory");
+    if (pids == 0) {
+        return;
+    }
+    spin_lock_irqsave(&sched_lock, flags);
+    for (pid = 0; pid < MAX_TASK_NUM; pid++) {
+        if (pids & (1 << pid)) {
+            // set before the wake up, see sleep_until
+            get_pcb_by_pid(pid)->poll_event = 1;
+            task_wake_locked(pid);
+        }
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
 }
+
+/*
+ * yield()
+ *  DESCRIPTION:
+ *    The yield system call, give up the rest of the time slice to the next
+ *    runnable task.
+ *  INPUTS:
+ *      None
+ *  OUTPUTS:
+ *      0
+ */
+int32_t yield() {
+    schedule();
+    return 0;
+}
+
+/*
+ * handoff(int32_t pid)
+ *  DESCRIPTION:
+ *    The handoff system call, wake the given task and run it at once for the
+ *    rest of the current time slice, skipping the round robin order.
+ *  INPUTS:
+ *      pid - task to hand the CPU to
+ *  OUTPUTS:
+ *       0 - succeeded
+ *      -1 - the task does not exist or is waiting for a child
+ */
+int32_t handoff(int32_t pid) {
+    uint32_t flags;
+    pcb_t* pcb = get_pcb_by_pid(pid);
+
+    if (pcb == NULL) {
+        return -1;
+    }
+
+    spin_lock_irqsave(&sched_lock, flags);
+    if (!pcb->present || pcb->state == TASK_WAITING) {
+        spin_unlock_irqrestore(&sched_lock, flags);
+        return -1;
+    }
+    task_wake_locked(pid);
+    if (pcb != get_pcb_by_pid(get_curr_pid())) {
+        get_pcb_by_pid(get_curr_pid())->stats.nr_voluntary++;
+    }
+    switch_to_task(pcb);
+    spin_unlock_irqrestore(&sched_lock, flags);
+    serve_ctrl_c();
+    return 0;
+}
+
+/*
+ * setsched(int32_t policy, int32_t priority)
+ *  DESCRIPTION:
+ *    The setsched system call, change the scheduling class of the calling
+ *    task. Tasks it executes later inherit the class.
+ *  INPUTS:
+ *      policy   - SCHED_NORMAL or SCHED_RT
+ *      priority - RT_PRIO_MIN to RT_PRIO_MAX for SCHED_RT, ignored otherwise
+ *  OUTPUTS:
+ *       0 - succeeded
+ *      -1 - invalid policy or priority
+ */
+int32_t setsched(int32_t policy, int32_t priority) {
+    uint32_t flags;
+    pcb_t* curr = get_current_pcb();
+    pcb_t* next;
+
+    if (policy == SCHED_NORMAL) {
+        priority = 0;
+    } else if (policy != SCHED_RT || priority < RT_PRIO_MIN || priority > RT_PRIO_MAX) {
+        return -1;
+    }
+
+    spin_lock_irqsave(&sched_lock, flags);
+    curr->policy = policy;
+    curr->rt_priority = priority;
+
+    // a lowered rank lets a runnable task of higher rank run now
+    next = pick_next_task();
+    if (next != NULL && task_rank(next) > task_rank(curr)) {
+        schedule_locked(0);
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
+    serve_ctrl_c();
+    return 0;
+}
+
+/*
+ * settimer(int32_t hz, int32_t quantum)
+ *  DESCRIPTION:
+ *    The settimer system call, tune the PIT frequency and the time slice
+ *    of every task. Short slices favor latency, long ones throughput.
+ *  INPUTS:
+ *      hz      - PIT_MIN_FREQ to PIT_MAX_FREQ, 0 keeps the frequency
+ *      quantum - ticks in a time slice up to SCHED_MAX_QUANTUM, 0 keeps it
+ *  OUTPUTS:
+ *       0 - succeeded
+ *      -1 - invalid frequency or quantum
+ */
+int32_t settimer(int32_t hz, int32_t quantum) {
+    if ((hz != 0 && (hz < PIT_MIN_FREQ || hz > PIT_MAX_FREQ)) ||
+        quantum < 0 || quantum > SCHED_MAX_QUANTUM) {
+        return -1;
+    }
+
+    if (hz != 0) {
+        pit_set_freq(hz);
+    }
+    if (quantum != 0) {
+        // running slices keep their length, new ones get the new quantum
+        sched_quantum = quantum;
+    }
+    return 0;
+}
+
 /*
  * get_curr_pid()
  *  DESCRIPTION:
- *    get current running terminal's pid of running PCB.
+ *    get the pid of the task running on this CPU, -1 in the idle thread.
  *  INPUTS:
  *      None
  *  OUTPUTS:
  *      None
  */
 int32_t get_curr_pid(){
-    return terminal_info_array[curr_running_terminal].curr_pid;
+    return this_cpu()->curr_pid;
 }
 /*
  * set_curr_pid()
  *  DESCRIPTION:
- *    set up current running terminal's pid of running PCB.
+ *    set up the foreground task of the running terminal (the one the keyboard
+ *    wakes up); task_switch makes it the task running on this CPU.
  *  INPUTS:
  *      None
  *  OUTPUTS:
  *      None
  */
 void set_curr_pid(int32_t pid){
-    terminal_info_array[curr_running_terminal].curr_pid = pid;
+    terminal_info_array[curr_running_terminal]->curr_pid = pid;
 }
 /*
- * terminal_init()
+ * sched_init()
  *  DESCRIPTION:
- *    initialize the terminal.
+ *    set up the scheduler and terminal locks, before the APs start.
  *  INPUTS:
  *      None
  *  OUTPUTS:
  *      None
  */
-void terminal_init(){
-    int i;
+void sched_init(){
+    spin_lock_init(&sched_lock, "sched");
+    spin_lock_init(&boot_terminal.lock, "tty0");
+}
+
+/*
+ * terminal_setup(int32_t tid, terminal_info_t* t)
+ *  DESCRIPTION:
+ *    reset the state of a terminal being opened and clear its screen.
+ *  INPUTS:
+ *      tid - terminal id
+ *      t - its state, with the lock set up
+ *  OUTPUTS:
+ *      None
+ */
+static void terminal_setup(int32_t tid, terminal_info_t* t){
+    t->curr_pid = -1;
+    t->screen_x = 0;
+    t->screen_y = 0;
+    t->current_show_y = 0;
+    t->view_history_show_y = 0;
+    t->video_mem = (char*) VIDEO + (tid * term_video_pages % VGA_TEXT_PAGES) * TEXT_PAGE_SIZE;
+    t->video_rows = term_video_pages * TEXT_PAGE_SIZE / ROW_BYTES;
+    t->video_top = 0;
+    t->video_shared = (tid >= VGA_TEXT_PAGES || tid + VGA_TEXT_PAGES < nr_terminals);
+    t->vidmap_pid = -1;
+    t->screen_stale = 0;
+    memset(&t->stats, 0, sizeof(term_stats_t));
+    t->input.head = 0;
+    t->input.tail = 0;
+    t->input.lines = 0;
+    t->input_ready = 0;
+    t->raw_pid = -1;
+    t->curr_string_len = 0;
+
+    set_screen_terminal(t);
+    vt_reset();
+    clear();
+    restore_running_terminal();
+}
+
+/*
+ * open_terminal(int32_t tid)
+ *  DESCRIPTION:
+ *    allocate the state of a terminal and start its shell, unless done
+ *    already. Loading the shell may sleep, called from the workqueue.
+ *  INPUTS:
+ *      tid - terminal id, below nr_terminals
+ *  OUTPUTS:
+ *       0 - the terminal has its shell
+ *      -1 - out of memory or pids
+ */
+static int32_t open_terminal(int32_t tid){
+    terminal_info_t* t = terminal_info_array[tid];
+    int8_t name[LOCK_NAME_LEN] = "tty";
+    pcb_t* shell;
+    uint32_t flags;
+
+    if (t == NULL) {
+        t = kmem_alloc(sizeof(terminal_info_t));
+        if (t == NULL) {
+            return -1;
+        }
+        itoa(tid, &name[3], 10);
+        spin_lock_init(&t->lock, name);
+        // unpublished yet, the lock keeps this CPU drawing on it
+        spin_lock_irqsave(&t->lock, flags);
+        terminal_setup(tid, t);
+        spin_unlock_irqrestore(&t->lock, flags);
+        terminal_info_array[tid] = t;
+    }
+    if (t->curr_pid != -1) {
+        return 0;
+    }
+
+    shell = create_task((uint8_t*) "shell", NULL, tid);
+    if (shell == NULL) {
+        return -1;
+    }
+    spin_lock_irqsave(&sched_lock, flags);
+    t->curr_pid = shell->pid;
+    shell->state = TASK_RUNNABLE;
+    spin_unlock_irqrestore(&sched_lock, flags);
+    smp_kick_idle();
+    return 0;
+}
+
+/*
+ * open_terminal_work(work_t* work)
+ *  DESCRIPTION:
+ *    open the terminals asked for by show_terminal, and show them.
+ *  INPUTS:
+ *      work - open_work
+ *  OUTPUTS:
+ *      None
+ */
+static void open_terminal_work(work_t* work){
+    uint32_t requests;
+    int32_t tid;
 
-    for (i = 0; i < MAX_TERMINAL_NUM; i++) {
-        terminal_info_array[i].curr_pid = -1;
-        terminal_info_array[i].screen_x = 0;
-        terminal_info_array[i].screen_y = 0;
-        terminal_info_array[i].current_show_y = 0;
-        terminal_info_array[i].view_history_show_y = 0;
-        terminal_info_array[i].video_mem = (char*) (VIDEO + (1 + i) * (1 << 12));
-        terminal_info_array[i].curr_string_len = 0;
+    // taken at once, Alt+Fn may ask again meanwhile
+    requests = 0;
+    asm volatile ("lock; xchgl %0, %1"
+                  : "+r" (requests), "+m" (open_requests)
+                  :
+                  : "memory");
+    for (tid = 0; tid < nr_terminals; tid++) {
+        if ((requests & (1 << tid)) && open_terminal(tid) == 0) {
+            switch_active_terminal(tid);
+        }
     }
+}
 
-    // intialize the value of terminal 0
+/*
+ * show_terminal(int32_t tid)
+ *  DESCRIPTION:
+ *    display terminal tid. The first time it is shown the terminal is not
+ *    open yet: its setup (the screen, its shell) is queued on the system
+ *    workqueue, which shows it once it is open.
+ *  INPUTS:
+ *      tid - the terminal to show
+ *  OUTPUTS:
+ *      0 if it is shown or queued, -1 if there is no terminal tid
+ */
+int32_t show_terminal(int32_t tid){
+    terminal_info_t* t;
+
+    if (tid < 0 || tid >= nr_terminals) {
+        return -1;
+    }
+    t = terminal_info_array[tid];
+    if (t != NULL && t->curr_pid != -1) {
+        return switch_active_terminal(tid);
+    }
+    asm volatile ("lock; btsl %1, %0"
+                  : "+m" (open_requests)
+                  : "r" (tid)
+                  : "memory", "cc");
+    schedule_work(&open_work);
+    return 0;
+}
+
+/*
+ * terminal_init()
+ *  DESCRIPTION:
+ *    initialize the terminal. Only terminal 0 is opened, the others cost
+ *    nothing until they are first shown (show_terminal).
+ *  INPUTS:
+ *      None
+ *  OUTPUTS:
+ *      None
+ */
+void terminal_init(){
+    uint32_t flags;
+    pcb_t* shell;
+
+    // terminal 0 is displayed first
     curr_active_terminal = 0;
+
+    sched_quantum = cmdline_get_int("quantum", SCHED_DEFAULT_QUANTUM, 1, SCHED_MAX_QUANTUM);
+    lazy_render = cmdline_get_int("lazy_render", 1, 0, 1);
+    scrollback_depth = cmdline_get_int("scrollback", SCROLLBACK_MAX_LINES, 0, SCROLLBACK_MAX_LINES);
+    nr_terminals = cmdline_get_int("terminals", DEFAULT_TERMINAL_NUM, 1, MAX_TERMINAL_NUM);
+    term_video_pages = (nr_terminals < VGA_TEXT_PAGES) ? VGA_TEXT_PAGES / nr_terminals : 1;
+
     curr_running_terminal = 0;
-    terminal_info_array[0].video_mem = (char*) VIDEO;
-    set_all_x_y(terminal_info_array[0].screen_x, terminal_info_array[0].screen_y,
-        terminal_info_array[0].current_show_y, terminal_info_array[0].view_history_show_y); 
-    set_video_mem((char*) VIDEO);
-    set_buf_video_mem(terminal_info_array[0].buf_video_mem);
-    set_user_video_mem((char*) VIDEO);
-    set_curr_string_len(terminal_info_array[0].curr_string_len);
-    set_keyboard_buffer(terminal_info_array[0].keyboard_buffer);
-
-    // execute shell of terminal 0
-    clear();
-    execute((uint8_t*) "shell");
+    terminal_setup(0, &boot_terminal);
+    shell = create_task((uint8_t*) "shell", NULL, 0);
+    if (shell == NULL) {
+        printf("Cannot start shell!\n");
+        return;
+    }
+    set_curr_pid(shell->pid);
+
+    spin_lock_irqsave(&sched_lock, flags);
+    shell->state = TASK_RUNNABLE;
+
+    // run the shell of terminal 0, the boot thread is never resumed
+    set_user_video_mem(boot_terminal.video_mem);
+    task_switch(&this_cpu()->idle_context, shell);
 }
@@ -4,46 +4,83 @@
 #include "types.h"
 #include "lib.h"
 #include "terminal.h"
+#include "task.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "scrollback.h"
 
-#define MAX_TERMINAL_NUM    3
-#define BUF_VIDEO_MEM_SIZE  (10*NUM_COLS*NUM_ROWS*2)
+/* terminals shown by Alt+F1 to Alt+F12, nr_terminals of them (terminals boot option) */
+#define MAX_TERMINAL_NUM    12
+#define DEFAULT_TERMINAL_NUM    3
 
-// typedef struct task_regs
-// {
-//     uint32_t ebx;
-//     uint32_t ecx;
-//     uint32_t edx;
-//     uint32_t esi;
-//     uint32_t edi;
-//     uint32_t flags;
-// } task_regs_t;
+/*
+ * VGA text memory is split between the terminals, each keeps its screen
+ * there all the time: a window scrolling down over the rows of its part.
+ * The CRTC start address shows the window of the terminal on display.
+ * With more terminals than pages, two terminals share a page: a hidden one
+ * is then never drawn (video_shared, see screen_deferred).
+ */
+#define TEXT_PAGE_SIZE      0x1000
 
+/* time slice of a task in PIT ticks, set by the quantum boot option or settimer */
+#define SCHED_DEFAULT_QUANTUM   1
+#define SCHED_MAX_QUANTUM       100
 
 typedef struct terminal_info_t {
     int     screen_x;
     int     screen_y;
-    int     current_show_y;
-    int     view_history_show_y;
-    char*   video_mem;
-    char    buf_video_mem[BUF_VIDEO_MEM_SIZE];
-
-    int32_t enter_flag;
-    int32_t curr_string_len;
+    int     current_show_y;     // number of the line at the top of the screen
+    int     view_history_show_y;    // line at the top while looking at the scrollback
+    char*   video_mem;          // first row of the video memory of the terminal
+    int     video_rows;         // rows there
+    int     video_top;          // row the screen starts at
+    int32_t vidmap_pid;         // task drawing on the first rows itself, -1 if none
+    int     video_shared;       // another terminal uses the same video memory
+    int     screen_stale;       // output went to the buffer only, see lazy_render
+    vt_state_t vt;
+    term_stats_t stats;
+    char    buf_video_mem[SCREEN_BYTES];    // rows of the screen, a ring starting at current_show_y
+    scrollback_t history;       // lines above them
+
+    input_ring_t input;         // typed, waiting to be read
+    volatile int32_t input_ready;   // a read would not wait, see input_update
+    int32_t raw_pid;            // task reading keys raw (TTY_RAW), -1 for line editing
+    wait_list_t input_pollers;  // tasks polling for input_ready
+    int32_t curr_string_len;    // the line being edited
     uint8_t keyboard_buffer[MAX_TERMINAL_BUF_CHARACTERS]; 
 
     int32_t curr_pid;
-    uint32_t esp;
-    uint32_t ebp;
-    // task_regs_t curr_regs;
-    
+
+    spinlock_t lock;        // screen and keyboard buffer, taken with interrupts off
 } terminal_info_t;
 
-int32_t curr_active_terminal;
-int32_t curr_running_terminal;
-terminal_info_t terminal_info_array[3];
+extern int32_t curr_active_terminal;
+/* terminal of the task running on this CPU */
+#define curr_running_terminal   (this_cpu()->running_terminal)
+extern int32_t nr_terminals;
+/* terminal 0, it prints the boot messages before terminal_init */
+extern terminal_info_t boot_terminal;
+/* the terminals opened so far, NULL for the others (see show_terminal) */
+extern terminal_info_t* terminal_info_array[MAX_TERMINAL_NUM];
+
+/*
+ * Output to a hidden terminal only goes to its buffer, its screen is drawn
+ * again once when it is shown. Set by the lazy_render boot option (on by
+ * default).
+ */
+extern int32_t lazy_render;
+
+/*
+ * Guards the scheduling state: state, cpu and on_cpu of the pcbs, the
+ * current task and need_resched of each CPU and the foreground task of each
+ * terminal. Taken with interrupts off and held across task_switch.
+ */
+extern spinlock_t sched_lock;
 
+/* Draw screen output on the terminal being displayed (keyboard echo) */
 void set_active_terminal();
 
+/* Draw screen output on the terminal being run again */
 void restore_running_terminal();
 
 /*
@@ -59,24 +96,81 @@ void restore_running_terminal();
 int32_t switch_active_terminal(int32_t tid);
 
 /*
- * switch_running_terminal
+ * show_terminal
  *  DESCRIPTION:
- *      Switch the terminal currently being run 
-        (This is the scheduler function to be called inside pit interrupt handler) 
+ *      Alt+Fn, switch to a terminal. One that nobody has opened yet is
+ *      opened first by the system workqueue: its state is allocated and
+ *      its shell started, then it is shown.
  *  INPUTS:
- *      tid - terminal Id
+ *      tid - terminal id
  *  OUTPUTS:
- *       0 - succeeded
- *      -1 - failed
+ *       0 - succeeded, or the terminal is being opened
+ *      -1 - no such terminal
+ */
+int32_t show_terminal(int32_t tid);
+
+/*
+ * switch_to_task
+ *  DESCRIPTION:
+ *      Run the given task now, the terminal being run follows the task.
+ *      The caller holds sched_lock, which is held again when we are back.
+ *  INPUTS:
+ *      next - a present task that is not waiting for a child
  */
-void switch_running_terminal(int32_t tid);
+void switch_to_task(pcb_t* next);
+
+/* Round robin over the runnable tasks, NULL when no task can run (sched_lock held) */
+pcb_t* pick_next_task();
+
+/* Give the CPU to the next runnable task, returns at once if there is none */
+void schedule();
+
+/* Take the CPU away from the current task at the end of its time slice */
+void preempt();
+
+/* First code of a new task, drops the sched_lock of whoever switched to it */
+void schedule_tail();
+
+/* Preempt the current task if an interrupt woke up a task of higher rank */
+void check_preempt();
+
+/* Halt the current task if Ctrl+C was pressed on its terminal meanwhile, no lock held */
+void serve_ctrl_c();
 
-void scheduler_round_robin();
+/* Charge a PIT tick to the time slice of the current task */
+void scheduler_tick();
+
+/* Start a new time slice of a task being switched in */
+void grant_slice(pcb_t* pcb);
+
+/* Block the current task until *cond becomes non-zero (see task_wake) */
+void sleep_until(volatile int32_t* cond);
+
+/* sleep_until, giving up at deadline (clock_ns): 0 if *cond was set, -1 if the deadline passed */
+int32_t sleep_until_deadline(volatile int32_t* cond, uint64_t deadline);
+
+/* Make a sleeping task runnable again, -1 if it is not sleeping */
+int32_t task_wake(int32_t pid);
+
+/* Put the current task on a wait list, from the poll op of a file */
+void poll_wait(wait_list_t* list);
+
+/* Wake up the tasks on a wait list and empty it, once the source got ready */
+void poll_wake(wait_list_t* list);
+
+/* system calls: give up the time slice, to anyone or to the given pid */
+int32_t yield();
+int32_t handoff(int32_t pid);
+int32_t setsched(int32_t policy, int32_t priority);
+int32_t settimer(int32_t hz, int32_t quantum);
 
 int32_t get_curr_pid();
 
 void set_curr_pid(int32_t pid);
 
+/* Set up the scheduler and terminal locks, before the APs start */
+void sched_init();
+
 void terminal_init();
 
 #endif /* SCHEDULER_H */
@@ -0,0 +1,155 @@
+#include "scrollback.h"
+
+/*
+ * A line record is a header, the attribute runs and the characters:
+ *   nchars, nruns, fill attribute,
+ *   nruns times (length, attribute), covering the nchars characters,
+ *   nchars characters.
+ * The rest of the line is blanks in the fill attribute.
+ */
+#define REC_HEADER      3
+#define REC_MAX         (REC_HEADER + 3 * NUM_COLS)
+
+int32_t scrollback_depth = SCROLLBACK_MAX_LINES;
+
+/* bytes of the record starting at off in data */
+static int32_t rec_size(const scrollback_t* sb, int32_t off)
+{
+    int32_t nchars = sb->data[off];
+    int32_t nruns = sb->data[(off + 1) % SCROLLBACK_BYTES];
+
+    return REC_HEADER + 2 * nruns + nchars;
+}
+
+/* copy n bytes out of the ring of data, from off on */
+static void ring_read(const scrollback_t* sb, int32_t off, uint8_t* buf, int32_t n)
+{
+    int32_t part = SCROLLBACK_BYTES - off;
+
+    if (part >= n) {
+        memcpy(buf, &sb->data[off], n);
+    } else {
+        memcpy(buf, &sb->data[off], part);
+        memcpy(buf + part, sb->data, n - part);
+    }
+}
+
+/* copy n bytes into the ring of data, from off on */
+static void ring_write(scrollback_t* sb, int32_t off, const uint8_t* buf, int32_t n)
+{
+    int32_t part = SCROLLBACK_BYTES - off;
+
+    if (part >= n) {
+        memcpy(&sb->data[off], buf, n);
+    } else {
+        memcpy(&sb->data[off], buf, part);
+        memcpy(sb->data, buf + part, n - part);
+    }
+}
+
+/*
+ *  scrollback_clear
+ *  DESCRIPTION: forget all the lines kept
+ *  INPUTS: sb -- the scrollback of a terminal
+ *          next -- number of the next line pushed
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void scrollback_clear(scrollback_t* sb, int32_t next)
+{
+    sb->first = next;
+    sb->count = 0;
+    sb->used = 0;
+    sb->head = 0;
+}
+
+/*
+ *  scrollback_push
+ *  DESCRIPTION: compress a row leaving the screen and keep it as the newest
+ *               line, dropping the oldest ones to make room
+ *  INPUTS: sb -- the scrollback of a terminal
+ *          row -- NUM_COLS cells, character then attribute
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void scrollback_push(scrollback_t* sb, const uint8_t* row)
+{
+    uint8_t rec[REC_MAX];
+    uint8_t* runs = &rec[REC_HEADER];
+    int32_t nchars, nruns, size, i;
+    uint8_t fill = row[((NUM_COLS - 1) << 1) + 1];
+
+    // trailing blanks in the attribute of the last cell are left out
+    for (nchars = NUM_COLS; nchars > 0; nchars--) {
+        if (row[(nchars - 1) << 1] != ' ' || row[((nchars - 1) << 1) + 1] != fill) {
+            break;
+        }
+    }
+    nruns = 0;
+    for (i = 0; i < nchars; i++) {
+        if (nruns == 0 || runs[2 * nruns - 1] != row[(i << 1) + 1]) {
+            runs[2 * nruns] = 0;
+            runs[2 * nruns + 1] = row[(i << 1) + 1];
+            nruns++;
+        }
+        runs[2 * nruns - 2]++;
+    }
+    for (i = 0; i < nchars; i++) {
+        runs[2 * nruns + i] = row[i << 1];
+    }
+    rec[0] = nchars;
+    rec[1] = nruns;
+    rec[2] = fill;
+    size = REC_HEADER + 2 * nruns + nchars;
+
+    if (scrollback_depth == 0) {
+        sb->first++;
+        return;
+    }
+    while (sb->count != 0 && (sb->count >= scrollback_depth || sb->used + size > SCROLLBACK_BYTES)) {
+        sb->used -= rec_size(sb, sb->start[sb->first % SCROLLBACK_MAX_LINES]);
+        sb->first++;
+        sb->count--;
+    }
+    ring_write(sb, sb->head, rec, size);
+    sb->start[(sb->first + sb->count) % SCROLLBACK_MAX_LINES] = sb->head;
+    sb->head = (sb->head + size) % SCROLLBACK_BYTES;
+    sb->used += size;
+    sb->count++;
+}
+
+/*
+ *  scrollback_get
+ *  DESCRIPTION: draw a line kept into a row of cells
+ *  INPUTS: sb -- the scrollback of a terminal
+ *          line -- number of the line
+ *          row -- NUM_COLS cells to fill
+ *  OUTPUTS: none
+ *  RETURN VALUE: 0 on success, -1 if the line is not kept (the row is left blank)
+ */
+int32_t scrollback_get(const scrollback_t* sb, int32_t line, uint8_t* row)
+{
+    uint8_t rec[REC_MAX];
+    const uint8_t* runs = &rec[REC_HEADER];
+    const uint8_t* chars;
+    int32_t off, nchars, nruns, i, x, len;
+
+    if (line < sb->first || line >= sb->first + sb->count) {
+        memset_word(row, (ATTRIB << 8) | ' ', NUM_COLS);
+        return -1;
+    }
+    off = sb->start[line % SCROLLBACK_MAX_LINES];
+    ring_read(sb, off, rec, rec_size(sb, off));
+    nchars = rec[0];
+    nruns = rec[1];
+    chars = &runs[2 * nruns];
+
+    for (i = 0, x = 0; i < nruns; i++) {
+        for (len = runs[2 * i]; len > 0; len--, x++) {
+            row[x << 1] = chars[x];
+            row[(x << 1) + 1] = runs[2 * i + 1];
+        }
+    }
+    memset_word(row + (nchars << 1), (rec[2] << 8) | ' ', NUM_COLS - nchars);
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef _SCROLLBACK_H
+#define _SCROLLBACK_H
+
+#include "types.h"
+#include "lib.h"
+
+/*
+ * Lines that scrolled off the top of a terminal, kept compressed: a line
+ * record holds its characters up to the trailing blanks, and the attribute
+ * runs they are drawn with. Most lines are short and in one color, a few
+ * bytes each. The oldest lines go when there are scrollback_depth of them
+ * or their bytes run out.
+ */
+#define SCROLLBACK_MAX_LINES    (100 * NUM_ROWS)
+#define SCROLLBACK_BYTES        (30 * 1024)
+
+typedef struct scrollback_t {
+    uint8_t  data[SCROLLBACK_BYTES];        // line records, a ring of bytes
+    uint16_t start[SCROLLBACK_MAX_LINES];   // offset of the record of each line, a ring
+    int32_t  first;                         // number of the oldest line kept
+    int32_t  count;                         // lines kept
+    int32_t  used;                          // bytes of data they take
+    int32_t  head;                          // where the next record goes in data
+} scrollback_t;
+
+/* lines kept at most, set by the scrollback boot option */
+extern int32_t scrollback_depth;
+
+/* Forget all lines, the next one pushed is line number next */
+void scrollback_clear(scrollback_t* sb, int32_t next);
+
+/* Keep a row of NUM_COLS cells leaving the screen, as the line after the last */
+void scrollback_push(scrollback_t* sb, const uint8_t* row);
+
+/* Draw line number line into a row of NUM_COLS cells, blank if it is not kept */
+int32_t scrollback_get(const scrollback_t* sb, int32_t line, uint8_t* row);
+
+#endif /* _SCROLLBACK_H */
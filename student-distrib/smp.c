@@ -0,0 +1,226 @@
+#include "smp.h"
+
+#include "lib.h"
+#include "page.h"
+#include "cmdline.h"
+#include "scheduler.h"
+#include "task.h"
+#include "pit.h"
+
+#define AP_START_TIMEOUT    100000      // microseconds to wait for an AP
+
+/* Real mode trampoline and its GDT pointer, see trampoline.S */
+extern uint8_t ap_trampoline[], ap_trampoline_end[], ap_trampoline_gdtr[];
+
+cpu_t cpus[MAX_CPUS] = {
+    [0] = {.id = 0, .started = 1, .curr_pid = -1, .dead_pid = -1, .screen = &boot_terminal,
+           .pd = pd, .pt_user_video = pt_user_video, .tss = &tss},
+};
+int32_t nr_cpus = 1;
+int32_t smp_apic_to_cpu[256];
+
+/* stack handed to the AP being started, read by ap_start32 */
+uint32_t ap_boot_stack;
+
+static uint8_t ap_stacks[MAX_CPUS][AP_STACK_SIZE] __attribute__((aligned(16)));
+static tss_t ap_tss[MAX_CPUS];
+static pde_t ap_pd[MAX_CPUS][NUM_PDE] __attribute__((aligned(SIZE_PD)));
+static pte_t ap_pt_user_video[MAX_CPUS][NUM_PTE] __attribute__((aligned(SIZE_PT)));
+
+/* 
+ *  setup_cpu
+ *  DESCRIPTION: build the GDT, TSS and page directory of an AP
+ *  INPUTS: cpu -- the AP
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+static void setup_cpu(cpu_t* cpu)
+{
+    seg_desc_t tss_desc;
+
+    cpu->curr_pid = -1;
+    cpu->dead_pid = -1;
+    cpu->running_terminal = -1;
+    cpu->screen = &boot_terminal;
+    cpu->pd = ap_pd[cpu->id];
+    cpu->pt_user_video = ap_pt_user_video[cpu->id];
+    page_init_cpu(cpu->pd, cpu->pt_user_video);
+
+    // same kernel stack switching as the BSP
+    cpu->tss = &ap_tss[cpu->id];
+    memset(cpu->tss, 0, sizeof(tss_t));
+    cpu->tss->ldt_segment_selector = KERNEL_LDT;
+    cpu->tss->ss0 = KERNEL_DS;
+    cpu->tss->esp0 = (uint32_t) ap_stacks[cpu->id] + AP_STACK_SIZE;
+
+    // same layout and selectors as the BSP GDT, only the TSS differs
+    memcpy(cpu->gdt, (void*) gdt_desc.addr, sizeof(cpu->gdt));
+    tss_desc = tss_desc_ptr;
+    tss_desc.type = 0x9;    // available, the BSP TSS is marked busy
+    SET_TSS_PARAMS(tss_desc, cpu->tss, tss_size);
+    cpu->gdt[KERNEL_TSS >> 3] = tss_desc;
+    cpu->gdt_desc.size = sizeof(cpu->gdt) - 1;
+    cpu->gdt_desc.addr = (uint32_t) cpu->gdt;
+}
+
+/* 
+ *  smp_init
+ *  DESCRIPTION: start every AP listed by the firmware (up to the maxcpus
+ *               boot option). The APs idle until terminal_init makes the
+ *               shells runnable.
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ *  SIDE EFFECTS: must run after apic_init and pit_init
+ */
+void smp_init(void)
+{
+    int32_t i, wait;
+    int32_t max_cpus = cmdline_get_int("maxcpus", MAX_CPUS, 1, MAX_CPUS);
+    cpu_t* cpu;
+
+    if (!lapic_enabled) {
+        return;
+    }
+
+    cpus[0].apic_id = lapic_id();
+    smp_apic_to_cpu[cpus[0].apic_id] = 0;
+
+    // the trampoline runs in real mode at a fixed low address
+    memcpy((void*) AP_TRAMPOLINE_ADDR, ap_trampoline, ap_trampoline_end - ap_trampoline);
+    memcpy((void*) (AP_TRAMPOLINE_ADDR + (ap_trampoline_gdtr - ap_trampoline)), &gdt_desc, sizeof(x86_desc_t));
+
+    for (i = 0; i < mp_info.nr_cpus && nr_cpus < max_cpus; i++) {
+        if (mp_info.lapic_id[i] == cpus[0].apic_id) {
+            continue;
+        }
+        cpu = &cpus[nr_cpus];
+        cpu->id = nr_cpus;
+        cpu->apic_id = mp_info.lapic_id[i];
+        smp_apic_to_cpu[cpu->apic_id] = cpu->id;
+        setup_cpu(cpu);
+
+        ap_boot_stack = (uint32_t) ap_stacks[cpu->id] + AP_STACK_SIZE;
+        lapic_start_ap(cpu->apic_id, AP_TRAMPOLINE_ADDR);
+        for (wait = 0; wait < AP_START_TIMEOUT && !cpu->started; wait++) {
+            io_delay(1);
+        }
+        if (!cpu->started) {
+            printf("CPU %d (APIC %d) did not start\n", cpu->id, cpu->apic_id);
+            continue;
+        }
+        nr_cpus++;
+    }
+    printf("Done Initiating SMP, %d CPU(s) online\n", nr_cpus);
+}
+
+/* 
+ *  ap_main
+ *  DESCRIPTION: finish the setup of an AP and run its idle loop. The idle
+ *               loop steals the first task that becomes runnable; the idle
+ *               thread is never resumed after that, an idle CPU waits in
+ *               sleep_until of its last task like the BSP.
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: never returns
+ */
+void ap_main(void)
+{
+    cpu_t* cpu = &cpus[smp_apic_to_cpu[lapic_id()]];
+
+    asm volatile ("lgdt %0" : : "m" (cpu->gdt_desc) : "memory");
+    lidt(idt_desc_ptr);
+    lldt(KERNEL_LDT);
+    ltr(KERNEL_TSS);
+    load_page_directory(cpu->pd);
+    lapic_init_ap();
+    pit_init_ap();
+
+    cpu->started = 1;
+
+    while (1) {
+        schedule();
+        // nothing to steal, wait for a tick or a wake up (sti delays to after hlt)
+        sti_hlt_cli();
+    }
+}
+
+/* 
+ *  smp_send_resched
+ *  DESCRIPTION: make a CPU run its scheduler
+ *  INPUTS: cpu -- target, nothing happens for the running CPU
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void smp_send_resched(cpu_t* cpu)
+{
+    if (cpu != this_cpu()) {
+        lapic_send_ipi(cpu->apic_id, IPI_RESCHED_VECTOR, 0);
+    }
+}
+
+/* 
+ *  smp_send_resched_all
+ *  DESCRIPTION: make every other CPU run its scheduler
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void smp_send_resched_all(void)
+{
+    if (nr_cpus > 1) {
+        lapic_send_ipi(0, IPI_RESCHED_VECTOR, ICR_ALL_BUT_SELF);
+    }
+}
+
+/* 
+ *  smp_kick_idle
+ *  DESCRIPTION: wake one idle CPU (halted in its idle loop or in the
+ *               sleep_until of its task) so that it steals work
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void smp_kick_idle(void)
+{
+    int32_t i;
+    pcb_t* curr;
+
+    for (i = 0; i < nr_cpus; i++) {
+        curr = get_pcb_by_pid(cpus[i].curr_pid);
+        if (&cpus[i] != this_cpu() && (curr == NULL || curr->state != TASK_RUNNABLE)) {
+            smp_send_resched(&cpus[i]);
+            return;
+        }
+    }
+}
+
+/* 
+ *  resched_ipi_handler
+ *  DESCRIPTION: another CPU woke a task of ours; preempt if asked to. A CPU
+ *               halted in sleep_until or in its idle loop looks for work by
+ *               itself when the handler returns.
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void resched_ipi_handler(void)
+{
+    lapic_eoi();
+    check_preempt();
+}
+
+/* 
+ *  tick_ipi_handler
+ *  DESCRIPTION: the PIT tick forwarded by the BSP, when the local APIC
+ *               timers are not used
+ *  INPUTS: cs -- code segment of the interrupted code
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void tick_ipi_handler(uint32_t cs)
+{
+    lapic_eoi();
+    task_account_tick(cs);
+    scheduler_tick();
+}
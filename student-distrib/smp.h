@@ -0,0 +1,73 @@
+#ifndef _SMP_H
+#define _SMP_H
+
+#include "types.h"
+#include "x86_desc.h"
+#include "switch.h"
+#include "mp.h"
+#include "apic.h"
+
+#define AP_TRAMPOLINE_ADDR  0x8000      // real mode entry of the APs, 4KB aligned below 1MB
+#define AP_STACK_SIZE       0x1000      // stack of the idle thread of an AP
+#define GDT_ENTRIES         8           // up to KERNEL_LDT, see x86_desc.S
+
+#ifndef ASM
+
+struct terminal_info_t;
+struct tasklet_t;
+
+/* Per-CPU state, cpus[0] is the bootstrap processor */
+typedef struct cpu_t {
+    int32_t             id;             // index into cpus
+    uint8_t             apic_id;
+    volatile int32_t    started;        // set by the AP once it idles
+
+    int32_t             curr_pid;       // task running on this CPU, -1 for the idle thread
+    int32_t             running_terminal;   // terminal of that task
+    struct terminal_info_t* screen;     // terminal putc/printf draw on
+    volatile int32_t    need_resched;   // a task outranking curr_pid was woken up
+    context_t           idle_context;   // boot/idle thread, switched away from only once
+    int32_t             preempt_count;  // locks held and preempt_disable calls, see spinlock.h
+    int32_t             dead_pid;       // task that halted here, freed once switched away
+    int32_t             timer_hz;       // rate the local APIC timer runs at, 0 if stopped
+    volatile uint32_t   softirq_pending;    // bit per softirq number, see softirq.h
+    struct tasklet_t*   tasklet_head;   // tasklets queued on this CPU, oldest first
+    struct tasklet_t*   tasklet_tail;
+
+    pde_t*              pd;             // page directory, the user pages differ per CPU
+    pte_t*              pt_user_video;  // page table of the vidmap page
+    tss_t*              tss;
+    seg_desc_t          gdt[GDT_ENTRIES];
+    uint16_t            gdt_pad;
+    x86_desc_t          gdt_desc;
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+extern int32_t nr_cpus;
+extern int32_t smp_apic_to_cpu[256];
+
+/* The CPU running this code. Callers that can be preempted must not keep the result. */
+static inline cpu_t* this_cpu(void) {
+    return lapic_enabled ? &cpus[smp_apic_to_cpu[lapic_id()]] : &cpus[0];
+}
+
+/* Start the application processors, they idle until they find a task to run */
+void smp_init(void);
+
+/* C entry of an AP, called by the trampoline once paging is on */
+void ap_main(void);
+
+/* Make a CPU run its scheduler */
+void smp_send_resched(cpu_t* cpu);
+/* Make every other CPU run its scheduler */
+void smp_send_resched_all(void);
+/* Wake up one idle CPU so that it steals work */
+void smp_kick_idle(void);
+
+/* Local APIC interrupt handlers */
+void resched_ipi_handler(void);
+void tick_ipi_handler(uint32_t cs);
+
+#endif /* ASM */
+
+#endif /* _SMP_H */
@@ -0,0 +1,253 @@
+#include "softirq.h"
+
+#include "smp.h"
+#include "spinlock.h"
+#include "scheduler.h"
+#include "syscall.h"
+#include "latency.h"
+
+static void (*softirq_vec[NR_SOFTIRQS])(void);
+
+/* written by the CPU handling the line, and the one running its tasklets */
+static irq_stats_t irq_stats[NR_IRQ_LINES];
+
+/* add a run of cycles to a total in units of 1024 cycles and a maximum */
+static inline void account_cycles(uint32_t cycles, uint32_t* kcycles, uint32_t* max)
+{
+    *kcycles += cycles >> 10;
+    if (cycles > *max) {
+        *max = cycles;
+    }
+}
+
+/*
+ *  open_softirq
+ *  DESCRIPTION: install the handler of a softirq number
+ *  INPUTS: nr -- softirq number, action -- run with interrupts on
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void open_softirq(int32_t nr, void (*action)(void))
+{
+    softirq_vec[nr] = action;
+}
+
+/*
+ *  raise_softirq
+ *  DESCRIPTION: mark a softirq pending on this CPU, it runs at the end of
+ *               the interrupt, or when the interrupted code drops its last lock
+ *  INPUTS: nr -- softirq number
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void raise_softirq(int32_t nr)
+{
+    unsigned long flags;
+
+    cli_and_save(flags);
+    this_cpu()->softirq_pending |= 1 << nr;
+    restore_flags(flags);
+}
+
+/*
+ *  do_softirq
+ *  DESCRIPTION: run the pending softirqs of this CPU with interrupts on.
+ *               Interrupts raised meanwhile are served in the same call,
+ *               up to SOFTIRQ_RESTART rounds.
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ *  SIDE EFFECTS: does nothing while this CPU holds a lock or runs softirqs
+ *                already, the preempt count covers both
+ */
+void do_softirq(void)
+{
+    unsigned long flags;
+    uint32_t pending;
+    int32_t nr, restart = SOFTIRQ_RESTART;
+    cpu_t* cpu;
+
+    cli_and_save(flags);
+    cpu = this_cpu();
+    if (cpu->preempt_count != 0) {
+        restore_flags(flags);
+        return;
+    }
+    // the count keeps us on this CPU and keeps a nested interrupt out
+    cpu->preempt_count++;
+    trace_preempt_off((uint32_t) do_softirq);
+    while ((pending = cpu->softirq_pending) != 0 && restart-- > 0) {
+        cpu->softirq_pending = 0;
+        sti();
+        for (nr = 0; nr < NR_SOFTIRQS; nr++) {
+            if ((pending & (1 << nr)) && softirq_vec[nr] != NULL) {
+                softirq_vec[nr]();
+            }
+        }
+        cli();
+    }
+    cpu->preempt_count--;
+    trace_preempt_on();
+    restore_flags(flags);
+}
+
+/*
+ *  irq_exit
+ *  DESCRIPTION: end of a hardware interrupt handler, after its EOI. Run the
+ *               bottom halves, serve a Ctrl+C they could not serve from
+ *               there, and preempt if a task of higher rank was woken up.
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void irq_exit(void)
+{
+    if (this_cpu()->softirq_pending && preemptible()) {
+        do_softirq();
+        serve_ctrl_c();
+    }
+    check_preempt();
+}
+
+/*
+ *  tasklet_schedule
+ *  DESCRIPTION: queue a tasklet on this CPU and raise the tasklet softirq
+ *  INPUTS: t -- tasklet, nothing happens if it is queued already
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void tasklet_schedule(tasklet_t* t)
+{
+    unsigned long flags;
+    uint8_t queued;
+    cpu_t* cpu;
+
+    asm volatile ("lock; btsl %2, %0; setc %1"
+                  : "+m" (t->state), "=q" (queued)
+                  : "Ir" (TASKLET_SCHED)
+                  : "memory", "cc");
+    if (queued) {
+        return;
+    }
+
+    cli_and_save(flags);
+    cpu = this_cpu();
+    t->next = NULL;
+    if (cpu->tasklet_head == NULL) {
+        cpu->tasklet_head = t;
+    } else {
+        cpu->tasklet_tail->next = t;
+    }
+    cpu->tasklet_tail = t;
+    cpu->softirq_pending |= 1 << TASKLET_SOFTIRQ;
+    restore_flags(flags);
+}
+
+/*
+ *  tasklet_action
+ *  DESCRIPTION: the tasklet softirq, run the tasklets queued on this CPU.
+ *               One still running on another CPU is queued again.
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+static void tasklet_action(void)
+{
+    tasklet_t* list;
+    tasklet_t* t;
+    uint8_t running;
+    uint32_t start;
+    irq_stats_t* st;
+
+    cli();
+    list = this_cpu()->tasklet_head;
+    this_cpu()->tasklet_head = NULL;
+    this_cpu()->tasklet_tail = NULL;
+    sti();
+
+    while (list != NULL) {
+        t = list;
+        list = list->next;
+
+        asm volatile ("lock; btsl %2, %0; setc %1"
+                      : "+m" (t->state), "=q" (running)
+                      : "Ir" (TASKLET_RUN)
+                      : "memory", "cc");
+        if (running) {
+            asm volatile ("lock; btrl %1, %0" : "+m" (t->state) : "Ir" (TASKLET_SCHED) : "memory", "cc");
+            tasklet_schedule(t);
+            continue;
+        }
+        // scheduled again from here on, it runs once more
+        asm volatile ("lock; btrl %1, %0" : "+m" (t->state) : "Ir" (TASKLET_SCHED) : "memory", "cc");
+
+        start = (uint32_t) rdtsc();
+        t->func(t->data);
+        if (t->irq >= 0 && t->irq < NR_IRQ_LINES) {
+            st = &irq_stats[t->irq];
+            st->bottom_count++;
+            account_cycles((uint32_t) rdtsc() - start, &st->bottom_kcycles, &st->bottom_max);
+        }
+
+        asm volatile ("lock; btrl %1, %0" : "+m" (t->state) : "Ir" (TASKLET_RUN) : "memory", "cc");
+    }
+}
+
+/*
+ *  softirq_init
+ *  DESCRIPTION: set up the tasklet softirq
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void softirq_init(void)
+{
+    open_softirq(TASKLET_SOFTIRQ, tasklet_action);
+}
+
+/*
+ *  irq_account_top
+ *  DESCRIPTION: record the time spent in the top half of an IRQ
+ *  INPUTS: irq -- IRQ line, start -- low word of the TSC at handler entry
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void irq_account_top(int32_t irq, uint32_t start)
+{
+    irq_stats_t* st = &irq_stats[irq];
+
+    st->top_count++;
+    account_cycles((uint32_t) rdtsc() - start, &st->top_kcycles, &st->top_max);
+}
+
+/*
+ *  irq_account_drop
+ *  DESCRIPTION: count an event of an IRQ lost to a full queue
+ *  INPUTS: irq -- IRQ line
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void irq_account_drop(int32_t irq)
+{
+    irq_stats[irq].dropped++;
+}
+
+/*
+ *  irqstat
+ *  DESCRIPTION: the irqstat system call, copy the statistics of an IRQ line
+ *  INPUTS: irq -- 0 to NR_IRQ_LINES - 1
+ *          buf -- user buffer receiving an irq_stats_t
+ *  OUTPUTS: none
+ *  RETURN VALUE: 0 on success, -1 if there is no such line or buf is not a user address
+ */
+int32_t irqstat(int32_t irq, irq_stats_t* buf)
+{
+    if (irq < 0 || irq >= NR_IRQ_LINES) {
+        return -1;
+    }
+    if ((uint32_t) buf < USER_MEM || (uint32_t) buf > USER_MEM_END - sizeof(irq_stats_t)) {
+        return -1;
+    }
+    memcpy(buf, &irq_stats[irq], sizeof(irq_stats_t));
+    return 0;
+}
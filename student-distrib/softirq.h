@@ -0,0 +1,69 @@
+#ifndef _SOFTIRQ_H
+#define _SOFTIRQ_H
+
+#include "types.h"
+#include "lib.h"
+
+#define NR_IRQ_LINES        16          // ISA IRQs of the PICs / IOAPIC
+
+/* Softirq numbers, lower numbers run first */
+#define TASKLET_SOFTIRQ     0
+#define NR_SOFTIRQS         1
+
+#define SOFTIRQ_RESTART     10          // rounds of do_softirq before leaving the rest for later
+
+#define TASKLET_SCHED       0           // bit of state: queued on a CPU
+#define TASKLET_RUN         1           // bit of state: running on a CPU
+
+/*
+ * Interrupt work deferred out of the handler. A tasklet runs with
+ * interrupts enabled and preemption disabled, on the CPU that scheduled
+ * it, and never on two CPUs at once.
+ */
+typedef struct tasklet_t {
+    struct tasklet_t* next;
+    void (*func)(uint32_t data);
+    uint32_t data;
+    volatile uint32_t state;
+    int32_t irq;                        // IRQ line its run time is accounted to
+} tasklet_t;
+
+/* Time spent in the two halves of an IRQ, times in TSC cycles */
+typedef struct irq_stats_t {
+    uint32_t top_count;                 // interrupts handled
+    uint32_t top_kcycles;               // total in the handler, in units of 1024 cycles
+    uint32_t top_max;
+    uint32_t bottom_count;              // tasklet runs
+    uint32_t bottom_kcycles;            // total in the tasklets, in units of 1024 cycles
+    uint32_t bottom_max;
+    uint32_t dropped;                   // events lost before the bottom half caught up
+} irq_stats_t;
+
+#define DECLARE_TASKLET(name, fn, irq_line) \
+    tasklet_t name = {.next = NULL, .func = fn, .data = 0, .state = 0, .irq = irq_line}
+
+/* Install the handler of a softirq number */
+void open_softirq(int32_t nr, void (*action)(void));
+/* Mark a softirq pending on this CPU */
+void raise_softirq(int32_t nr);
+/* Run the pending softirqs of this CPU, if it is not in one already */
+void do_softirq(void);
+/* End of a hardware interrupt handler: run the bottom halves it raised */
+void irq_exit(void);
+
+/* Queue a tasklet on this CPU, a tasklet queued already is left alone */
+void tasklet_schedule(tasklet_t* t);
+
+/* Set up the tasklet softirq */
+void softirq_init(void);
+
+/* Record the top half of an IRQ, started at TSC low word start */
+void irq_account_top(int32_t irq, uint32_t start);
+
+/* Count an event the top half had no room to queue */
+void irq_account_drop(int32_t irq);
+
+/* The irqstat system call */
+int32_t irqstat(int32_t irq, irq_stats_t* buf);
+
+#endif /* _SOFTIRQ_H */
@@ -0,0 +1,255 @@
+#include "spinlock.h"
+
+#include "smp.h"
+#include "scheduler.h"
+#include "syscall.h"
+#include "softirq.h"
+#include "latency.h"
+
+/* every lock set up by spin_lock_init, for lockstat */
+static spinlock_t* lock_list[MAX_LOCKS];
+static int32_t nr_locks;
+
+/* low half of the time stamp counter, enough for the length of a hold */
+static inline uint32_t rdtsc_low(void)
+{
+    uint32_t low, high;
+    asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+    return low;
+}
+
+/*
+ *  preempt_count_add
+ *  DESCRIPTION: raise the preempt count of this CPU
+ *  INPUTS: ip -- code asking, shown by latstat if the section is the longest
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+static void preempt_count_add(uint32_t ip)
+{
+    unsigned long flags;
+    cpu_t* cpu;
+
+    // an interrupt in between could move us to another CPU
+    cli_and_save(flags);
+    cpu = this_cpu();
+    if (cpu->preempt_count++ == 0) {
+        trace_preempt_off(ip);
+    }
+    restore_flags(flags);
+}
+
+/*
+ *  spin_lock_init
+ *  DESCRIPTION: reset a lock and list it in the lock statistics
+ *  INPUTS: lock -- lock to set up, before anyone takes it (set up twice, it is listed once)
+ *          name -- shown by lockstat, cut at LOCK_NAME_LEN - 1
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void spin_lock_init(spinlock_t* lock, const int8_t* name)
+{
+    int32_t i;
+
+    memset(lock, 0, sizeof(spinlock_t));
+    strncpy(lock->stats.name, name, LOCK_NAME_LEN - 1);
+    for (i = 0; i < nr_locks; i++) {
+        if (lock_list[i] == lock) {
+            return;
+        }
+    }
+    if (nr_locks < MAX_LOCKS) {
+        lock_list[nr_locks++] = lock;
+    }
+}
+
+/*
+ *  spin_lock
+ *  DESCRIPTION: take a ticket and spin until it is served
+ *  INPUTS: lock -- lock to take, must not be held by this CPU
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ *  SIDE EFFECTS: preemption is disabled until spin_unlock
+ */
+void spin_lock(spinlock_t* lock)
+{
+    uint16_t ticket = 1;
+    uint32_t start, wait;
+
+    preempt_count_add(_RET_IP_);
+    asm volatile ("lock; xaddw %0, %1"
+                  : "+r" (ticket), "+m" (lock->next)
+                  :
+                  : "memory", "cc");
+    if (lock->owner != ticket) {
+        start = rdtsc_low();
+        while (lock->owner != ticket) {
+            asm volatile ("pause" : : : "memory");
+        }
+        wait = rdtsc_low() - start;
+        lock->stats.contended++;
+        lock->stats.wait_kcycles += wait >> 10;
+        if (wait > lock->stats.max_wait) {
+            lock->stats.max_wait = wait;
+        }
+    }
+    lock->stats.acquired++;
+    lock->hold_start = rdtsc_low();
+}
+
+/*
+ *  spin_unlock_no_resched
+ *  DESCRIPTION: serve the next ticket, a preemption held back meanwhile
+ *               waits for the next preemption point
+ *  INPUTS: lock -- lock held by this CPU
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void spin_unlock_no_resched(spinlock_t* lock)
+{
+    uint32_t hold = rdtsc_low() - lock->hold_start;
+
+    lock->stats.hold_kcycles += hold >> 10;
+    if (hold > lock->stats.max_hold) {
+        lock->stats.max_hold = hold;
+    }
+    // only the owner writes owner, x86 does not reorder the stores above after it
+    asm volatile ("" : : : "memory");
+    lock->owner++;
+    preempt_enable_no_resched();
+}
+
+/*
+ *  spin_unlock
+ *  DESCRIPTION: release a lock, and preempt if a task of higher rank was
+ *               woken up while it was held
+ *  INPUTS: lock -- lock held by this CPU
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void spin_unlock(spinlock_t* lock)
+{
+    spin_unlock_no_resched(lock);
+    preempt_check_resched();
+}
+
+/*
+ *  preempt_disable
+ *  DESCRIPTION: keep the running task on this CPU until preempt_enable
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void preempt_disable(void)
+{
+    preempt_count_add(_RET_IP_);
+}
+
+/*
+ *  preempt_enable_no_resched
+ *  DESCRIPTION: undo preempt_disable without preempting
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void preempt_enable_no_resched(void)
+{
+    unsigned long flags;
+    cpu_t* cpu;
+
+    cli_and_save(flags);
+    cpu = this_cpu();
+    if (--cpu->preempt_count == 0) {
+        trace_preempt_on();
+    }
+    restore_flags(flags);
+}
+
+/*
+ *  preempt_check_resched
+ *  DESCRIPTION: run the softirqs and the preemption held back by the preempt
+ *               count, if the count is 0 and interrupts are on (an interrupt
+ *               handler checks for itself in irq_exit)
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void preempt_check_resched(void)
+{
+    unsigned long flags;
+    cpu_t* cpu;
+
+    cli_and_save(flags);
+    cpu = this_cpu();
+    if (cpu->preempt_count == 0 && (flags & EFLAGS_IF)) {
+        // bottom halves raised while the lock was held
+        if (cpu->softirq_pending) {
+            do_softirq();
+        }
+        if (cpu->need_resched) {
+            preempt();
+        }
+    }
+    restore_flags(flags);
+}
+
+/*
+ *  preempt_enable
+ *  DESCRIPTION: undo preempt_disable, and preempt if needed
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void preempt_enable(void)
+{
+    preempt_enable_no_resched();
+    preempt_check_resched();
+}
+
+/*
+ *  cond_resched
+ *  DESCRIPTION: preemption point of a long loop, give up the CPU if a
+ *               preemption is due (nothing happens with a lock held)
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void cond_resched(void)
+{
+    if (this_cpu()->need_resched) {
+        preempt_check_resched();
+    }
+}
+
+/*
+ *  preemptible
+ *  DESCRIPTION: check whether the running task may be switched away now
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: non-zero when no lock is held and preemption is enabled
+ */
+int32_t preemptible(void)
+{
+    return this_cpu()->preempt_count == 0;
+}
+
+/*
+ *  lockstat
+ *  DESCRIPTION: the lockstat system call, copy the statistics of a lock
+ *  INPUTS: index -- 0 to the number of locks - 1
+ *          buf -- user buffer receiving a lock_stats_t
+ *  OUTPUTS: none
+ *  RETURN VALUE: 0 on success, -1 if there is no such lock or buf is not a user address
+ */
+int32_t lockstat(int32_t index, lock_stats_t* buf)
+{
+    if (index < 0 || index >= nr_locks) {
+        return -1;
+    }
+    if ((uint32_t) buf < USER_MEM || (uint32_t) buf > USER_MEM_END - sizeof(lock_stats_t)) {
+        return -1;
+    }
+    // a snapshot, the owner may be updating it meanwhile
+    memcpy(buf, &lock_list[index]->stats, sizeof(lock_stats_t));
+    return 0;
+}
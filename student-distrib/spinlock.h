@@ -0,0 +1,81 @@
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include "types.h"
+#include "lib.h"
+
+#define LOCK_NAME_LEN       16
+#define MAX_LOCKS           32
+
+/*
+ * Locks of the kernel, always taken in this order:
+ *
+ *   terminal lock (lower index first) / rtc_lock
+ *     -> sched_lock
+ *       -> pcb_lock
+ *
+ * i8259_lock, ioapic_lock and pit_lock only guard I/O ports and are
+ * leaves, so is kmem_lock. The lock of a workqueue is taken alone. A context switch happens with sched_lock and nothing else
+ * held, the lock is released by the task being switched to.
+ */
+
+/* Hold time and contention of a lock, times in TSC cycles */
+typedef struct lock_stats_t {
+    uint32_t acquired;              // times the lock was taken
+    uint32_t contended;             // times it was taken after spinning
+    uint32_t wait_kcycles;          // total spinning, in units of 1024 cycles
+    uint32_t hold_kcycles;          // total holding, in units of 1024 cycles
+    uint32_t max_wait;              // longest spin
+    uint32_t max_hold;              // longest hold
+    int8_t name[LOCK_NAME_LEN];
+} lock_stats_t;
+
+/* Ticket lock, CPUs get the lock in the order they asked for it */
+typedef struct spinlock_t {
+    volatile uint16_t next;         // ticket of the next CPU to arrive
+    volatile uint16_t owner;        // ticket being served
+    uint32_t hold_start;            // TSC when the owner took it
+    lock_stats_t stats;             // written by the owner only
+} spinlock_t;
+
+/* Reset a lock and list it in the lock statistics */
+void spin_lock_init(spinlock_t* lock, const int8_t* name);
+
+/* Take and release a lock, preemption is disabled while it is held */
+void spin_lock(spinlock_t* lock);
+void spin_unlock(spinlock_t* lock);
+/* Release without preempting, when the caller is about to switch or return to user */
+void spin_unlock_no_resched(spinlock_t* lock);
+
+/* Lock also taken by interrupt handlers, interrupts are off on this CPU while it is held */
+#define spin_lock_irqsave(lock, flags)          \
+do {                                            \
+    cli_and_save(flags);                        \
+    spin_lock(lock);                            \
+} while (0)
+
+#define spin_unlock_irqrestore(lock, flags)     \
+do {                                            \
+    spin_unlock_no_resched(lock);               \
+    restore_flags(flags);                       \
+    preempt_check_resched();                    \
+} while (0)
+
+/*
+ * Preemption control: the count of the running CPU is raised by every lock
+ * held, a task is only preempted when it is 0. preempt_enable preempts
+ * at once if a preemption was held back meanwhile.
+ */
+void preempt_disable(void);
+void preempt_enable(void);
+void preempt_enable_no_resched(void);
+void preempt_check_resched(void);
+int32_t preemptible(void);
+
+/* Preemption point of a long kernel loop, see preempt_check_resched */
+void cond_resched(void);
+
+/* The lock statistics system call */
+int32_t lockstat(int32_t index, lock_stats_t* buf);
+
+#endif /* _SPINLOCK_H */
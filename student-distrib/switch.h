@@ -0,0 +1,56 @@
+/* switch.h - Kernel context switch
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SWITCH_H
+#define _SWITCH_H
+
+/* Byte offsets of the fields of context_t, shared with switch.S */
+#define CTX_EBX     0
+#define CTX_ESI     4
+#define CTX_EDI     8
+#define CTX_EBP     12
+#define CTX_ESP     16
+#define CTX_EIP     20
+#define CTX_EAX     24
+
+#ifndef ASM
+
+#include "types.h"
+
+/* 
+ * Kernel register state of a task that is not running. Only the callee-saved
+ * registers are kept: switch_to is an ordinary function call, so the caller
+ * already assumes eax, ecx and edx are clobbered.
+ */
+typedef struct context_t {
+    uint32_t ebx;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t ebp;
+    uint32_t esp;
+    uint32_t eip;
+    uint32_t eax;   // value switch_to returns when this context is resumed
+} context_t;
+
+/*
+ * switch_to
+ *  DESCRIPTION:
+ *      Save the callee-saved registers of the caller into prev and resume
+ *      next. The caller points the TSS at the kernel stack of next.
+ *  INPUTS:
+ *      prev - where the current context is saved
+ *      next - context to be resumed
+ *  OUTPUTS:
+ *      next->eax, once some other task switches back to prev
+ *      (0 unless that task stored a value into prev->eax)
+ */
+int32_t switch_to(context_t* prev, context_t* next);
+
+/* First instruction run by a new user task: return to user mode through the
+ * iret frame sitting on the top of its kernel stack */
+void ret_to_user(void);
+
+#endif /* ASM */
+
+#endif /* _SWITCH_H */
@@ -8,51 +8,47 @@
 #include "rtc.h"
 #include "task.h"
 #include "scheduler.h"
+#include "kthread.h"
+#include "clock.h"
+
+/* context the halting task is saved into, it is never resumed */
+static context_t halt_context;
+/* context of the kernel boot thread, left behind by the first shell */
+static context_t boot_context;
 
 /*
- * execute:
- * DESCRIPTION: excute system call depending on input command
- * INPUTS: command -- The input command to excute
+ * load_task:
+ * DESCRIPTION: load a program as the given pid and set up a task that is
+ *              ready to be resumed with task_switch
+ * INPUTS: pid         -- allocated pid, or the pid of the caller to replace it
+ *         command     -- The input command to excute
+ *         parent      -- pcb of the parent, NULL for the shell of a terminal
+ *         terminal_id -- terminal of the task when there is no parent
  * OUTPUTS: none
- * RETURN: 0 -- successful calls
- *         1 -- failed calls
- * SIDE EFFECTS: none
+ * RETURN: pointer to the pcb of the new task, NULL on failure
+ * SIDE EFFECTS: the program page of this CPU may be left mapped to the new
+ *               task until the next task switch, which maps the right one.
+ *               The task is TASK_WAITING, the caller makes it runnable.
  */
-int32_t execute(const uint8_t* command)
+static pcb_t* load_task(uint32_t pid, const uint8_t* command, pcb_t* parent, int32_t terminal_id)
 {
     /* Steps to be carried out 
-        1. Parse the command (arg list not supported in CH3)
+        1. Parse the command
         2. Check the file's validity
         3. Set up paging for the user program
         4. create PCB which will be loaded into our kernel stack
-        5. prepare for context swtich and push the iret arguments
-        6. use iret to jump to the target program
+        5. push the iret arguments and the initial context
     */
 
     
     int32_t     i;                           // variable for for loop
-    uint32_t    flags;                       // flag for critical part
-    uint32_t    pd_idx;                      // index into page directory
     uint8_t     fname[MAX_FILENAME_LEN];     // file name 
     uint8_t     argument[MAX_ARGUMENT_SIZE]; // Buffer for argument
     dentry_t    exe_dentry;                  // dentry to fetch the executable file
-    uint32_t    pid;                         // pid
     pcb_t*      pcb;                         // pointer to the pcb entry specified by pid
+    uint32_t*   iret_frame;                  // top of the kernel stack of the new task
     
 
-    //check validity of the argument
-    if (command == NULL){
-        return -1;
-    }
-    
-    pid = allocate_pid();
-    if (pid == -1) {
-        // cannot allocate more pid
-        printf("Number of processes reached the limit (%d)\n", MAX_TASK_NUM);
-        return -1;
-    }
-
-
     // Parse file name 
     memset(fname, NULL, MAX_FILENAME_LEN);
     memset(argument, NULL, MAX_ARGUMENT_SIZE);
@@ -94,69 +90,58 @@ int32_t execute(const uint8_t* command)
     //Check for existence 
     if(read_dentry_by_name(fname,&exe_dentry) == -1){
         printf("filename does not exist!\n");
-        return -1;
+        return NULL;
     }  
     //Check the file type
     if (exe_dentry.file_type != FILE_FILE_TYPE){
         printf("filetype check fails!\n");
-        return -1;
+        return NULL;
     }
     //Check for executable
     //read the data
     uint8_t buf[4]; 
     if (read_data(exe_dentry.inode_idx, 0, buf, 4) != 4){
         printf("Read data fails!\n");
-        return -1;
+        return NULL;
     }
     //use four magic numbers to check for executable
     if (buf[0] != EXE_MAGIC_NUMBER_0 || buf[1] != EXE_MAGIC_NUMBER_1 || buf[2] != EXE_MAGIC_NUMBER_2 || buf[3] != EXE_MAGIC_NUMBER_3){
         printf("Magic number check fails!\n");
-        return -1;    
+        return NULL;    
     }
     // done checking, safe to move on now
 
-
-    //Set up paging
-    pd_idx = (uint32_t) (USER_IMG_ADDR  >> PAGE_4MB_SHIFT);  //the index of the page directory should be 32 (128 MB)
-
-    pd[pd_idx].pde_4m.present = 1;
-    pd[pd_idx].pde_4m.rw = 1;
-    pd[pd_idx].pde_4m.us = 1;
-    pd[pd_idx].pde_4m.pwt = 0;
-    pd[pd_idx].pde_4m.pcd = 0;
-    pd[pd_idx].pde_4m.accessed = 0;
-    pd[pd_idx].pde_4m.dirty = 0;
-    pd[pd_idx].pde_4m.entry_type = 1;
-    pd[pd_idx].pde_4m.global = 0;
-    pd[pd_idx].pde_4m.ignored = 0;
-    pd[pd_idx].pde_4m.pat = 0;
-    pd[pd_idx].pde_4m.addr_39_32 = 0;
-    pd[pd_idx].pde_4m.reserved = 0;
-    pd[pd_idx].pde_4m.addr_31_22 = pid + 2;  // the per-process 4MB space starts from 8MB in the physical address   
-    flush_tlb();
-
-    
     //Load file image into the corresponding address in the memory (0x08048000 user program addr)
     int32_t bytes_read;
     int32_t offset = 0;
     while(1){
+        // while the program page of this CPU is the one of the new task we
+        // must not be switched away (task_switch maps the running task), so
+        // we only stay on one block at a time and map it again after each
+        // preemption point
+        preempt_disable();
+        map_user_program(pid);
         bytes_read = read_data(exe_dentry.inode_idx, offset, (void*)(USER_IMG_ADDR + offset), BLOCK_SIZE);
-        if (bytes_read < BLOCK_SIZE) {
-            break;
-        }
-        else if (bytes_read == -1) {
+        if (bytes_read == -1) {
             printf("Load file fails in reading data!\n");
-            return -1;
+            if (parent != NULL) {
+                map_user_program(parent->pid);
+            }
+            preempt_enable();
+            return NULL;
         }
-        else {
-            offset += bytes_read;
+        preempt_enable();
+        if (bytes_read < BLOCK_SIZE) {
+            break;
         }
+        offset += bytes_read;
     }
     
     // set PCB struct
     pcb = create_pcb(pid);
 
-    pcb->present = 1;
+    strncpy((int8_t*) pcb->name, (int8_t*) fname, TASK_NAME_LEN - 1);
+    pcb->cpu = this_cpu()->id;
     // open stdin & stdout for the task
     pcb->file_desc_num = 2;
     pcb->file_desc_array[0].file_op_table = &terminal_op_table;
@@ -165,232 +150,209 @@ int32_t execute(const uint8_t* command)
     pcb->file_desc_array[1].flags = FD_FLAG_PRESENT;
 
     // set parent process info
-    pcb->parent_pid = get_curr_pid();
-    if (pcb->parent_pid == -1)
+    if (parent == NULL) {
+        pcb->parent_pid = -1;
         pcb->parent_pcb = NULL;
-    else
-        pcb->parent_pcb = get_current_pcb();
-    set_curr_pid(pid);
+        pcb->terminal_id = terminal_id;
+    } else {
+        pcb->parent_pid = parent->pid;
+        pcb->parent_pcb = parent;
+        pcb->terminal_id = parent->terminal_id;
+        pcb->policy = parent->policy;
+        pcb->rt_priority = parent->rt_priority;
+    }
 
     // copy argument
     memcpy(pcb->argument, argument, MAX_ARGUMENT_SIZE);
 
-    // 5. prepare for context swtich and push the iret arguments
-    cli_and_save(flags);
-    // set kernal mode
-    tss.ss0 = KERNEL_DS;
-    //get the addr of stack (the firt 4 bytes are reserved for the pointer of the struct of the pcb)
-    tss.esp0 = STACK_BASE_8_MB - pcb->pid * STACK_SIZE_8_KB - sizeof(uint32_t);
-    restore_flags(flags);
-
-    //save the esp and ebp
-    asm volatile("        \n\
-        movl %%esp, %0    \n\
-        movl %%ebp, %1    \n\
-        "
-        : "=r"(pcb->esp), "=r"(pcb->ebp)
-        :
-        : "memory"
-    );
- 
-    /* Context Switch */
+    // 5. push the iret arguments: eip, cs, eflags (IF set), esp, ss
     uint8_t eip_buf[4];
-    uint32_t return_addr;
-    read_data(exe_dentry.inode_idx,24,eip_buf,sizeof(uint32_t));
-    return_addr=*((uint32_t *)eip_buf);   
-    
-    uint32_t user_esp = USER_MEM_END - sizeof(int32_t);
-
-    sti();
-    asm volatile("              \n\
-        andl   $0x00FF, %%ebx   \n\
-        movw   %%bx, %%ds       \n\
-        pushl  %%ebx            \n\
-        pushl  %%edx            \n\
-        pushfl                  \n\
-        popl   %%ebx            \n\
-        orl    $0x200, %%ebx    \n\
-        pushl  %%ebx            \n\
-        pushl  %%ecx            \n\
-        pushl  %%eax            \n\
-        iret                    \n\
-        "
-        :
-        : "a"(return_addr), "b"(USER_DS), "c"(USER_CS), "d"(user_esp)
-        : "memory"
-    );
+    read_data(exe_dentry.inode_idx, 24, eip_buf, sizeof(uint32_t));
 
-    return -1;
-}
+    iret_frame = (uint32_t*) get_kernel_stack(pid) - 5;
+    iret_frame[0] = *((uint32_t *)eip_buf);
+    iret_frame[1] = USER_CS;
+    iret_frame[2] = 0x202;
+    iret_frame[3] = USER_MEM_END - sizeof(int32_t);
+    iret_frame[4] = USER_DS;
 
+    // the first switch_to into the task "returns" into ret_to_user
+    pcb->context.esp = (uint32_t) iret_frame;
+    pcb->context.eip = (uint32_t) ret_to_user;
 
+    return pcb;
+}
 
 /*
- * halt:
- * DESCRIPTION: halt the current process
- * INPUTS: status of current process
+ * create_task:
+ * DESCRIPTION: load a program and set up a new task that is ready to be
+ *              resumed with task_switch
+ * INPUTS: command     -- The input command to excute
+ *         parent      -- pcb of the parent, NULL for the shell of a terminal
+ *         terminal_id -- terminal of the task when there is no parent
  * OUTPUTS: none
- * RETURN: exit status
- * SIDE EFFECTS: none
+ * RETURN: pointer to the pcb of the new task, NULL on failure
+ * SIDE EFFECTS: the program page of this CPU may be left mapped to the new
+ *               task until the next task switch, which maps the right one.
+ *               The task is TASK_WAITING, the caller makes it runnable.
  */
-int32_t halt (uint8_t status)
+pcb_t* create_task(const uint8_t* command, pcb_t* parent, int32_t terminal_id)
 {
-    /* 
-        1. restore parent paging
-        2. close all files
-        3. return to parent execution
-    */
+    uint32_t    pid;
+    pcb_t*      pcb;
 
-    // decrement the number of processes
+    //check validity of the argument
+    if (command == NULL){
+        return NULL;
+    }
+    
+    pid = allocate_pid();
+    if (pid == -1) {
+        // cannot allocate more pid
+        printf("Number of processes reached the limit (%d)\n", MAX_TASK_NUM);
+        return NULL;
+    }
 
-    pcb_t* pcb = get_current_pcb();
-    uint32_t pd_idx;
-    uint32_t flags;
+    pcb = load_task(pid, command, parent, terminal_id);
+    if (pcb == NULL) {
+        release_pid(pid);
+    }
+    return pcb;
+}
 
-    if (pcb->parent_pid != -1){
+/*
+ * execute:
+ * DESCRIPTION: excute system call depending on input command
+ * INPUTS: command -- The input command to excute
+ * OUTPUTS: none
+ * RETURN: 0-255 -- status passed to halt by the program
+ *         256   -- the program was killed by an exception
+ *         -1    -- failed calls
+ * SIDE EFFECTS: the caller sleeps inside switch_to until the program halts
+ */
+int32_t execute(const uint8_t* command)
+{
+    uint32_t    flags;      // flag for critical part
+    int32_t     status;     // return value of the program
+    pcb_t*      parent;     // the caller, NULL when the kernel starts a shell
+    pcb_t*      child;
 
-        // Write Parent process’ info back to TSS 
-        cli_and_save(flags);
-        tss.ss0 = KERNEL_DS;
-        tss.esp0 = STACK_BASE_8_MB - (pcb->parent_pid) * STACK_SIZE_8_KB - sizeof(uint32_t);
-        restore_flags(flags);
+    parent = (get_curr_pid() == -1) ? NULL : get_current_pcb();
 
-        // Restore parent's paging
-        pd_idx = (uint32_t) (USER_IMG_ADDR  >> PAGE_4MB_SHIFT );  //the index of the page table
-    
-        pd[pd_idx].pde_4m.present = 1;
-        pd[pd_idx].pde_4m.rw = 1;
-        pd[pd_idx].pde_4m.us = 1;
-        pd[pd_idx].pde_4m.pwt = 0;
-        pd[pd_idx].pde_4m.pcd = 0;
-        pd[pd_idx].pde_4m.accessed = 0;
-        pd[pd_idx].pde_4m.dirty = 0;
-        pd[pd_idx].pde_4m.entry_type = 1;
-        pd[pd_idx].pde_4m.global = 0;
-        pd[pd_idx].pde_4m.ignored = 0;
-        pd[pd_idx].pde_4m.pat = 0;
-        pd[pd_idx].pde_4m.addr_39_32 = 0;
-        pd[pd_idx].pde_4m.reserved = 0;
-        pd[pd_idx].pde_4m.addr_31_22 = pcb->parent_pid + 2;  //2 is the where the program on pd begin
-        //flush the tlb
-        flush_tlb();
+    child = create_task(command, parent, curr_running_terminal);
+    if (child == NULL) {
+        return -1;
     }
-    
-    // here we "lazy" clean up the pcb. The full clean up is done when calling "execute".
 
-    // set pcb to not present
-    pcb->present = 0;
-    set_curr_pid(pcb->parent_pid);
-
-    // Close any relevant FDs in use
-    int32_t tmp_fd = 0;
-    for (tmp_fd = 0; tmp_fd < FD_ARRAY_SIZE; tmp_fd++){
-        if (pcb->file_desc_array[tmp_fd].flags & FD_FLAG_PRESENT){
-            close(tmp_fd);  
-        }
+    /* Context Switch: halt of the child resumes us with its status */
+    spin_lock_irqsave(&sched_lock, flags);
+    if (parent != NULL) {
+        parent->state = TASK_WAITING;
     }
-    if (pcb->parent_pid == -1){
-        execute((uint8_t*)"shell");
-    }else{
-        
-        asm volatile("     \n\
-        movl %%edx, %%eax  \n\
-        movl %%ebx, %%esp  \n\
-        movl %%ecx, %%ebp  \n\
-        leave     \n\
-        ret       \n\
-        "
-        :
-        : "b" (pcb->esp), "c" (pcb->ebp), "d" (status)
-        : "esp","ebp","eax"
-        );
-    }
-
-    return 1;
+    child->state = TASK_RUNNABLE;
+    set_curr_pid(child->pid);
+    status = task_switch((parent == NULL) ? &boot_context : &parent->context, child);
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    return status;
 }
 
 /*
- * halt:
- * DESCRIPTION: halt the current process
- * INPUTS: status of current process
+ * halt_task:
+ * DESCRIPTION: tear down the current process and resume its parent
+ * INPUTS: status -- value returned by the execute of the parent
  * OUTPUTS: none
- * RETURN: 256 (exit with exception)
- * SIDE EFFECTS: none
+ * RETURN: never returns
+ * SIDE EFFECTS: the shell of a terminal is restarted when it halts
  */
-int32_t exception_halt (void)
+static int32_t halt_task(uint32_t status)
 {
     /* 
-        1. restore parent paging
-        2. close all files
+        1. close all files
+        2. restore parent paging and kernel stack
         3. return to parent execution
     */
 
-    // decrement the number of processes
-
     pcb_t* pcb = get_current_pcb();
-    uint32_t pd_idx;
+    pcb_t* next;
     uint32_t flags;
+    int32_t tmp_fd;
 
-    if (pcb->parent_pid != -1){
-
-        // Write Parent process’ info back to TSS 
-        cli_and_save(flags);
-        tss.ss0 = KERNEL_DS;
-        tss.esp0 = STACK_BASE_8_MB - (pcb->parent_pid) * STACK_SIZE_8_KB - sizeof(uint32_t);
-        restore_flags(flags);
-
-        // Restore parent's paging
-        pd_idx = (uint32_t) (USER_IMG_ADDR  >> PAGE_4MB_SHIFT );  //the index of the page table
-    
-        pd[pd_idx].pde_4m.present = 1;
-        pd[pd_idx].pde_4m.rw = 1;
-        pd[pd_idx].pde_4m.us = 1;
-        pd[pd_idx].pde_4m.pwt = 0;
-        pd[pd_idx].pde_4m.pcd = 0;
-        pd[pd_idx].pde_4m.accessed = 0;
-        pd[pd_idx].pde_4m.dirty = 0;
-        pd[pd_idx].pde_4m.entry_type = 1;
-        pd[pd_idx].pde_4m.global = 0;
-        pd[pd_idx].pde_4m.ignored = 0;
-        pd[pd_idx].pde_4m.pat = 0;
-        pd[pd_idx].pde_4m.addr_39_32 = 0;
-        pd[pd_idx].pde_4m.reserved = 0;
-        pd[pd_idx].pde_4m.addr_31_22 = pcb->parent_pid + 2;  //2 is the where the program on pd begin
-        //flush the tlb
-        flush_tlb();
+    // a kernel thread taking an exception has no parent to go back to
+    if (pcb->kthread) {
+        kthread_exit();
     }
-    
-    // here we "lazy" clean up the pcb. The full clean up is done when calling "execute".
-
-    // set pcb to not present
-    pcb->present = 0;
-    set_curr_pid(pcb->parent_pid);
 
     // Close any relevant FDs in use
-    int32_t tmp_fd = 0;
     for (tmp_fd = 0; tmp_fd < FD_ARRAY_SIZE; tmp_fd++){
         if (pcb->file_desc_array[tmp_fd].flags & FD_FLAG_PRESENT){
             close(tmp_fd);  
         }
     }
+    
+    // the screen of the terminal may scroll freely again
+    if (terminal_info_array[pcb->terminal_id]->vidmap_pid == pcb->pid) {
+        terminal_info_array[pcb->terminal_id]->vidmap_pid = -1;
+    }
+    // and its input goes back to line editing
+    if (terminal_info_array[pcb->terminal_id]->raw_pid == pcb->pid) {
+        ttymode(TTY_CANONICAL);
+    }
+
+    // here we "lazy" clean up the pcb. The full clean up is done when calling "execute".
+
     if (pcb->parent_pid == -1){
-        execute((uint8_t*)"shell");
-    }else{
-        
-        asm volatile("     \n\
-        movl %%edx, %%eax  \n\
-        movl %%ebx, %%esp  \n\
-        movl %%ecx, %%ebp  \n\
-        leave     \n\
-        ret       \n\
-        "
-        :
-        : "b" (pcb->esp), "c" (pcb->ebp), "d" (256)
-        : "esp","ebp","eax"
-        );
-    }
-
-    return 1;
+        // the terminal always keeps a shell, a new one takes over our pid
+        next = load_task(pcb->pid, (uint8_t*)"shell", NULL, pcb->terminal_id);
+        if (next == NULL) {
+            printf("Cannot restart shell!\n");
+            while (1) asm volatile ("hlt");
+        }
+    } else {
+        next = pcb->parent_pcb;
+    }
+
+    spin_lock_irqsave(&sched_lock, flags);
+    if (next != pcb) {
+        // our pid is given back once we are off its kernel stack (finish_task_switch)
+        pcb->state = TASK_WAITING;
+        this_cpu()->dead_pid = pcb->pid;
+        next->context.eax = status;
+    }
+    next->state = TASK_RUNNABLE;
+    set_curr_pid(next->pid);
+
+    // task_switch maps the parent image and writes its kernel stack back to TSS
+    task_switch(&halt_context, next);
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return -1;
+}
+
+/*
+ * halt:
+ * DESCRIPTION: halt the current process
+ * INPUTS: status of current process
+ * OUTPUTS: none
+ * RETURN: never returns to the caller
+ * SIDE EFFECTS: none
+ */
+int32_t halt (uint8_t status)
+{
+    return halt_task(status);
+}
+
+/*
+ * exception_halt:
+ * DESCRIPTION: halt the current process
+ * INPUTS: none
+ * OUTPUTS: none
+ * RETURN: never returns, the parent sees 256 (exit with exception)
+ * SIDE EFFECTS: none
+ */
+int32_t exception_halt (void)
+{
+    return halt_task(256);
 }
 
 /*
@@ -405,13 +367,30 @@ int32_t exception_halt (void)
  *   else : fd of the file 
  */
 int32_t open (const uint8_t* filename)
+{
+    return open_flags(filename, 0);
+}
+
+/*
+ * open_flags:
+ * DESCRIPTION: 
+ *  The open_flags system call, open with flags: O_NONBLOCK makes reads of
+ *  the file return ERR_WOULD_BLOCK instead of waiting
+ * INPUTS: 
+ *   - filename : name of the file
+ *   - flags : O_NONBLOCK or 0
+ * RETURN: 
+ *   -1 : cannot open file, or unknown flags
+ *   else : fd of the file 
+ */
+int32_t open_flags (const uint8_t* filename, int32_t flags)
 {
     int32_t fd;
     pcb_t* curr_pcb;
     dentry_t dentry;
     
     // check for null ptr
-    if (filename == NULL) return -1;
+    if (filename == NULL || (flags & ~O_NONBLOCK) != 0) return -1;
 
     // get current task
     curr_pcb = get_current_pcb();
@@ -452,17 +431,19 @@ int32_t open (const uint8_t* filename)
         return -1;
     }
     
+    // open the file
+    if (curr_pcb->file_desc_array[fd].file_op_table->open(filename, fd) == -1) {
+        curr_pcb->file_desc_array[fd].file_op_table = NULL;
+        return -1;
+    }
+
     // increment number of opened files
     curr_pcb->file_desc_num++;
-    
-    // open the file
-    curr_pcb->file_desc_array[fd].flags = 1;
+
+    curr_pcb->file_desc_array[fd].flags = FD_FLAG_PRESENT | ((flags & O_NONBLOCK) ? FD_FLAG_NONBLOCK : 0);
     curr_pcb->file_desc_array[fd].file_position = 0;
     curr_pcb->file_desc_array[fd].inode_idx = dentry.inode_idx;
 
-    curr_pcb->file_desc_array[fd].file_op_table->open(filename);
-
-
     return fd;
 }
 
@@ -506,6 +487,8 @@ int32_t close (int32_t fd)
 }
 
 
+static int32_t read_fd (int32_t fd, void* buf, int32_t nbytes, uint64_t deadline);
+
 /*
  * read:
  * DESCRIPTION: 
@@ -522,6 +505,116 @@ int32_t close (int32_t fd)
  */
 int32_t read (int32_t fd, void* buf, int32_t nbytes)
 {
+    return read_fd(fd, buf, nbytes, NO_DEADLINE);
+}
+
+/*
+ * read_timeout:
+ * DESCRIPTION: 
+ *      the read_timeout system call, read waiting timeout_ms milliseconds
+ *      at most; 0 does not wait at all, a negative timeout waits as read
+ * INPUTS: 
+ *      - fd     : index into file_desc_array
+ *      - buf    : the read buffer
+ *      - nbytes : number of bytes to be read 
+ *      - timeout_ms : longest wait
+ * OUTPUTS: 
+ *      -1   : read failed
+ *      ERR_WOULD_BLOCK : nothing came in time
+ *      else : number of bytes read
+ */
+int32_t read_timeout (int32_t fd, void* buf, int32_t nbytes, int32_t timeout_ms)
+{
+    uint64_t deadline = NO_DEADLINE;
+
+    if (timeout_ms == 0) {
+        deadline = 0;
+    } else if (timeout_ms > 0) {
+        deadline = clock_ns() + (uint64_t) timeout_ms * NSEC_PER_MSEC;
+    }
+    return read_fd(fd, buf, nbytes, deadline);
+}
+
+/*
+ * poll:
+ * DESCRIPTION: 
+ *      the poll system call, wait until one of the files is ready for the
+ *      events asked for, or timeout_ms milliseconds (0 does not wait, a
+ *      negative timeout waits as long as it takes). The task sleeps on the
+ *      wait lists of the files meanwhile (the poll op of file_op_table_t).
+ * INPUTS: 
+ *      - fds     : user array of nfds pollfd_t, revents is filled in
+ *      - nfds    : 0 to FD_ARRAY_SIZE
+ *      - timeout_ms : longest wait
+ * OUTPUTS: 
+ *      -1   : bad arguments
+ *      else : number of entries with revents set, 0 at the timeout
+ */
+int32_t poll (pollfd_t* fds, int32_t nfds, int32_t timeout_ms)
+{
+    pcb_t* curr_pcb = get_current_pcb();
+    uint64_t deadline = NO_DEADLINE;
+    file_desc_t* desc;
+    int32_t i, fd, mask, ready;
+
+    if (nfds < 0 || nfds > FD_ARRAY_SIZE) return -1;
+    if ((uint32_t) fds < USER_MEM || (uint32_t) fds > USER_MEM_END - nfds * sizeof(pollfd_t)) return -1;
+
+    if (timeout_ms == 0) {
+        deadline = 0;
+    } else if (timeout_ms > 0) {
+        deadline = clock_ns() + (uint64_t) timeout_ms * NSEC_PER_MSEC;
+    }
+
+    while (1) {
+        // set by poll_wake from now on, a file getting ready during the scan is not missed
+        curr_pcb->poll_event = 0;
+        ready = 0;
+        for (i = 0; i < nfds; i++) {
+            fd = fds[i].fd;
+            fds[i].revents = 0;
+            // a negative fd is skipped
+            if (fd < 0) continue;
+            if (fd >= FD_ARRAY_SIZE || (curr_pcb->file_desc_array[fd].flags & FD_FLAG_PRESENT) == 0) {
+                fds[i].revents = POLLNVAL;
+                ready++;
+                continue;
+            }
+            desc = &curr_pcb->file_desc_array[fd];
+            if (desc->file_op_table->poll == NULL) {
+                mask = POLLIN | POLLOUT;
+            } else {
+                // no need to wait for the others once one is ready
+                mask = desc->file_op_table->poll(fd, ready == 0 && deadline != 0);
+            }
+            fds[i].revents = mask & fds[i].events;
+            if (fds[i].revents != 0) ready++;
+        }
+        if (ready != 0 || sleep_until_deadline(&curr_pcb->poll_event, deadline) == -1) {
+            return ready;
+        }
+    }
+}
+
+/*
+ * read_fd:
+ * DESCRIPTION: 
+ *      call the corresponding read function, waiting until the deadline
+ *      at most (none for an O_NONBLOCK file)
+ * INPUTS: 
+ *      - fd     : index into file_desc_array
+ *      - buf    : the read buffer
+ *      - nbytes : number of bytes to be read 
+ *      - deadline : clock_ns time, NO_DEADLINE to wait as long as it takes
+ * OUTPUTS: 
+ *      -1   : read failed
+ *      ERR_WOULD_BLOCK : nothing came by the deadline
+ *      else : number of bytes read
+ */
+static int32_t read_fd (int32_t fd, void* buf, int32_t nbytes, uint64_t deadline)
+{
+    file_desc_t* desc;
+
     if (buf == NULL || nbytes < 0) return -1;
 
     // fd should < FD_ARRAY_SIZE and stdout should not be read
@@ -532,12 +625,20 @@ int32_t read (int32_t fd, void* buf, int32_t nbytes)
     pcb_t* curr_pcb;
     curr_pcb = get_current_pcb();
 
-    if ((curr_pcb->file_desc_array[fd].flags & FD_FLAG_PRESENT) == 0) {
+    desc = &curr_pcb->file_desc_array[fd];
+    if ((desc->flags & FD_FLAG_PRESENT) == 0) {
         // if file is not opened
         return -1;
     } 
-    
-    return curr_pcb->file_desc_array[fd].file_op_table->read(fd, buf, nbytes);
+    if (desc->flags & FD_FLAG_NONBLOCK) {
+        deadline = 0;
+    }
+
+    // files and directories never wait
+    if (deadline == NO_DEADLINE || desc->file_op_table->read_until == NULL) {
+        return desc->file_op_table->read(fd, buf, nbytes);
+    }
+    return desc->file_op_table->read_until(fd, buf, nbytes, deadline);
 }
 
 /*
@@ -610,10 +711,23 @@ int32_t getargs (uint8_t* buf, int32_t nbytes){
  *       0  - success
  */
 int32_t vidmap (uint8_t** screen_start){
+    terminal_info_t* running = terminal_info_array[curr_running_terminal];
+    unsigned long flags;
+
     /* Check whether the address falls in user-level page */
     if (screen_start < (uint8_t**)USER_MEM || screen_start >= (uint8_t**)USER_MEM_END)
         return -1;
 
+    /* The program would draw on the other terminal of the page while hidden */
+    if (running->video_shared)
+        return -1;
+
+    /* The page maps the first rows of the terminal, its screen stays there from now on */
+    spin_lock_irqsave(&running->lock, flags);
+    running->vidmap_pid = get_curr_pid();
+    screen_home();
+    spin_unlock_irqrestore(&running->lock, flags);
+
     /* Write the user video memory address */
     *screen_start = (uint8_t*)USER_VIDEO;
 
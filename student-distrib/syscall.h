@@ -3,6 +3,7 @@
 
 #include "types.h"
 #include "lib.h"
+#include "task.h"
 
 #define USER_IMG_ADDR       0x08048000    //address to run the current user process
 #define USER_MEM            0x08000000    //start addr of user memory
@@ -14,6 +15,16 @@
 
 #define NEED_TO_ASSIGN      -1
 
+// flags of open_flags
+#define O_NONBLOCK          0x1
+
+// an entry of the poll system call
+typedef struct pollfd_t {
+    int32_t fd;                 // negative to skip the entry
+    int16_t events;             // POLLIN and POLLOUT wanted
+    int16_t revents;            // those ready, or POLLNVAL
+} pollfd_t;
+
 //magic numbers to check for executable
 #define EXE_MAGIC_NUMBER_0  0x7F
 #define EXE_MAGIC_NUMBER_1  0x45
@@ -26,6 +37,9 @@ int32_t execute (const uint8_t* command);
 int32_t read (int32_t fd, void* buf, int32_t nbytes);
 int32_t write (int32_t fd, const void* buf, int32_t nbytes);
 int32_t open (const uint8_t* filename);
+int32_t open_flags (const uint8_t* filename, int32_t flags);
+int32_t read_timeout (int32_t fd, void* buf, int32_t nbytes, int32_t timeout_ms);
+int32_t poll (pollfd_t* fds, int32_t nfds, int32_t timeout_ms);
 int32_t close (int32_t fd);
 int32_t getargs (uint8_t* buf, int32_t nbytes);
 int32_t vidmap (uint8_t** screen_start);
@@ -34,4 +48,7 @@ int32_t sigreturn (void);
 
 int32_t exception_halt (void);
 
+/* load a program into a new task without running it */
+pcb_t* create_task(const uint8_t* command, pcb_t* parent, int32_t terminal_id);
+
 #endif /* SYSCALL_H */
@@ -1,5 +1,16 @@
 #include "task.h"
 
+#include "page.h"
+#include "syscall.h"
+#include "scheduler.h"
+#include "latency.h"
+
+/* PIT ticks that found no runnable task */
+static uint32_t idle_ticks;
+
+/* Guards the present flag of the pcbs, i.e. pid allocation */
+static spinlock_t pcb_lock;
+
 /* 
  * init_all_pcb
  *  DESCRIPTION:
@@ -11,6 +22,7 @@
 void init_all_pcb() {
     int pid;
 
+    spin_lock_init(&pcb_lock, "pcb");
     for (pid = 0; pid < MAX_TASK_NUM; pid++) {
         reset_pcb(pid);
     }
@@ -38,9 +50,20 @@ int32_t reset_pcb(uint32_t pid) {
     pcb->pid = pid;
     pcb->parent_pid = -1;
     pcb->present = 0;
-    pcb->tick_count = -1; //-1 is an invalid value to indicate need open
-    pcb->pcb_freq = -1;   //-1 is an invalid value to indicate need open
-    pcb->int_flag = 0;  
+    pcb->state = TASK_RUNNABLE;
+    pcb->terminal_id = -1;
+    pcb->timeout = NO_DEADLINE;
+    pcb->poll_event = 0;
+    memset(&pcb->context, 0, sizeof(context_t));
+    memset(pcb->name, NULL, TASK_NAME_LEN);
+    memset(&pcb->stats, 0, sizeof(task_stats_t));
+    pcb->policy = SCHED_NORMAL;
+    pcb->cpu = 0;
+    pcb->on_cpu = -1;
+    pcb->rt_priority = 0;
+    pcb->kthread = 0;
+    pcb->kthread_fn = NULL;
+    pcb->kthread_arg = NULL;
     // clear fd entries
     pcb->file_desc_num = 0;
     for (fd = 0; fd < FD_ARRAY_SIZE; fd++) {
@@ -62,7 +85,8 @@ int32_t reset_pcb(uint32_t pid) {
  * INPUTS: pid        -- the pcb id to use, pid start from 1
  * OUTPUTS: none
  * RETURN: the pointer of the pcb created
- * SIDE EFFECTS: create a pcb on the stack
+ * SIDE EFFECTS: create a pcb on the stack. The pid stays allocated, the
+ *               task is TASK_WAITING until its creator makes it runnable.
  */
 pcb_t* create_pcb(uint32_t pid)
 {
@@ -70,8 +94,12 @@ pcb_t* create_pcb(uint32_t pid)
     
     if (new_pcb == NULL) { return NULL; }
 
-    // reset the cooresponding pcb struct
+    // reset the cooresponding pcb struct, allocate_pid must not see it free
+    spin_lock(&pcb_lock);
     reset_pcb(pid);
+    new_pcb->state = TASK_WAITING;
+    new_pcb->present = 1;
+    spin_unlock(&pcb_lock);
 
     return new_pcb;
 }
@@ -124,7 +152,8 @@ pcb_t* get_pcb_by_pid(uint32_t pid) {
 /*
  * allocate_pid
  *  DESCRIPTION:
- *      Allocate one available pid. 
+ *      Allocate one available pid. It is marked present (and TASK_WAITING,
+ *      so nobody schedules it) until release_pid.
  *  INPUT: NONE
  *  OUTPUT: 
  *      -1   - cannot allocate more pid
@@ -132,14 +161,180 @@ pcb_t* get_pcb_by_pid(uint32_t pid) {
  */
 uint32_t allocate_pid() {
     int pid; 
+    pcb_t* pcb;
 
+    spin_lock(&pcb_lock);
     for (pid = 0; pid < MAX_TASK_NUM; pid++) {
         // no need to check for NULL because pid is valid
-        if(get_pcb_by_pid(pid)->present == 0){
+        pcb = get_pcb_by_pid(pid);
+        if(pcb->present == 0){
             // found a vacant pid
+            pcb->state = TASK_WAITING;
+            pcb->present = 1;
             break;
         }
     }
+    spin_unlock(&pcb_lock);
 
     return (pid == MAX_TASK_NUM) ? -1 : pid;
 }
+
+/*
+ * release_pid
+ *  DESCRIPTION:
+ *      Give back a pid, its kernel stack must not be in use any more
+ *  INPUT:
+ *      pid - pid returned by allocate_pid
+ *  OUTPUT: NONE
+ */
+void release_pid(uint32_t pid) {
+    spin_lock(&pcb_lock);
+    get_pcb_by_pid(pid)->present = 0;
+    spin_unlock(&pcb_lock);
+}
+
+/*
+ * get_kernel_stack
+ *  DESCRIPTION:
+ *      Top of the kernel stack of a task, the value loaded into TSS esp0
+ *      (the first 4 bytes below the 8KB boundary are kept unused)
+ *  INPUT:
+ *      pid - the pid of the task
+ *  OUTPUT:
+ *      address of the top of the kernel stack
+ */
+uint32_t get_kernel_stack(uint32_t pid) {
+    return STACK_BASE_8_MB - pid * STACK_SIZE_8_KB - sizeof(uint32_t);
+}
+
+/*
+ * task_switch
+ *  DESCRIPTION:
+ *      Map the program image of next (a kernel thread has none) and switch
+ *      to it through switch_to,
+ *      next becomes the current task of this CPU and starts a new time
+ *      slice. Must be called with sched_lock held (and no other lock), the
+ *      lock is released by the task being switched to.
+ *  INPUT:
+ *      prev - where the context of the caller is saved
+ *      next - task to be resumed
+ *  OUTPUT:
+ *      value stored into prev->eax by whoever resumes the caller
+ */
+int32_t task_switch(context_t* prev, pcb_t* next) {
+    cpu_t* cpu = this_cpu();
+    pcb_t* curr = get_pcb_by_pid(cpu->curr_pid);
+    int32_t ret;
+
+    // next moves into the run queue of this CPU
+    if (curr != NULL) {
+        curr->on_cpu = -1;
+    }
+    cpu->curr_pid = next->pid;
+    next->on_cpu = cpu->id;
+    next->cpu = cpu->id;
+
+    grant_slice(next);
+    trace_switch_in(next->pid);
+    // a kernel thread runs on the page directory of whoever came before
+    if (!next->kthread) {
+        map_user_program(next->pid);
+    }
+    cpu->tss->esp0 = get_kernel_stack(next->pid);
+    ret = switch_to(prev, &next->context);
+
+    // we may be resumed on another CPU, by a task we know nothing about
+    finish_task_switch();
+    return ret;
+}
+
+/*
+ * finish_task_switch
+ *  DESCRIPTION:
+ *      Clean up after the task switched away from on this CPU, run by the
+ *      task switched to (sched_lock is still held). A halted task can only
+ *      give its pid back now that nothing runs on its kernel stack.
+ *  INPUT: NONE
+ *  OUTPUT: NONE
+ */
+void finish_task_switch(void) {
+    cpu_t* cpu = this_cpu();
+
+    if (cpu->dead_pid != -1) {
+        release_pid(cpu->dead_pid);
+        cpu->dead_pid = -1;
+    }
+}
+
+/* 
+ * task_account_tick
+ *  DESCRIPTION:
+ *      Charge one PIT tick to the current task (or to the idle CPU)
+ *  INPUT:
+ *      cs - code segment of the interrupted code
+ */
+void task_account_tick(uint32_t cs) {
+    pcb_t* pcb = get_pcb_by_pid(get_curr_pid());
+
+    if (pcb == NULL || pcb->state == TASK_SLEEPING) {
+        // the current task waits in hlt for an interrupt
+        idle_ticks++;
+    } else if ((cs & 0x3) == 0x3) {
+        pcb->stats.user_ticks++;
+    } else {
+        pcb->stats.kernel_ticks++;
+    }
+}
+
+/* 
+ * task_account_syscall
+ *  DESCRIPTION:
+ *      Count one system call of the current task (called from sys_call_handler)
+ */
+void task_account_syscall(void) {
+    get_current_pcb()->stats.nr_syscalls++;
+}
+
+/*
+ * getstats
+ *  DESCRIPTION:
+ *      The getstats system call, copy the CPU accounting of a task to user space
+ *  INPUT:
+ *      pid - task to be inspected, -1 for the idle CPU
+ *      buf - user buffer receiving a task_stats_t
+ *  OUTPUT:
+ *      -1 - pid is not present or buf is not a user address
+ *       0 - success
+ */
+int32_t getstats(int32_t pid, task_stats_t* buf) {
+    pcb_t* pcb;
+
+    if ((uint32_t) buf < USER_MEM || (uint32_t) buf > USER_MEM_END - sizeof(task_stats_t)) {
+        return -1;
+    }
+
+    if (pid == -1) {
+        memset(buf, 0, sizeof(task_stats_t));
+        buf->pid = -1;
+        buf->parent_pid = -1;
+        buf->terminal_id = -1;
+        buf->kernel_ticks = idle_ticks;
+        strcpy((int8_t*) buf->name, "idle");
+        return 0;
+    }
+
+    pcb = get_pcb_by_pid(pid);
+    if (pcb == NULL || !pcb->present) {
+        return -1;
+    }
+
+    memcpy(buf, &pcb->stats, sizeof(task_stats_t));
+    buf->pid = pcb->pid;
+    buf->parent_pid = pcb->parent_pid;
+    buf->terminal_id = pcb->terminal_id;
+    buf->state = pcb->state;
+    buf->policy = pcb->policy;
+    buf->rt_priority = pcb->rt_priority;
+    memcpy(buf->name, pcb->name, TASK_NAME_LEN);
+    return 0;
+}
@@ -4,6 +4,9 @@
 #include "types.h"
 #include "lib.h"
 #include "filesys_struct.h"
+#include "switch.h"
+#include "smp.h"
+#include "spinlock.h"
 
 #define FD_ARRAY_SIZE           8
 #define STACK_BASE_8_MB         0x800000
@@ -12,22 +15,75 @@
 #define MAX_TASK_NUM 16
 #define MAX_ARGUMENT_SIZE       127         // in accordance with terminal's limit
 
+/* scheduling states of a present task */
+#define TASK_RUNNABLE           0           // may be picked by the scheduler
+#define TASK_SLEEPING           1           // blocked until a driver wakes it up
+#define TASK_WAITING            2           // waiting in execute for its child to halt
+
+#define TASK_NAME_LEN           32
+
+/* scheduling classes, a runnable SCHED_RT task always runs before any SCHED_NORMAL one */
+#define SCHED_NORMAL            0           // round robin on PIT ticks
+#define SCHED_RT                1           // fixed priority, preempts on wake up
+#define RT_PRIO_MIN             1
+#define RT_PRIO_MAX             99
+
+/* rtc_read latency histogram, bucket i counts 2^(i-1) to 2^i - 1 RTC ticks (~1ms) */
+#define RT_HIST_BUCKETS         8
+
+/* 
+ * CPU accounting of a task, also the buffer layout of the getstats system call
+ * (pid -1 describes the idle CPU: kernel_ticks counts ticks nobody could run)
+ */
+typedef struct task_stats_t {
+    int32_t             pid;
+    int32_t             parent_pid;
+    int32_t             terminal_id;
+    int32_t             state;
+    uint32_t            user_ticks;     // PIT ticks that interrupted user mode
+    uint32_t            kernel_ticks;   // PIT ticks that interrupted kernel mode
+    uint32_t            nr_switches;    // times the task was switched in
+    uint32_t            nr_voluntary;   // gave up the CPU: yield, handoff, sleep
+    uint32_t            nr_forced;      // preempted by the PIT
+    uint32_t            nr_syscalls;
+    int32_t             policy;         // SCHED_NORMAL or SCHED_RT
+    int32_t             rt_priority;    // RT_PRIO_MIN to RT_PRIO_MAX, 0 for SCHED_NORMAL
+    uint32_t            rt_latency[RT_HIST_BUCKETS];    // virtual RTC event to rtc_read return
+    uint32_t            rt_misses;      // rtc_read returned a whole period late or more
+    uint32_t            slice_granted;  // ticks of all time slices handed to the task
+    uint32_t            slice_used;     // ticks of them actually run before giving up the CPU
+    uint8_t             name[TASK_NAME_LEN];
+} task_stats_t;
+
+/* tasks in poll waiting for a source to get ready, a bit per pid (see poll_wait) */
+typedef volatile uint32_t wait_list_t;
 
 typedef struct pcb_t {
     int32_t             pid;           // pid start from 0
     int32_t             parent_pid;
     struct pcb_t*       parent_pcb;
-    uint32_t            esp;
-    uint32_t            ebp;
+    context_t           context;        // kernel registers saved by switch_to
     uint8_t             present;        // whether this entry is being occupied
+    volatile int32_t    state;          // TASK_RUNNABLE, TASK_SLEEPING or TASK_WAITING
+    uint64_t            timeout;        // clock_ns deadline of a sleep_until_deadline, NO_DEADLINE if none
+    int32_t             terminal_id;    // terminal the task reads from and writes to
+    uint8_t             name[TASK_NAME_LEN];    // executable name
+    task_stats_t        stats;          // CPU accounting (only counters are kept up to date)
+    int32_t             policy;         // SCHED_NORMAL or SCHED_RT, inherited by children
+    int32_t             rt_priority;    // higher runs first among SCHED_RT tasks
+    int32_t             slice_left;     // ticks left in the current time slice
+    int32_t             cpu;            // CPU whose run queue holds the task
+    int32_t             on_cpu;         // CPU running the task right now, -1 if none
 
     uint32_t            file_desc_num;
     file_desc_t         file_desc_array[FD_ARRAY_SIZE];
     uint8_t             argument[MAX_ARGUMENT_SIZE];
 
-    int32_t             pcb_freq;      // Virtual frequency of pcb
-    volatile int32_t    tick_count;    // Counter of ticks, when ticks equal to zero, it should be a interrupt
-    volatile int32_t    int_flag;      // Interrupt flag, 0 means no interrupt, 1 means need interrupt. 
+    volatile int32_t    poll_event;     // set by poll_wake, a source the task polls got ready
+
+    uint8_t             kthread;        // kernel thread, no program image or terminal
+    void                (*kthread_fn)(void* arg);  // body of a kernel thread
+    void*               kthread_arg;
 } pcb_t;
 
 /* 
@@ -53,7 +109,8 @@ pcb_t* get_current_pcb();
 /*
  * allocate_pid
  *  DESCRIPTION:
- *      Allocate one available pid. 
+ *      Allocate one available pid. It is marked present (and TASK_WAITING,
+ *      so nobody schedules it) until release_pid.
  *  INPUT: NONE
  *  OUTPUT: 
  *      -1   - cannot allocate more pid
@@ -61,6 +118,9 @@ pcb_t* get_current_pcb();
  */
 uint32_t allocate_pid();
 
+/* Give back a pid, its kernel stack must not be in use any more */
+void release_pid(uint32_t pid);
+
 /* 
  * init_all_pcb
  *  DESCRIPTION:
@@ -97,6 +157,60 @@ int32_t reset_pcb(uint32_t pid);
  */
 pcb_t* get_pcb_by_pid(uint32_t pid);
 
+/*
+ * get_kernel_stack
+ *  DESCRIPTION:
+ *      Top of the kernel stack of a task, the value loaded into TSS esp0
+ *      (the first 4 bytes below the 8KB boundary are kept unused)
+ *  INPUT:
+ *      pid - the pid of the task
+ *  OUTPUT:
+ *      address of the top of the kernel stack
+ */
+uint32_t get_kernel_stack(uint32_t pid);
+
+/*
+ * task_switch
+ *  DESCRIPTION:
+ *      Map the program image of next and switch to it through switch_to.
+ *      Must be called with sched_lock held (and no other lock), the lock
+ *      is released by the task being switched to.
+ *  INPUT:
+ *      prev - where the context of the caller is saved
+ *      next - task to be resumed
+ *  OUTPUT:
+ *      value stored into prev->eax by whoever resumes the caller
+ */
+int32_t task_switch(context_t* prev, pcb_t* next);
+
+/* Clean up after the task switched away from, run by the task switched to */
+void finish_task_switch(void);
+
+/* 
+ * task_account_tick
+ *  DESCRIPTION:
+ *      Charge one PIT tick to the current task (or to the idle CPU)
+ *  INPUT:
+ *      cs - code segment of the interrupted code
+ */
+void task_account_tick(uint32_t cs);
+
+/* Count one system call of the current task (called from sys_call_handler) */
+void task_account_syscall(void);
+
+/*
+ * getstats
+ *  DESCRIPTION:
+ *      The getstats system call, copy the CPU accounting of a task to user space
+ *  INPUT:
+ *      pid - task to be inspected, -1 for the idle CPU
+ *      buf - user buffer receiving a task_stats_t
+ *  OUTPUT:
+ *      -1 - pid is not present or buf is not a user address
+ *       0 - success
+ */
+int32_t getstats(int32_t pid, task_stats_t* buf);
+
 /* number of running processes */
 
 #endif
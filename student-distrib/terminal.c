@@ -5,14 +5,55 @@
 #include "syscall.h"
 #include "scheduler.h"
 
-static int32_t curr_string_len;
-static uint8_t* keyboard_buffer; 
-static volatile int32_t enter_flag = 0;
-static int32_t halt_flag = 0; // bit vector for whether halt in each terminal
+static volatile int32_t halt_flag = 0; // bit vector for whether halt in each terminal
 
-file_op_table_t terminal_op_table = {.open = terminal_open, .close = terminal_close, .read = terminal_read, .write = terminal_write};
+/* bytes of a write drawn per hold of the terminal lock (putbuf draws a chunk at once), keeps interrupts latency bounded */
+#define WRITE_CHUNK     512
+
+file_op_table_t terminal_op_table = {.open = terminal_open, .close = terminal_close, .read = terminal_read, .write = terminal_write,
+                                     .read_until = terminal_read_until, .poll = terminal_poll};
 
 
+/*
+ * input_update:
+ * DESCRIPTION: tell whether a read of the terminal would find something,
+ *              called with the terminal lock held after the input changed
+ * INPUTS: t - the terminal
+ * OUTPUTS: none
+ * RETURN: input_ready, a whole line (or a full ring) when editing lines,
+ *         any key in raw mode
+ * SIDE EFFECTS: sets input_ready
+ */
+static int32_t input_update(terminal_info_t* t){
+    uint32_t count = t->input.tail - t->input.head;
+
+    if (t->raw_pid != -1) {
+        t->input_ready = (count != 0);
+    } else {
+        t->input_ready = (t->input.lines != 0 || count == INPUT_RING_SIZE);
+    }
+    return t->input_ready;
+}
+
+/*
+ * input_put:
+ * DESCRIPTION: queue a typed byte for read, with the terminal lock held
+ * INPUTS: t - the terminal
+ *         c - the byte
+ * OUTPUTS: none
+ * RETURN: none
+ * SIDE EFFECTS: the byte is dropped if the ring is full
+ */
+static void input_put(terminal_info_t* t, uint8_t c){
+    if (t->input.tail - t->input.head == INPUT_RING_SIZE) {
+        return;
+    }
+    t->input.buf[t->input.tail++ & (INPUT_RING_SIZE - 1)] = c;
+    if (c == CODE_ENTER) {
+        t->input.lines++;
+    }
+}
+
 /*
  * terminal_init:
  * DESCRIPTION: initialize the terminal stuff
@@ -32,11 +73,12 @@ file_op_table_t terminal_op_table = {.open = terminal_open, .close = terminal_cl
  * DESCRIPTION: open and initialize the terminal stuff
  * INPUTS: 
  *   - filename (not used)
+ *   - fd (not used)
  * OUTPUTS: none
  * RETURN: 0
  * SIDE EFFECTS: none
  */
-int32_t terminal_open(const uint8_t* filename){
+int32_t terminal_open(const uint8_t* filename, int32_t fd){
     // terminal_init();
     //while(1){printf("114514");}
     return 0;
@@ -62,171 +104,237 @@ int32_t terminal_close(int32_t fd){
  * INPUTS: curr_ascii_code, the current ascii code given by keyboard
  * OUTPUTS: none
  * RETURN: none
- * SIDE EFFECTS: handle the terminal which multiple cases
+ * SIDE EFFECTS: handle the terminal which multiple cases, called from the keyboard tasklet
  */
 void terminal_handler(uint8_t curr_ascii_code){
+    // keyboard input always belongs to the terminal on the screen
+    terminal_info_t* active = terminal_info_array[curr_active_terminal];
+    unsigned long flags;
+    int32_t tid, i, ready, raw_pid, curr_pid;
+
     //the case that ctrl + L is pressed
     if (get_ctrl_f() == 1) {
         switch (curr_ascii_code) {
             case 'L':
-                set_active_terminal();
-                clear();
-                init_cursor();
-                restore_running_terminal();
-                return;
             case 'l':
+                spin_lock_irqsave(&active->lock, flags);
                 set_active_terminal();
                 clear();
                 init_cursor();
                 restore_running_terminal();
+                spin_unlock_irqrestore(&active->lock, flags);
                 return;
             case 'C':
-                if (curr_active_terminal == curr_running_terminal) {
-                    halt(255);
-                } else {
-                    halt_flag |= 1 << curr_active_terminal;
-                }
-                return;
             case 'c':
-                if (curr_active_terminal == curr_running_terminal) {
-                    halt(255);
-                } else {
-                    halt_flag |= 1 << curr_active_terminal;
-                }
+                // we run in the keyboard tasklet, the task is halted once it
+                // gets the CPU back (irq_exit, or serve_ctrl_c in the scheduler)
+                asm volatile ("lock; btsl %1, %0"
+                              : "+m" (halt_flag)
+                              : "r" (curr_active_terminal)
+                              : "memory", "cc");
+                task_wake(active->curr_pid);
                 return;
             default:
                 return;
         }
     }
     
+    // Alt+Fn shows terminal n-1, opening it the first time
     if (get_alt_f() == 1){
-        switch(get_function_f()){
-            case 1:
-                switch_active_terminal(0);
-                return;
-            case 2:
-                switch_active_terminal(1);
-                return;
-            case 4:
-                switch_active_terminal(2);
+        for (tid = 0; tid < MAX_TERMINAL_NUM; tid++) {
+            if (get_function_f() == (1 << tid)) {
+                show_terminal(tid);
                 return;
+            }
         }
     }
 
     if (get_dir_up_f() || get_dir_down_f()) {
+        spin_lock_irqsave(&active->lock, flags);
         set_active_terminal();
         scroll_and_view_history(get_dir_up_f(), get_dir_down_f());
         restore_running_terminal();
+        spin_unlock_irqrestore(&active->lock, flags);
     }
     
     if (curr_ascii_code == 0){
         return;
     }
 
+    //in raw mode every key goes to the reader as it is, not echoed
+    spin_lock_irqsave(&active->lock, flags);
+    if (active->raw_pid != -1){
+        input_put(active, curr_ascii_code);
+        ready = input_update(active);
+        // the raw reader need not be the foreground task (its parent may run)
+        raw_pid = active->raw_pid;
+        curr_pid = active->curr_pid;
+        spin_unlock_irqrestore(&active->lock, flags);
+        if (ready){
+            task_wake(raw_pid);
+            if (curr_pid != raw_pid) {
+                task_wake(curr_pid);
+            }
+            poll_wake(&active->input_pollers);
+        }
+        return;
+    }
+    spin_unlock_irqrestore(&active->lock, flags);
+
     //if backspace is hit, decrement the length and clear the last character
     if (curr_ascii_code == CODE_BACKSPACE){
+        spin_lock_irqsave(&active->lock, flags);
         set_active_terminal();
 
         //check if there is a expression, if there is not, simply return
-        if (curr_string_len == 0){
+        if (active->curr_string_len == 0){
             restore_running_terminal();
+            spin_unlock_irqrestore(&active->lock, flags);
             return;
         }
 
         //modify the buffer
-        curr_string_len--;
-        keyboard_buffer[curr_string_len] = NULL;
+        active->curr_string_len--;
+        active->keyboard_buffer[active->curr_string_len] = NULL;
         //modify the screen
         backspace_handler();
         update_cursor();
 
         restore_running_terminal();
+        spin_unlock_irqrestore(&active->lock, flags);
         return;
     }
-    // if enter is pressed, switch to new line and call terminal_read
+    // if enter is pressed, the line goes to the input ring for terminal_read
     if (curr_ascii_code == CODE_ENTER){
-        //if pressed enter, set the flag
-        terminal_info_array[curr_active_terminal].enter_flag = 1;
-        enter_flag = terminal_info_array[curr_running_terminal].enter_flag;
-        return;
-    }
-    //check the limit, while the last place of the buffer is reserved for an LINE FEED
-    if (curr_string_len < MAX_TERMINAL_BUF_CHARACTERS - 1){
-        //if the string length does not exceed the max, put it to the keyboard buffer
+        spin_lock_irqsave(&active->lock, flags);
         set_active_terminal();
-
-        keyboard_buffer[curr_string_len] = curr_ascii_code;
-        curr_string_len ++;
-        putc(curr_ascii_code);
+        for (i = 0; i < active->curr_string_len; i++){
+            input_put(active, active->keyboard_buffer[i]);
+        }
+        input_put(active, CODE_ENTER);
+        active->curr_string_len = 0;
+        putc(CODE_ENTER);
         update_cursor();
-
+        ready = input_update(active);
         restore_running_terminal();
+        spin_unlock_irqrestore(&active->lock, flags);
+        if (ready){
+            task_wake(active->curr_pid);
+            poll_wake(&active->input_pollers);
+        }
         return;
-    }else{
-        //if it exceed the maximum number,do not put into buffer, just put it to screen and and return
-        set_active_terminal();
-
-        putc(curr_ascii_code);
-        update_cursor();
+    }
 
-        restore_running_terminal();
-        return;
+    spin_lock_irqsave(&active->lock, flags);
+    set_active_terminal();
+    //check the limit, while the last place of the buffer is reserved for an LINE FEED
+    if (active->curr_string_len < MAX_TERMINAL_BUF_CHARACTERS - 1){
+        //if the string length does not exceed the max, put it to the keyboard buffer
+        active->keyboard_buffer[active->curr_string_len] = curr_ascii_code;
+        active->curr_string_len ++;
     }
+    //if it exceed the maximum number,do not put into buffer, just put it to screen
+    putc(curr_ascii_code);
+    update_cursor();
+
+    restore_running_terminal();
+    spin_unlock_irqrestore(&active->lock, flags);
 
 }
 
 /*
  * terminal_read:
- * DESCRIPTION: wait until an enter is pressed, then read the characters and clear the keyboard buffer
+ * DESCRIPTION: wait until a line was entered (any key in raw mode), then read the input ring
  * INPUTS: fd  - the file descriptor
- *         buf - the user buffer, which read the characters in the keyboard buffer
+ *         buf - the user buffer, which read the characters typed
  *         n -    number of byte to read
  * OUTPUTS: none
  * RETURN: the number of bytes read, else return -1 for failure
- * SIDE EFFECTS: move to the new line on the terminal
+ * SIDE EFFECTS: none
  */
 int32_t terminal_read(int32_t fd, void* buf, int32_t n){
+    return terminal_read_until(fd, buf, n, NO_DEADLINE);
+}
+
+/*
+ * terminal_read_until:
+ * DESCRIPTION: terminal_read, giving up when nothing could be read by the deadline
+ * INPUTS: fd  - the file descriptor
+ *         buf - the user buffer, which read the characters typed
+ *         n -    number of byte to read
+ *         deadline - clock_ns time, 0 not to wait at all
+ * OUTPUTS: none
+ * RETURN: the number of bytes read, -1 for failure, ERR_WOULD_BLOCK past the deadline
+ * SIDE EFFECTS: none
+ */
+int32_t terminal_read_until(int32_t fd, void* buf, int32_t n, uint64_t deadline){
     int32_t length;
-    //check the length
-    int32_t i;
+    uint8_t c;
     uint8_t* buf_8 = (uint8_t *) buf;
     unsigned long flags;
+    // the reader is the process of the terminal being run
+    terminal_info_t* running = terminal_info_array[curr_running_terminal];
 
     //check the null pointer
     if (buf_8 == NULL){
         return -1;
     }
-    //wait for the enter
-    asm volatile ("terminal_hlt: hlt;");
-    if (enter_flag == 0)
-        asm volatile ("jmp terminal_hlt;");
-    
-    //mask the interrupts to protect enter flag
-    cli_and_save(flags);
-    enter_flag = 0; //set it back
-    keyboard_buffer[curr_string_len] = CODE_ENTER; //set the last character of the string to be line feed
-    curr_string_len ++;
-    putc(CODE_ENTER);  //put the line feed character to the terminal
-    length = curr_string_len;
-    curr_string_len = 0;  //clear the buffer
-    if (curr_active_terminal == curr_running_terminal) {
-        update_cursor();
+
+    //the keyboard handler of any CPU fills the ring under the terminal lock
+    spin_lock_irqsave(&running->lock, flags);
+    //wait for a line, or a key in raw mode
+    while (!running->input_ready){
+        spin_unlock_irqrestore(&running->lock, flags);
+        if (sleep_until_deadline(&running->input_ready, deadline) == -1){
+            return ERR_WOULD_BLOCK;
+        }
+        spin_lock_irqsave(&running->lock, flags);
     }
 
-    //copy it to buf
-    for (i = 0; i < n; i++){
-        if (i < length){
-            buf_8[i] = keyboard_buffer[i];
-        }else{
-            buf_8[i] = NULL;
+    //copy it to buf, a line at most when editing lines; the rest stays for the next read
+    for (length = 0; length < n && running->input.head != running->input.tail; ){
+        c = running->input.buf[running->input.head++ & (INPUT_RING_SIZE - 1)];
+        buf_8[length++] = c;
+        if (c == CODE_ENTER){
+            running->input.lines--;
+            if (running->raw_pid == -1){
+                break;
+            }
         }
     }
-    restore_flags(flags);
+    input_update(running);
+    spin_unlock_irqrestore(&running->lock, flags);
 
     return length;
 }
 
 
+/*
+ * terminal_poll:
+ * DESCRIPTION: the poll op of the terminal, writes never wait
+ * INPUTS: fd - the file descriptor
+ *         wait - put the caller on the wait list of the input
+ * OUTPUTS: none
+ * RETURN: POLLOUT, and POLLIN once a read would find something
+ * SIDE EFFECTS: none
+ */
+int32_t terminal_poll(int32_t fd, int32_t wait){
+    terminal_info_t* running = terminal_info_array[curr_running_terminal];
+    unsigned long flags;
+    int32_t mask = POLLOUT;
+
+    //the keyboard handler wakes the list up after making input_ready under the lock
+    spin_lock_irqsave(&running->lock, flags);
+    if (wait){
+        poll_wait(&running->input_pollers);
+    }
+    if (running->input_ready){
+        mask |= POLLIN;
+    }
+    spin_unlock_irqrestore(&running->lock, flags);
+    return mask;
+}
+
 /*
  * terminal_write:
  * DESCRIPTION: write n bytes from buf to the terminal as well as keyboard buffer
@@ -238,54 +346,91 @@ int32_t terminal_read(int32_t fd, void* buf, int32_t n){
  * SIDE EFFECTS: none
  */
 int32_t terminal_write(int32_t fd, const void* buf, int32_t n){
-    int32_t i;
+    int32_t i, len;
     uint8_t* buf_8 = (uint8_t*) buf;
+    unsigned long flags;
+    terminal_info_t* running = terminal_info_array[curr_running_terminal];
 
     //check the null pointer
     if (buf_8 == NULL){
         return -1;
     }
     
-    //copy from buffer and print it to the terminal
-    for (i = 0; i < n; i ++){
-        if (buf_8[i] != NULL){
-            putc(buf_8[i]);
+    //copy from buffer and print it to the terminal, a chunk per hold of the lock
+    for (i = 0; i < n; i += len){
+        len = (n - i > WRITE_CHUNK) ? WRITE_CHUNK : n - i;
+        spin_lock_irqsave(&running->lock, flags);
+        putbuf(buf_8 + i, len);
+        // the cursor only moves once, after the last chunk
+        if (i + len == n && curr_active_terminal == curr_running_terminal) {
+            update_cursor();
         }
-    }
-    if (curr_active_terminal == curr_running_terminal) {
-        update_cursor();
+        spin_unlock_irqrestore(&running->lock, flags);
     }
     return n;
 }
 
-int32_t get_enter_flag() {
-    return enter_flag;
-}
-
-int32_t get_curr_string_len() {
-    return curr_string_len;
-}
-
-uint8_t* get_keyboard_buffer() {
-    return keyboard_buffer;
-}
-
 int32_t get_halt_flag(int32_t terminal_id) {
     return (halt_flag & (1 << terminal_id)) ? 1 : 0;
 }
 
-void set_enter_flag(int32_t enter_flag_n) {
-    enter_flag = enter_flag_n;
+void clear_halt_flag(int32_t terminal_id) {
+    // set by the keyboard handler of another CPU meanwhile
+    asm volatile ("lock; btrl %1, %0"
+                  : "+m" (halt_flag)
+                  : "r" (terminal_id)
+                  : "memory", "cc");
 }
 
-void set_curr_string_len(int32_t curr_string_len_n) {
-    curr_string_len = curr_string_len_n;
+/*
+ * termstat:
+ * DESCRIPTION: the termstat system call, copy the output counters of a terminal
+ * INPUTS: tid - the terminal
+ *         buf - user buffer receiving a term_stats_t
+ * OUTPUTS: none
+ * RETURN: 0 on success, -1 if there is no such terminal or buf is not a user address
+ * SIDE EFFECTS: none
+ */
+int32_t termstat(int32_t tid, term_stats_t* buf) {
+    if (tid < 0 || tid >= nr_terminals) {
+        return -1;
+    }
+    if ((uint32_t) buf < USER_MEM || (uint32_t) buf > USER_MEM_END - sizeof(term_stats_t)) {
+        return -1;
+    }
+    // a terminal never opened has written nothing
+    if (terminal_info_array[tid] == NULL) {
+        memset(buf, 0, sizeof(term_stats_t));
+        return 0;
+    }
+    // a snapshot, writers may be counting meanwhile
+    memcpy(buf, &terminal_info_array[tid]->stats, sizeof(term_stats_t));
+    return 0;
 }
 
-void set_keyboard_buffer(uint8_t* keyboard_buffer_n) {
-    keyboard_buffer = keyboard_buffer_n;
-}
+/*
+ * ttymode:
+ * DESCRIPTION: the ttymode system call, choose how the caller reads its terminal:
+ *              TTY_CANONICAL, lines edited and echoed by the terminal, or
+ *              TTY_RAW, every key as it is typed and not echoed. Raw mode
+ *              ends when the task halts.
+ * INPUTS: mode - TTY_CANONICAL or TTY_RAW
+ * OUTPUTS: none
+ * RETURN: the mode before, -1 if mode is not one of them
+ * SIDE EFFECTS: input typed so far stays in the ring for the next read
+ */
+int32_t ttymode(int32_t mode) {
+    terminal_info_t* running = terminal_info_array[curr_running_terminal];
+    unsigned long flags;
+    int32_t prev;
 
-void clear_halt_flag(int32_t terminal_id) {
-    halt_flag &= ~(1 << terminal_id);
+    if (mode != TTY_CANONICAL && mode != TTY_RAW) {
+        return -1;
+    }
+    spin_lock_irqsave(&running->lock, flags);
+    prev = (running->raw_pid != -1) ? TTY_RAW : TTY_CANONICAL;
+    running->raw_pid = (mode == TTY_RAW) ? get_curr_pid() : -1;
+    input_update(running);
+    spin_unlock_irqrestore(&running->lock, flags);
+    return prev;
 }
@@ -6,37 +6,78 @@
 #include "filesys_struct.h"
 
 #define MAX_TERMINAL_BUF_CHARACTERS   128
+#define INPUT_RING_SIZE     1024    // typeahead of a terminal, a power of 2
+
+/* modes of the keyboard input of a terminal, set by the ttymode system call */
+#define TTY_CANONICAL       0       // lines edited and echoed, read a line at a time
+#define TTY_RAW             1       // every key as it is typed, without echo
 // #define NUM_TERMINAL_COLS    80
 // #define NUM_TERMINAL_ROWS    25
 
 // void terminal_init();
 
+#define VT_MAX_PARAMS   8
+
+/*
+ * VT100 escape sequences written to a terminal (see putbuf): the one being
+ * parsed and the state the others set
+ */
+typedef struct vt_state_t {
+    uint8_t state;              // VT_NORMAL, VT_ESC or VT_CSI (lib.c)
+    uint8_t private;            // a "?" sequence, parsed and ignored
+    int32_t nparams;
+    int32_t params[VT_MAX_PARAMS];
+    uint8_t sgr;                // colors set: foreground bits 0-3 (3 is bold), background 4-6, reverse 7
+    uint8_t attrib;             // VGA attribute of the cells written, from sgr
+    int32_t top;                // scroll region, rows top to bottom
+    int32_t bottom;
+    int32_t saved_x;            // cursor and colors saved by ESC 7 or CSI s
+    int32_t saved_y;
+    uint8_t saved_sgr;
+} vt_state_t;
+
+/* Keyboard input of a terminal waiting to be read */
+typedef struct input_ring_t {
+    uint8_t  buf[INPUT_RING_SIZE];
+    uint32_t head;              // next byte read, both free running
+    uint32_t tail;              // next byte typed
+    int32_t  lines;             // line feeds in it
+} input_ring_t;
+
+/*
+ * Output of a terminal in screen cells, also the buffer layout of the
+ * termstat system call
+ */
+typedef struct term_stats_t {
+    uint32_t cells_immediate;   // drawn on the screen as they were written
+    uint32_t cells_deferred;    // only stored into the buffer, the screen being hidden
+    uint32_t redraws;           // hidden screens drawn again from the buffer when shown
+} term_stats_t;
+
 //open the terminal
-extern int32_t terminal_open(const uint8_t* filename);
+extern int32_t terminal_open(const uint8_t* filename, int32_t fd);
 //close the terminal
 extern int32_t terminal_close(int32_t fd);
 //read function
 extern int32_t terminal_read(int32_t fd, void* buf, int32_t n);
+//read function waiting until a deadline at most
+extern int32_t terminal_read_until(int32_t fd, void* buf, int32_t n, uint64_t deadline);
+//poll op
+extern int32_t terminal_poll(int32_t fd, int32_t wait);
 //write function
 extern int32_t terminal_write(int32_t fd, const void* buf, int32_t n);
 //handle different input
 extern void terminal_handler(uint8_t curr_ascii_code);
 
-int32_t get_enter_flag();
-
-int32_t get_curr_string_len();
-
-uint8_t* get_keyboard_buffer();
-
 int32_t get_halt_flag(int32_t terminal_id);
 
-void set_enter_flag(int32_t enter_flag_n);
-
-void set_curr_string_len(int32_t curr_string_len_n);
+void clear_halt_flag(int32_t terminal_id);
 
-void set_keyboard_buffer(uint8_t* keyboard_buffer_n);
+/* The termstat system call, copy the output counters of a terminal */
+int32_t termstat(int32_t tid, term_stats_t* buf);
 
-void clear_halt_flag(int32_t terminal_id);
+/* The ttymode system call, TTY_CANONICAL or TTY_RAW input for the terminal of the caller */
+int32_t ttymode(int32_t mode);
 
 extern file_op_table_t terminal_op_table;
 #endif /* TERMINAL_H */
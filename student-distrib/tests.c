@@ -137,6 +137,14 @@ int page_test() {
 			}
 		}
 
+		/* Local APIC and IOAPIC registers */
+		else if (i == (mp_info.lapic_base >> 22) || i == (mp_info.ioapic_base >> 22)) {
+			if (mp_info.nr_cpus != 0 && !pd[i].pde_4m.pcd) {
+				result = FAIL;
+				printf("APIC page cached\n");
+			}
+		}
+
 		/* Other pages */
 		else {
 			if (pd[i].pde_table.present) {
@@ -156,6 +164,11 @@ int page_test() {
 			}
 		}
 
+		/* AP trampoline */
+		else if (i == (AP_TRAMPOLINE_ADDR >> 12)) {
+			continue;
+		}
+
 		/* Other pages */
 		else {
 			if (pt_video[i].present) {
@@ -233,20 +246,22 @@ void divide_by_zero() {
 }
 
 /* Checkpoint 2 tests */
+
+/* fd the rtc tests open the rtc as, the rtc keeps a virtual RTC per fd */
+#define TEST_RTC_FD	2
 /* 
  * rtc_open_close_test()
  * 	DESCRIPTION:
- * 		firts initial the rtc, and call the open & close function. Open will set freq to 2.
+ * 		call the open & close function. Open will set freq to 2.
  * 	INPUTS: none
  *  OUTPUTS: none
- *  SIDE EFFECTS: print freq 2 on the screen.
+ *  SIDE EFFECTS: none
  */
 int rtc_open_close_test(){
 	int ret = 0;
 	TEST_HEADER;
-	rtc_init();
-	ret += rtc_open(NULL);
-	ret += rtc_close(NULL);
+	ret += rtc_open(NULL, TEST_RTC_FD);
+	ret += rtc_close(TEST_RTC_FD);
 	if(ret == 0){
 		ret = PASS;
 	}else{
@@ -257,16 +272,18 @@ int rtc_open_close_test(){
 /* 
  * rtc_read_test()
  * 	DESCRIPTION:
- * 		firts initial the rtc, then call rtc_read to wait for next interrupt.
+ * 		open the rtc, then call rtc_read to wait for next interrupt.
  * 	INPUTS: none
  *  OUTPUTS: none
  *  SIDE EFFECTS: none
  */
 int rtc_read_test(){
 	int ret;
-	rtc_init();
+	TEST_HEADER;
+	ret = rtc_open(NULL, TEST_RTC_FD);
 	printf("Wait for new interrupt\n");
-	ret = rtc_read(NULL,NULL,NULL);
+	ret += rtc_read(TEST_RTC_FD, NULL,NULL);
+	ret += rtc_close(TEST_RTC_FD);
 	printf("\n");
 	printf("New interrupt has come");
 	if(ret == 0){
@@ -279,24 +296,26 @@ int rtc_read_test(){
 /* 
  * rtc_write_test()
  * 	DESCRIPTION:
- * 		set the freq of RTC.
+ * 		open the rtc and set its freq from 2 to 1024, reading a second
+ * 		worth of interrupts at each.
  * 	INPUTS: none
  *  OUTPUTS: none
  *  SIDE EFFECTS: none
  */
 int rtc_write_test(){
-	rtc_init();
-	int ret = 0;
+	int ret;
 	int freq;
 	int j;
+	TEST_HEADER;
+	ret = rtc_open(NULL, TEST_RTC_FD);
 	for(freq = 2;freq <= 1024; freq = freq *2){
-		ret += rtc_write(NULL,&freq,NULL);
+		ret += rtc_write(TEST_RTC_FD, &freq,NULL);
 		for(j = 0; j < freq;j++){
-			ret += rtc_read(NULL,NULL,NULL);
+			ret += rtc_read(TEST_RTC_FD, NULL,NULL);
 		}
 		printf("\n");
 	}
-	rtc_init();
+	ret += rtc_close(TEST_RTC_FD);
 	if(ret == 0) {
 		return PASS;
 	} else {
@@ -304,6 +323,140 @@ int rtc_write_test(){
 	}
 }
 
+/* state shared with rtc_rate_partner */
+static volatile int rtc_partner_open;
+static volatile int rtc_partner_done;
+
+/* 
+ * rtc_rate_partner()
+ * 	DESCRIPTION:
+ * 		the second rtc handle of rtc_rate_test, open at 1024 HZ until it is told to close
+ */
+static void rtc_rate_partner(void* arg){
+	int freq = 1024;
+	rtc_open(NULL, TEST_RTC_FD);
+	rtc_write(TEST_RTC_FD, &freq, NULL);
+	rtc_partner_open = 1;
+	while (!rtc_partner_done) {
+		rtc_read(TEST_RTC_FD, NULL, NULL);
+	}
+	rtc_close(TEST_RTC_FD);
+	rtc_partner_open = 0;
+}
+
+/* 
+ * rtc_hw_rate()
+ * 	DESCRIPTION:
+ * 		the rate in register A the RTC runs at
+ */
+static int8_t rtc_hw_rate(){
+	uint32_t flags;
+	int8_t rate;
+	cli_and_save(flags);
+	rate = rtc_get_reg(REG_A) & 0x0F;
+	restore_flags(flags);
+	return rate;
+}
+
+/* 
+ * rtc_rate_test()
+ * 	DESCRIPTION:
+ * 		The RTC runs at the rate of the fastest open handle. This one asks
+ * 		for 8 HZ, a kernel thread opens another one at 1024 HZ and closes it
+ * 		again. Once the last handle is closed the IRQ must be masked.
+ * 	INPUTS: none
+ *  OUTPUTS: PASS/FAIL
+ *  SIDE EFFECTS: none
+ */
+int rtc_rate_test(){
+	TEST_HEADER;
+
+	int result = PASS;
+	int freq = 8;
+
+	rtc_partner_open = rtc_partner_done = 0;
+	rtc_open(NULL, TEST_RTC_FD);
+	rtc_write(TEST_RTC_FD, &freq, NULL);
+	if (rtc_hw_rate() != get_rate(8) || irq_masked(RTC_IRQ_NUM)) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	if (kthread_create(rtc_rate_partner, NULL, "rtc_rate") == NULL) {
+		rtc_close(TEST_RTC_FD);
+		return FAIL;
+	}
+	while (!rtc_partner_open) {
+		rtc_read(TEST_RTC_FD, NULL, NULL);
+	}
+	if (rtc_hw_rate() != get_rate(1024)) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	rtc_partner_done = 1;
+	while (rtc_partner_open) {
+		rtc_read(TEST_RTC_FD, NULL, NULL);
+	}
+	if (rtc_hw_rate() != get_rate(8) || irq_masked(RTC_IRQ_NUM)) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	rtc_close(TEST_RTC_FD);
+	if (!irq_masked(RTC_IRQ_NUM)) {
+		assertion_failure();
+		result = FAIL;
+	}
+	return result;
+}
+
+/* 
+ * rtc_fd_test()
+ * 	DESCRIPTION:
+ * 		Two rtc fds of one task tick on their own. Opening the second one
+ * 		leaves the first at its frequency, closing the first leaves the
+ * 		second ticking, and a closed fd fails to read instead of sleeping.
+ * 	INPUTS: none
+ *  OUTPUTS: PASS/FAIL
+ *  SIDE EFFECTS: none
+ */
+int rtc_fd_test(){
+	TEST_HEADER;
+
+	int result = PASS;
+	int freq = 1024;
+	int i;
+
+	if (rtc_open(NULL, TEST_RTC_FD) != 0 || rtc_write(TEST_RTC_FD, &freq, 4) != 0 ||
+		rtc_open(NULL, TEST_RTC_FD + 1) != 0) {
+		assertion_failure();
+		result = FAIL;
+	}
+	/* the first fd stays at 1024 HZ, and so does the RTC */
+	if (rtc_hw_rate() != get_rate(1024)) {
+		assertion_failure();
+		result = FAIL;
+	}
+	rtc_close(TEST_RTC_FD);
+	if (rtc_read(TEST_RTC_FD, NULL, 0) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+	for (i = 0; i < 2; i++) {
+		if (rtc_read(TEST_RTC_FD + 1, NULL, 0) != 0) {
+			assertion_failure();
+			result = FAIL;
+		}
+	}
+	rtc_close(TEST_RTC_FD + 1);
+	if (!irq_masked(RTC_IRQ_NUM)) {
+		assertion_failure();
+		result = FAIL;
+	}
+	return result;
+}
+
 /*
  * fs_dir_test
  * 	DESCRIPTION:
@@ -321,7 +474,7 @@ int fs_dir_test(int8_t* dirname) {
 	printf("**** Reading %s ****\n", dirname);
 
 	/* test directory open */
-	if (dir_open((uint8_t*) dirname) == -1) {
+	if (dir_open((uint8_t*) dirname, 0) == -1) {
 		printf("Open Dir Failed\n");
 		return FAIL;
 	}
@@ -367,7 +520,7 @@ int fs_file_test(int8_t* filename) {
 	printf("\n****** FILE READ TEST ******\n");
 	printf("**** Reading %s ****\n", filename);
 	/* test read file */
-	if (file_open((uint8_t*) filename)) {
+	if (file_open((uint8_t*) filename, 0)) {
 		printf("Open File Failed\n");
 		return FAIL;
 	}
@@ -402,7 +555,7 @@ int fs_file_test(int8_t* filename) {
  */
 void terminal_test(){
 	int32_t i = 0;	
-	terminal_open(NULL);
+	terminal_open(NULL, 0);
 	printf("####### TERMINAL OPENED! #######\n ");
 	while(i < 10){
 		printf("\n####### NOW TEST TERMINAL READ #######\n ");
@@ -585,6 +738,264 @@ int execute_test(){
 /* Checkpoint 4 tests */
 /* Checkpoint 5 tests */
 
+static scrollback_t test_scrollback;
+
+/* 
+ * scrollback_test_row()
+ * 	DESCRIPTION:
+ * 		fill the cells of the row pushed as line n. Even lines (all of them
+ * 		if full is set) are full, 80 characters in runs of 10 with their own
+ * 		attribute, odd lines are short, a few characters in two colors and
+ * 		blanks in a third.
+ */
+static void scrollback_test_row(int32_t n, int32_t full, uint8_t* row){
+	int32_t x;
+	for (x = 0; x < NUM_COLS; x++) {
+		if (full || n % 2 == 0) {
+			row[x << 1] = 'A' + (n + x) % 26;
+			row[(x << 1) + 1] = 0x10 * (x / 10) + (n & 0x0F);
+		} else if (x < 6) {
+			row[x << 1] = '0' + (n + x) % 10;
+			row[(x << 1) + 1] = (x < 3) ? 0x07 : 0x4E;
+		} else {
+			row[x << 1] = ' ';
+			row[(x << 1) + 1] = 0x1F;
+		}
+	}
+}
+
+/* 
+ * scrollback_test_check()
+ * 	DESCRIPTION:
+ * 		read lines first to last - 1 back from test_scrollback, they must
+ * 		be the rows pushed (see scrollback_test_row). The lines just outside
+ * 		must not be kept.
+ * 	RETURN VALUES: PASS/FAIL
+ */
+static int scrollback_test_check(int32_t first, int32_t last, int32_t full){
+	uint8_t row[NUM_COLS * 2];
+	uint8_t expect[NUM_COLS * 2];
+	int32_t n, i;
+
+	if (test_scrollback.first != first || test_scrollback.count != last - first) {
+		return FAIL;
+	}
+	for (n = first; n < last; n++) {
+		scrollback_test_row(n, full, expect);
+		if (scrollback_get(&test_scrollback, n, row) != 0) {
+			return FAIL;
+		}
+		for (i = 0; i < NUM_COLS * 2; i++) {
+			if (row[i] != expect[i]) {
+				return FAIL;
+			}
+		}
+	}
+	if (scrollback_get(&test_scrollback, first - 1, row) != -1 ||
+		scrollback_get(&test_scrollback, last, row) != -1) {
+		return FAIL;
+	}
+	return PASS;
+}
+
+/* 
+ * scrollback_test()
+ * 	DESCRIPTION:
+ * 		Push known rows into a scrollback and read them back: full rows of
+ * 		several attribute runs and short ones. The oldest lines must go
+ * 		once scrollback_depth lines are kept, and once the records fill
+ * 		SCROLLBACK_BYTES (a full row of 8 runs takes 99 bytes).
+ * 	INPUTS: none
+ *  OUTPUTS: PASS/FAIL
+ *  SIDE EFFECTS: scrollback_depth is changed for the test and set back
+ */
+int scrollback_test(){
+	TEST_HEADER;
+
+	uint8_t row[NUM_COLS * 2];
+	int32_t depth = scrollback_depth;
+	int32_t n, kept;
+	int result = PASS;
+
+	/* a few lines, all kept */
+	scrollback_depth = SCROLLBACK_MAX_LINES;
+	scrollback_clear(&test_scrollback, 0);
+	for (n = 0; n < 20; n++) {
+		scrollback_test_row(n, 0, row);
+		scrollback_push(&test_scrollback, row);
+	}
+	if (scrollback_test_check(0, 20, 0) != PASS) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	/* at the depth the oldest lines go */
+	scrollback_depth = 8;
+	scrollback_clear(&test_scrollback, 100);
+	for (n = 100; n < 125; n++) {
+		scrollback_test_row(n, 0, row);
+		scrollback_push(&test_scrollback, row);
+	}
+	if (scrollback_test_check(117, 125, 0) != PASS) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	/* full rows only, the bytes run out long before the depth */
+	scrollback_depth = SCROLLBACK_MAX_LINES;
+	scrollback_clear(&test_scrollback, 0);
+	kept = SCROLLBACK_BYTES / (3 + 2 * 8 + NUM_COLS);
+	for (n = 0; n < 2 * kept + 5; n++) {
+		scrollback_test_row(n, 1, row);
+		scrollback_push(&test_scrollback, row);
+	}
+	if (scrollback_test_check(kept + 5, 2 * kept + 5, 1) != PASS ||
+		test_scrollback.used > SCROLLBACK_BYTES) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	scrollback_depth = depth;
+	return result;
+}
+
+#define PUTBUF_TEST_LINES	40
+
+static uint8_t putbuf_test_text[PUTBUF_TEST_LINES * 132];
+static uint8_t putbuf_test_screen[2][2 * SCREEN_BYTES];
+static int32_t putbuf_test_cursor[2][2];
+
+/* 
+ * putbuf_test_draw()
+ * 	DESCRIPTION:
+ * 		clear the screen, draw text on it with putc or with putbuf, and keep
+ * 		what the screen terminal holds: its rows in the buffer and in video
+ * 		memory, and the cursor
+ * 	INPUTS: text, n -- what to draw
+ * 		use_putbuf -- draw with putbuf instead of putc, also selects the snapshot
+ */
+static void putbuf_test_draw(const uint8_t* text, int32_t n, int32_t use_putbuf){
+	terminal_info_t* t = this_cpu()->screen;
+	uint8_t* snap = putbuf_test_screen[use_putbuf];
+	int32_t i, y;
+
+	clear();
+	init_cursor();
+	if (use_putbuf) {
+		putbuf(text, n);
+	} else {
+		for (i = 0; i < n; i++) {
+			putc(text[i]);
+		}
+	}
+	for (y = 0; y < NUM_ROWS; y++) {
+		memcpy(snap + y * ROW_BYTES,
+			t->buf_video_mem + ((t->current_show_y + y) % NUM_ROWS) * ROW_BYTES, ROW_BYTES);
+		memcpy(snap + SCREEN_BYTES + y * ROW_BYTES,
+			t->video_mem + (t->video_top + y) * ROW_BYTES, ROW_BYTES);
+	}
+	putbuf_test_cursor[use_putbuf][0] = t->screen_x;
+	putbuf_test_cursor[use_putbuf][1] = t->screen_y;
+}
+
+/* 
+ * putbuf_test()
+ * 	DESCRIPTION:
+ * 		putbuf must leave the screen exactly as putc does byte by byte. The
+ * 		text has empty lines, lines of exactly 80 characters, lines that
+ * 		wrap, carriage returns, and enough lines to scroll the screen.
+ * 	INPUTS: none
+ *  OUTPUTS: PASS/FAIL
+ *  SIDE EFFECTS: clear the screen
+ */
+int putbuf_test(){
+	TEST_HEADER;
+
+	int32_t n = 0;
+	int32_t line, x, len, i;
+	int result = PASS;
+
+	for (line = 0; line < PUTBUF_TEST_LINES; line++) {
+		len = (line * 37) % 131;
+		if (line % 5 == 0) {
+			len = NUM_COLS;
+		}
+		for (x = 0; x < len; x++) {
+			putbuf_test_text[n++] = 'a' + (line + x) % 26;
+		}
+		putbuf_test_text[n++] = (line % 7 == 3) ? '\r' : '\n';
+	}
+
+	putbuf_test_draw(putbuf_test_text, n, 0);
+	putbuf_test_draw(putbuf_test_text, n, 1);
+
+	for (i = 0; i < 2 * SCREEN_BYTES; i++) {
+		if (putbuf_test_screen[0][i] != putbuf_test_screen[1][i]) {
+			result = FAIL;
+			break;
+		}
+	}
+	if (putbuf_test_cursor[0][0] != putbuf_test_cursor[1][0] ||
+		putbuf_test_cursor[0][1] != putbuf_test_cursor[1][1]) {
+		result = FAIL;
+	}
+	if (result == FAIL) {
+		assertion_failure();
+	}
+	return result;
+}
+
+/* Benchmarks */
+#define SWITCH_BENCH_ROUNDS	10000
+
+static context_t bench_main_context;
+static context_t bench_partner_context;
+static uint32_t bench_partner_stack[1024];
+
+/* 
+ * switch_bench_partner()
+ * 	DESCRIPTION:
+ * 		the other side of switch_to_bench, bounces every switch straight back
+ */
+static void switch_bench_partner(){
+	while (1) {
+		switch_to(&bench_partner_context, &bench_main_context);
+	}
+}
+
+/* 
+ * switch_to_bench()
+ * 	DESCRIPTION:
+ * 		Measure the cost of switch_to in cycles. Two kernel contexts switch
+ * 		back and forth, so every round is two switches.
+ * 	INPUTS: none
+ *  OUTPUTS: PASS
+ *  SIDE EFFECTS: print the average cycles of one switch
+ */
+int switch_to_bench(){
+	TEST_HEADER;
+
+	int i;
+	uint32_t flags;
+	uint64_t start, end;
+
+	/* partner starts at its function entry, with a fake return address */
+	bench_partner_stack[1023] = 0;
+	bench_partner_context.esp = (uint32_t) &bench_partner_stack[1023];
+	bench_partner_context.eip = (uint32_t) switch_bench_partner;
+
+	cli_and_save(flags);
+	start = rdtsc();
+	for (i = 0; i < SWITCH_BENCH_ROUNDS; i++) {
+		switch_to(&bench_main_context, &bench_partner_context);
+	}
+	end = rdtsc();
+	restore_flags(flags);
+
+	printf("switch_to: %u cycles per switch\n", (uint32_t) (end - start) / (2 * SWITCH_BENCH_ROUNDS));
+	return PASS;
+}
+
 
 /* Test suite entry point */
 void launch_tests(){
@@ -612,7 +1023,14 @@ void launch_tests(){
 	// TEST_OUTPUT("fs_file_test: read directory", fs_file_test("."));
 
 	// TEST_OUTPUT("rtc_write_test",rtc_write_test());
+	// TEST_OUTPUT("rtc_rate_test",rtc_rate_test());
+	// TEST_OUTPUT("rtc_fd_test",rtc_fd_test());
+	// TEST_OUTPUT("scrollback_test",scrollback_test());
+	// TEST_OUTPUT("putbuf_test",putbuf_test());
 
 	/* checkpoint 3 tests */
 	// TEST_OUTPUT("syscall file op test:", syscall_file_op_test());
+
+	/* benchmarks */
+	// TEST_OUTPUT("switch_to_bench", switch_to_bench());
 }
@@ -10,6 +10,10 @@
 #include "task.h"
 #include "keyboard.h"
 #include "terminal.h"
+#include "kthread.h"
+#include "i8259.h"
+#include "scrollback.h"
+#include "scheduler.h"
 
 // test launcher
 void launch_tests();
@@ -0,0 +1,29 @@
+#include "vdso.h"
+
+#include "clock.h"
+#include "x86_desc.h"
+
+/* the whole page is readable by user programs, nothing else may share it */
+static union {
+    vdso_data_t data;
+    uint8_t page[SIZE_PT];
+} vdso_page __attribute__((aligned(SIZE_PT)));
+
+vdso_data_t* const vdso = &vdso_page.data;
+
+/* 
+ *  vdso_init
+ *  DESCRIPTION: copy the TSC calibration into the shared page, so that
+ *               user programs compute clock_ns the same way as the kernel
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ *  SIDE EFFECTS: must run before the first program starts
+ */
+void vdso_init(void)
+{
+    vdso->tsc_khz = tsc_khz;
+    vdso->clock_mult = clock_mult;
+    vdso->clock_shift = CLOCK_SHIFT;
+    vdso->tsc_base = tsc_base;
+}
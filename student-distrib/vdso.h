@@ -0,0 +1,33 @@
+#ifndef _VDSO_H
+#define _VDSO_H
+
+#include "types.h"
+#include "page.h"
+
+/* The page sits right after the vidmap page, in the same user page table */
+#define VDSO_INDEX          1
+#define VDSO_ADDR           (USER_VIDEO + (VDSO_INDEX << 12))
+
+/*
+ * Kernel data every process can read at VDSO_ADDR without a system call
+ * (mirrored in syscalls/ece391support.h). Each field is one aligned word
+ * stored at once, and the clock scale never changes after boot, so a
+ * reader needs no lock.
+ */
+typedef struct vdso_data_t {
+    volatile uint32_t ticks;            // timer ticks of CPU 0 since boot
+    volatile uint32_t tick_hz;          // current timer frequency
+    volatile int32_t active_terminal;   // terminal on the screen
+    uint32_t tsc_khz;                   // see clock.h
+    uint32_t clock_mult;                // ns = (tsc - tsc_base) * clock_mult >> clock_shift
+    uint32_t clock_shift;
+    uint64_t tsc_base;
+} vdso_data_t;
+
+/* The page itself, mapped read-only in user space */
+extern vdso_data_t* const vdso;
+
+/* Publish the clock scale, after clock_init */
+void vdso_init(void);
+
+#endif /* _VDSO_H */
@@ -0,0 +1,124 @@
+#include "workqueue.h"
+
+#include "kthread.h"
+#include "scheduler.h"
+
+workqueue_t system_wq;
+
+/*
+ *  worker_thread
+ *  DESCRIPTION: body of the worker of a queue, run the jobs one at a time
+ *               and sleep while there is none
+ *  INPUTS: arg -- the workqueue_t served
+ *  OUTPUTS: none
+ *  RETURN VALUE: never returns
+ */
+static void worker_thread(void* arg)
+{
+    workqueue_t* wq = (workqueue_t*) arg;
+    work_t* work;
+    uint32_t flags;
+
+    while (1) {
+        sleep_until(&wq->nr_pending);
+
+        spin_lock_irqsave(&wq->lock, flags);
+        work = wq->head;
+        wq->head = work->next;
+        if (wq->head == NULL) {
+            wq->tail = NULL;
+        }
+        wq->nr_pending--;
+        // the job may queue itself again once it has started
+        work->next = NULL;
+        work->pending = 0;
+        spin_unlock_irqrestore(&wq->lock, flags);
+
+        work->func(work);
+    }
+}
+
+/*
+ *  workqueue_create
+ *  DESCRIPTION: set up an empty queue and start its worker thread
+ *  INPUTS: wq -- queue to set up, before anyone queues work on it
+ *          name -- name of the worker thread and of the queue lock
+ *  OUTPUTS: none
+ *  RETURN VALUE: 0 on success, -1 if no pid is left
+ */
+int32_t workqueue_create(workqueue_t* wq, const int8_t* name)
+{
+    pcb_t* worker;
+
+    spin_lock_init(&wq->lock, name);
+    wq->head = NULL;
+    wq->tail = NULL;
+    wq->nr_pending = 0;
+
+    worker = kthread_create(worker_thread, wq, name);
+    if (worker == NULL) {
+        wq->worker_pid = -1;
+        return -1;
+    }
+    wq->worker_pid = worker->pid;
+    return 0;
+}
+
+/*
+ *  queue_work
+ *  DESCRIPTION: append a job to a queue and wake up its worker, also from
+ *               an interrupt handler
+ *  INPUTS: wq -- queue, work -- job, left alone if it is queued already
+ *  OUTPUTS: none
+ *  RETURN VALUE: 1 if the job was queued, 0 if it already was
+ */
+int32_t queue_work(workqueue_t* wq, work_t* work)
+{
+    uint32_t flags;
+
+    spin_lock_irqsave(&wq->lock, flags);
+    if (work->pending) {
+        spin_unlock_irqrestore(&wq->lock, flags);
+        return 0;
+    }
+    work->pending = 1;
+    work->next = NULL;
+    if (wq->tail == NULL) {
+        wq->head = work;
+    } else {
+        wq->tail->next = work;
+    }
+    wq->tail = work;
+    wq->nr_pending++;
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    // nr_pending is set before sched_lock is taken, see sleep_until
+    task_wake(wq->worker_pid);
+    return 1;
+}
+
+/*
+ *  schedule_work
+ *  DESCRIPTION: queue a job on the system workqueue
+ *  INPUTS: work -- job
+ *  OUTPUTS: none
+ *  RETURN VALUE: 1 if the job was queued, 0 if it already was
+ */
+int32_t schedule_work(work_t* work)
+{
+    return queue_work(&system_wq, work);
+}
+
+/*
+ *  workqueue_init
+ *  DESCRIPTION: start the system workqueue, its worker is the first task
+ *  INPUTS: none
+ *  OUTPUTS: none
+ *  RETURN VALUE: none
+ */
+void workqueue_init(void)
+{
+    if (workqueue_create(&system_wq, "kworker") == -1) {
+        printf("Cannot start kworker!\n");
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H
+
+#include "types.h"
+#include "lib.h"
+#include "spinlock.h"
+
+/*
+ * Work deferred to a kernel thread. Unlike a tasklet, a work function runs
+ * in a task: it may sleep, take any lock and be preempted, and it only
+ * gets the CPU when no task of higher rank wants it.
+ */
+typedef struct work_t {
+    struct work_t* next;
+    void (*func)(struct work_t* work);
+    volatile int32_t pending;           // queued and not started yet
+} work_t;
+
+/* Jobs run in order by one worker thread */
+typedef struct workqueue_t {
+    spinlock_t lock;                    // the list, taken with interrupts off
+    work_t* head;
+    work_t* tail;
+    volatile int32_t nr_pending;        // jobs on the list, the worker sleeps on it
+    int32_t worker_pid;
+} workqueue_t;
+
+#define DECLARE_WORK(name, fn) \
+    work_t name = {.next = NULL, .func = fn, .pending = 0}
+
+/* Queue of the jobs without a queue of their own, run by "kworker" */
+extern workqueue_t system_wq;
+
+/* Start the worker thread of a queue, -1 if no pid is left */
+int32_t workqueue_create(workqueue_t* wq, const int8_t* name);
+
+/* Queue a job, 0 if it is queued already (it then runs once), 1 otherwise */
+int32_t queue_work(workqueue_t* wq, work_t* work);
+
+/* queue_work on system_wq */
+int32_t schedule_work(work_t* work);
+
+/* Start system_wq, after the scheduler and before the first task */
+void workqueue_init(void);
+
+#endif /* _WORKQUEUE_H */
@@ -0,0 +1,48 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define NR_IRQ_LINES 16
+#define NUM_WIDTH    9
+
+/* print value right-aligned in a field of width columns */
+static void
+put_num (uint32_t value, int32_t width)
+{
+    uint8_t buf[12];
+    int32_t len;
+
+    ece391_itoa (value, buf, 10);
+    for (len = ece391_strlen (buf); len < width; len++)
+	ece391_fdputs (1, (uint8_t*)" ");
+    ece391_fdputs (1, buf);
+}
+
+/*
+ * irqstat
+ *   Print, for each IRQ line that fired, the time spent in its interrupt
+ *   handler (top half) and in its tasklets (bottom half), in TSC cycles
+ *   (totals in units of 1024 cycles).
+ */
+int main ()
+{
+    irq_stats_t st;
+    int32_t irq;
+
+    ece391_fdputs (1, (uint8_t*)"IRQ      TOP TOP(kc)  TOP MAX   BOTTOM BOT(kc)  BOT MAX  DROPPED\n");
+    for (irq = 0; irq < NR_IRQ_LINES; irq++) {
+	if (0 != ece391_irqstat (irq, &st) || (st.top_count == 0 && st.bottom_count == 0))
+	    continue;
+	put_num (irq, 3);
+	put_num (st.top_count, NUM_WIDTH);
+	put_num (st.top_kcycles, 8);
+	put_num (st.top_max, NUM_WIDTH);
+	put_num (st.bottom_count, NUM_WIDTH);
+	put_num (st.bottom_kcycles, 8);
+	put_num (st.bottom_max, NUM_WIDTH);
+	put_num (st.dropped, NUM_WIDTH);
+	ece391_fdputs (1, (uint8_t*)"\n");
+    }
+    return 0;
+}
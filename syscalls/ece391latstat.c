@@ -0,0 +1,63 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE   16
+#define NUM_WIDTH 9
+
+/* print value right-aligned in a field of width columns */
+static void
+put_num (uint32_t value, int32_t width, int32_t radix)
+{
+    uint8_t buf[12];
+    int32_t len;
+
+    ece391_itoa (value, buf, radix);
+    for (len = ece391_strlen (buf); len < width; len++)
+	ece391_fdputs (1, (uint8_t*)" ");
+    ece391_fdputs (1, buf);
+}
+
+/*
+ * latstat [reset]
+ *   Print, for each CPU, the longest section with interrupts off, the
+ *   longest with kernel preemption off (both with the kernel address that
+ *   began it) and the longest wait of a woken task for the CPU, in
+ *   microseconds. "reset" starts measuring again afterwards.
+ */
+int main ()
+{
+    const vdso_data_t* vdso = (const vdso_data_t*)ECE391_VDSO_ADDR;
+    uint8_t buf[BUFSIZE];
+    latency_stats_t st;
+    uint32_t tsc_mhz;
+    int32_t reset = 0;
+    int32_t cpu;
+
+    if (0 == ece391_getargs (buf, BUFSIZE)) {
+	if (0 != ece391_strcmp (buf, (uint8_t*)"reset")) {
+	    ece391_fdputs (1, (uint8_t*)"usage: latstat [reset]\n");
+	    return 3;
+	}
+	reset = 1;
+    }
+
+    tsc_mhz = vdso->tsc_khz / 1000;
+    if (tsc_mhz == 0)
+	tsc_mhz = 1;
+
+    ece391_fdputs (1, (uint8_t*)"CPU IRQSOFF(us)      AT PREEMPTOFF(us)      AT WAKEUP(us) PID\n");
+    for (cpu = 0; 0 == ece391_latstat (cpu, &st, reset); cpu++) {
+	put_num (cpu, 3, 10);
+	put_num (st.irqsoff_max / tsc_mhz, 12, 10);
+	put_num (st.irqsoff_ip, NUM_WIDTH, 16);
+	put_num (st.preemptoff_max / tsc_mhz, 15, 10);
+	put_num (st.preemptoff_ip, NUM_WIDTH, 16);
+	put_num (st.wakeup_max / tsc_mhz, 11, 10);
+	if (st.wakeup_max != 0)
+	    put_num (st.wakeup_pid, 4, 10);
+	ece391_fdputs (1, (uint8_t*)"\n");
+    }
+    return 0;
+}
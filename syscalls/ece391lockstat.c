@@ -0,0 +1,56 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define NAME_WIDTH  16
+#define NUM_WIDTH   10
+
+/* print s followed by spaces up to width columns */
+static void
+put_padded (const uint8_t* s, int32_t width)
+{
+    int32_t len = ece391_strlen (s);
+
+    ece391_fdputs (1, s);
+    while (len++ < width)
+	ece391_fdputs (1, (uint8_t*)" ");
+}
+
+/* print value right-aligned in a field of width columns */
+static void
+put_num (uint32_t value, int32_t width)
+{
+    uint8_t buf[12];
+    int32_t len;
+
+    ece391_itoa (value, buf, 10);
+    for (len = ece391_strlen (buf); len < width; len++)
+	ece391_fdputs (1, (uint8_t*)" ");
+    ece391_fdputs (1, buf);
+}
+
+/*
+ * lockstat
+ *   Print how often each kernel lock was taken, how often a CPU had to
+ *   spin for it, and how long it was waited for and held (in TSC cycles,
+ *   totals in units of 1024 cycles).
+ */
+int main ()
+{
+    lock_stats_t st;
+    int32_t i;
+
+    ece391_fdputs (1, (uint8_t*)"LOCK              ACQUIRED CONTENDED  WAIT(kc)  HOLD(kc)  MAX WAIT  MAX HOLD\n");
+    for (i = 0; 0 == ece391_lockstat (i, &st); i++) {
+	put_padded (st.name, NAME_WIDTH);
+	put_num (st.acquired, NUM_WIDTH);
+	put_num (st.contended, NUM_WIDTH);
+	put_num (st.wait_kcycles, NUM_WIDTH);
+	put_num (st.hold_kcycles, NUM_WIDTH);
+	put_num (st.max_wait, NUM_WIDTH);
+	put_num (st.max_hold, NUM_WIDTH);
+	ece391_fdputs (1, (uint8_t*)"\n");
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 128
+
+/*
+ * rt <priority> <command>
+ *   Run a command in the real-time scheduling class, e.g. "rt 50 pingpong".
+ *   Priority 0 runs it as a normal task again.
+ */
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    int32_t priority = 0;
+    int32_t i = 0;
+    int32_t rval;
+
+    if (0 != ece391_getargs (buf, BUFSIZE)) {
+        ece391_fdputs (1, (uint8_t*)"usage: rt <priority> <command>\n");
+	return 3;
+    }
+
+    while (buf[i] >= '0' && buf[i] <= '9')
+	priority = priority * 10 + (buf[i++] - '0');
+    if (i == 0 || buf[i] != ' ') {
+        ece391_fdputs (1, (uint8_t*)"usage: rt <priority> <command>\n");
+	return 3;
+    }
+    while (buf[i] == ' ')
+	i++;
+
+    if (0 == priority)
+	rval = ece391_setsched (SCHED_NORMAL, 0);
+    else
+	rval = ece391_setsched (SCHED_RT, priority);
+    if (-1 == rval) {
+        ece391_fdputs (1, (uint8_t*)"rt: invalid priority\n");
+	return 2;
+    }
+
+    /* the command inherits our scheduling class */
+    rval = ece391_execute (buf + i);
+    if (-1 == rval) {
+        ece391_fdputs (1, (uint8_t*)"no such command\n");
+	return 1;
+    }
+    return rval;
+}
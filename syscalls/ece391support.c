@@ -102,3 +102,37 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+
+/* Monotonic nanoseconds since boot, as the gettime system call */
+uint64_t ece391_clock_ns(void)
+{
+    const vdso_data_t* vdso = (const vdso_data_t*)ECE391_VDSO_ADDR;
+    uint64_t cycles;
+    uint32_t low, high;
+
+    asm volatile ("rdtsc" : "=A" (cycles));
+    cycles -= vdso->tsc_base;
+    low = (uint32_t)cycles;
+    high = (uint32_t)(cycles >> 32);
+    /* 96 bit product of the cycles and the scale, as the kernel does */
+    return (((uint64_t)low * vdso->clock_mult) >> vdso->clock_shift) +
+	   (((uint64_t)high * vdso->clock_mult) << (32 - vdso->clock_shift));
+}
+
+/* Timer ticks since boot */
+uint32_t ece391_ticks(void)
+{
+    return ((const vdso_data_t*)ECE391_VDSO_ADDR)->ticks;
+}
+
+/* Timer ticks per second */
+uint32_t ece391_tick_hz(void)
+{
+    return ((const vdso_data_t*)ECE391_VDSO_ADDR)->tick_hz;
+}
+
+/* Terminal shown on the screen */
+int32_t ece391_active_terminal(void)
+{
+    return ((const vdso_data_t*)ECE391_VDSO_ADDR)->active_terminal;
+}
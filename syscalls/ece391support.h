@@ -9,5 +9,24 @@ extern int32_t ece391_strncmp(const uint8_t* s1, const uint8_t* s2, uint32_t n);
 extern uint8_t *ece391_itoa(uint32_t value, uint8_t* buf, int32_t radix);
 extern uint8_t *ece391_strrev(uint8_t* s);
 
+/* kernel data page mapped read-only in every program (see vdso.h in the kernel) */
+#define ECE391_VDSO_ADDR 0x08401000
+
+typedef struct vdso_data_t {
+	volatile uint32_t ticks;
+	volatile uint32_t tick_hz;
+	volatile int32_t active_terminal;
+	uint32_t tsc_khz;
+	uint32_t clock_mult;
+	uint32_t clock_shift;
+	uint64_t tsc_base;
+} vdso_data_t;
+
+/* the same values as the system calls, read from the page without a trap */
+extern uint64_t ece391_clock_ns(void);
+extern uint32_t ece391_ticks(void);
+extern uint32_t ece391_tick_hz(void);
+extern int32_t ece391_active_terminal(void);
+
 #endif /* ECE391SUPPORT_H */
 
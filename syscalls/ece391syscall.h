@@ -21,6 +21,128 @@ extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
+/* give up the rest of the time slice, to anyone or to the given pid */
+extern int32_t ece391_yield (void);
+extern int32_t ece391_handoff (int32_t pid);
+
+#define SCHED_NORMAL 0
+#define SCHED_RT 1
+#define RT_PRIO_MIN 1
+#define RT_PRIO_MAX 99
+#define RT_HIST_BUCKETS 8
+
+/* CPU accounting of a task, pid -1 describes the idle CPU */
+typedef struct task_stats_t {
+	int32_t pid;
+	int32_t parent_pid;
+	int32_t terminal_id;
+	int32_t state;
+	uint32_t user_ticks;
+	uint32_t kernel_ticks;
+	uint32_t nr_switches;
+	uint32_t nr_voluntary;
+	uint32_t nr_forced;
+	uint32_t nr_syscalls;
+	int32_t policy;
+	int32_t rt_priority;
+	/* rtc_read latency, bucket i counts 2^(i-1) to 2^i - 1 RTC ticks (~1ms) */
+	uint32_t rt_latency[RT_HIST_BUCKETS];
+	uint32_t rt_misses;
+	uint32_t slice_granted;	/* ticks of the time slices handed to the task */
+	uint32_t slice_used;	/* ticks of them it ran before giving up the CPU */
+	uint8_t name[32];
+} task_stats_t;
+
+extern int32_t ece391_getstats (int32_t pid, task_stats_t* buf);
+/* scheduling class of the caller, inherited by the programs it executes */
+extern int32_t ece391_setsched (int32_t policy, int32_t priority);
+/* PIT frequency and time slice in ticks of all tasks, 0 keeps a value */
+extern int32_t ece391_settimer (int32_t hz, int32_t quantum);
+
+/* hold time and contention of a kernel lock, times in TSC cycles */
+typedef struct lock_stats_t {
+	uint32_t acquired;
+	uint32_t contended;
+	uint32_t wait_kcycles;	/* total spinning, in units of 1024 cycles */
+	uint32_t hold_kcycles;	/* total holding, in units of 1024 cycles */
+	uint32_t max_wait;
+	uint32_t max_hold;
+	uint8_t name[16];
+} lock_stats_t;
+
+/* statistics of kernel lock number index, -1 past the last lock */
+extern int32_t ece391_lockstat (int32_t index, lock_stats_t* buf);
+
+/* monotonic nanoseconds since boot, read from the TSC */
+extern int32_t ece391_gettime (uint64_t* ns);
+
+/* time spent in the interrupt handler (top) and the tasklets (bottom) of an IRQ */
+typedef struct irq_stats_t {
+	uint32_t top_count;
+	uint32_t top_kcycles;	/* total, in units of 1024 cycles */
+	uint32_t top_max;
+	uint32_t bottom_count;
+	uint32_t bottom_kcycles;
+	uint32_t bottom_max;
+	uint32_t dropped;	/* events lost before the bottom half caught up */
+} irq_stats_t;
+
+/* statistics of IRQ line irq (0 to 15) */
+extern int32_t ece391_irqstat (int32_t irq, irq_stats_t* buf);
+
+/* worst cases of a CPU, times in TSC cycles */
+typedef struct latency_stats_t {
+	uint32_t irqsoff_max;	/* longest stretch with interrupts off */
+	uint32_t irqsoff_ip;	/* kernel code that turned them off */
+	uint32_t preemptoff_max;	/* longest stretch the kernel could not be preempted */
+	uint32_t preemptoff_ip;
+	uint32_t wakeup_max;	/* longest wait of a woken task for the CPU */
+	int32_t wakeup_pid;
+} latency_stats_t;
+
+/* worst cases of CPU cpu, -1 past the last CPU; reset clears them afterwards */
+extern int32_t ece391_latstat (int32_t cpu, latency_stats_t* buf, int32_t reset);
+
+/* output of a terminal in screen cells */
+typedef struct term_stats_t {
+	uint32_t cells_immediate;	/* drawn as they were written */
+	uint32_t cells_deferred;	/* only buffered, the terminal being hidden */
+	uint32_t redraws;	/* hidden screens drawn again when shown */
+} term_stats_t;
+
+/* output counters of terminal tid, -1 past the last terminal */
+extern int32_t ece391_termstat (int32_t tid, term_stats_t* buf);
+
+/* keyboard input of the terminal: lines edited and echoed, or raw keys as typed */
+#define TTY_CANONICAL	0
+#define TTY_RAW		1
+
+/* returns the mode before; raw mode ends when the program halts */
+extern int32_t ece391_ttymode (int32_t mode);
+
+/* open flags: reads of the file return ECE391_WOULD_BLOCK instead of waiting */
+#define O_NONBLOCK	0x1
+#define ECE391_WOULD_BLOCK	(-2)
+
+extern int32_t ece391_open_flags (const uint8_t* filename, int32_t flags);
+/* read waiting timeout_ms at most (0 not at all, negative as long as it takes),
+   ECE391_WOULD_BLOCK if nothing came in time */
+extern int32_t ece391_read_timeout (int32_t fd, void* buf, int32_t nbytes, int32_t timeout_ms);
+
+/* poll events */
+#define POLLIN	0x0001	/* read would not wait */
+#define POLLOUT	0x0004	/* write would not wait */
+#define POLLNVAL	0x0020	/* fd is not open */
+
+typedef struct pollfd_t {
+	int32_t fd;	/* negative to skip the entry */
+	int16_t events;
+	int16_t revents;
+} pollfd_t;
+
+/* wait until one of nfds files is ready or timeout_ms passes (0 not at all,
+   negative as long as it takes); returns the entries with revents set */
+extern int32_t ece391_poll (pollfd_t* fds, int32_t nfds, int32_t timeout_ms);
 
 enum signums {
 	DIV_ZERO = 0,
@@ -11,5 +11,19 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_YIELD   11
+#define SYS_HANDOFF 12
+#define SYS_GETSTATS 13
+#define SYS_SETSCHED 14
+#define SYS_SETTIMER 15
+#define SYS_LOCKSTAT 16
+#define SYS_GETTIME 17
+#define SYS_IRQSTAT 18
+#define SYS_LATSTAT 19
+#define SYS_TERMSTAT 20
+#define SYS_TTYMODE 21
+#define SYS_OPEN_FLAGS 22
+#define SYS_READ_TIMEOUT 23
+#define SYS_POLL 24
 
 #endif /* ECE391SYSNUM_H */
@@ -0,0 +1,39 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+/* print value right-aligned in a field of width columns */
+static void
+put_num (uint32_t value, int32_t width)
+{
+    uint8_t buf[12];
+    int32_t len;
+
+    ece391_itoa (value, buf, 10);
+    for (len = ece391_strlen (buf); len < width; len++)
+	ece391_fdputs (1, (uint8_t*)" ");
+    ece391_fdputs (1, buf);
+}
+
+/*
+ * termstat
+ *   Print, for each terminal, the screen cells written to it that were
+ *   drawn at once and those only buffered while it was hidden, and how
+ *   many times its screen was drawn again when shown.
+ */
+int main ()
+{
+    term_stats_t st;
+    int32_t tid;
+
+    ece391_fdputs (1, (uint8_t*)"TTY   IMMEDIATE    DEFERRED  REDRAWS\n");
+    for (tid = 0; 0 == ece391_termstat (tid, &st); tid++) {
+	put_num (tid, 3);
+	put_num (st.cells_immediate, 12);
+	put_num (st.cells_deferred, 12);
+	put_num (st.redraws, 9);
+	ece391_fdputs (1, (uint8_t*)"\n");
+    }
+    return 0;
+}
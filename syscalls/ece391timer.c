@@ -0,0 +1,48 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 128
+
+/* parse a decimal number at *s, returns -1 if there is none */
+static int32_t
+parse_num (uint8_t** s)
+{
+    int32_t value = 0;
+    uint8_t* p = *s;
+
+    while (*p == ' ')
+	p++;
+    if (*p < '0' || *p > '9')
+	return -1;
+    while (*p >= '0' && *p <= '9')
+	value = value * 10 + (*p++ - '0');
+    *s = p;
+    return value;
+}
+
+/*
+ * timer <hz> [<quantum>]
+ *   Set the PIT frequency and the time slice of all tasks in ticks,
+ *   0 keeps the current value, e.g. "timer 0 10" for longer slices.
+ */
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    uint8_t* s = buf;
+    int32_t hz, quantum;
+
+    if (0 != ece391_getargs (buf, BUFSIZE) || -1 == (hz = parse_num (&s))) {
+        ece391_fdputs (1, (uint8_t*)"usage: timer <hz> [<quantum>]\n");
+	return 3;
+    }
+    if (-1 == (quantum = parse_num (&s)))
+	quantum = 0;
+
+    if (-1 == ece391_settimer (hz, quantum)) {
+        ece391_fdputs (1, (uint8_t*)"timer: invalid frequency or quantum\n");
+	return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define NUM_COLS    80
+#define NUM_ROWS    25
+#define ATTRIB      0x7
+#define HEAD_ATTRIB 0x70
+#define MAX_TASKS   16
+#define RTC_FREQ    2
+#define NUM_TICKS   2       /* rtc periods between two refreshes */
+
+static uint8_t* video_mem;
+
+/* ticks seen in the previous round, indexed by pid (MAX_TASKS is idle) */
+static uint32_t last_ticks[MAX_TASKS + 1];
+
+static char* state_name[] = {"run", "sleep", "wait"};
+
+/*
+ * put_str
+ *   DESCRIPTION: write a string into a row of the screen, starting at col
+ *   INPUTS: row, col -- position, s -- string, attrib -- color
+ *   RETURN VALUE: column after the string
+ */
+static int32_t
+put_str (int32_t row, int32_t col, const char* s, uint8_t attrib)
+{
+    while (*s != '\0' && col < NUM_COLS) {
+	video_mem[(row * NUM_COLS + col) << 1] = *s++;
+	video_mem[((row * NUM_COLS + col) << 1) + 1] = attrib;
+	col++;
+    }
+    return col;
+}
+
+/* right-align a number in a field of width columns ending before col + width */
+static void
+put_num (int32_t row, int32_t col, int32_t width, uint32_t value)
+{
+    uint8_t buf[12];
+    int32_t len;
+
+    ece391_itoa (value, buf, 10);
+    len = ece391_strlen (buf);
+    put_str (row, col + width - len, (char*)buf, ATTRIB);
+}
+
+static void
+clear_row (int32_t row, uint8_t attrib)
+{
+    int32_t col;
+
+    for (col = 0; col < NUM_COLS; col++) {
+	video_mem[(row * NUM_COLS + col) << 1] = ' ';
+	video_mem[((row * NUM_COLS + col) << 1) + 1] = attrib;
+    }
+}
+
+/* draw the rtc_read latency histogram of a task, returns 0 if it has no samples */
+static int32_t
+draw_latency (int32_t row, task_stats_t* st)
+{
+    uint32_t samples = 0;
+    int32_t i;
+
+    for (i = 0; i < RT_HIST_BUCKETS; i++)
+	samples += st->rt_latency[i];
+    if (samples == 0)
+	return 0;
+
+    clear_row (row, ATTRIB);
+    put_num (row, 0, 3, st->pid);
+    if (st->policy == SCHED_RT)
+	put_num (row, 4, 4, st->rt_priority);
+    else
+	put_str (row, 5, "-", ATTRIB);
+    for (i = 0; i < RT_HIST_BUCKETS; i++)
+	put_num (row, 9 + i * 7, 6, st->rt_latency[i]);
+    put_num (row, 65, 5, st->rt_misses);
+    put_str (row, 71, (char*)st->name, ATTRIB);
+    return 1;
+}
+
+/* draw one task; total is the number of ticks that elapsed over all cpus */
+static void
+draw_task (int32_t row, task_stats_t* st, int32_t slot, uint32_t total)
+{
+    uint32_t ticks = st->user_ticks + st->kernel_ticks;
+    uint32_t delta = ticks - last_ticks[slot];
+
+    last_ticks[slot] = ticks;
+
+    clear_row (row, ATTRIB);
+    if (st->pid >= 0) {
+	put_num (row, 0, 3, st->pid);
+	if (st->terminal_id >= 0)
+	    put_num (row, 4, 3, st->terminal_id);
+	else
+	    put_str (row, 6, "-", ATTRIB);
+	put_str (row, 9, state_name[st->state], ATTRIB);
+    }
+    put_num (row, 15, 4, total == 0 ? 0 : delta * 100 / total);
+    put_num (row, 20, 8, st->user_ticks);
+    put_num (row, 29, 8, st->kernel_ticks);
+    put_num (row, 38, 7, st->nr_switches);
+    put_num (row, 46, 7, st->nr_voluntary);
+    put_num (row, 54, 7, st->nr_forced);
+    put_num (row, 62, 7, st->nr_syscalls);
+    put_str (row, 71, (char*)st->name, ATTRIB);
+}
+
+int main ()
+{
+    task_stats_t stats[MAX_TASKS + 1];
+    uint8_t present[MAX_TASKS + 1];
+    uint32_t total;
+    uint32_t ticks;
+    int32_t rtc_fd;
+    int32_t garbage;
+    int32_t i, row;
+
+    if (-1 == ece391_vidmap (&video_mem)) {
+	ece391_fdputs (1, (uint8_t*)"top: vidmap failed\n");
+	return 2;
+    }
+
+    rtc_fd = ece391_open ((uint8_t*)"rtc");
+    garbage = RTC_FREQ;
+    ece391_write (rtc_fd, &garbage, 4);
+
+    for (row = 0; row < NUM_ROWS; row++)
+	clear_row (row, ATTRIB);
+
+    while (1) {
+	/* sum of tick deltas over all tasks and idle is the elapsed time */
+	total = 0;
+	for (i = 0; i <= MAX_TASKS; i++) {
+	    present[i] = (0 == ece391_getstats (i == MAX_TASKS ? -1 : i, &stats[i]));
+	    if (!present[i]) {
+		last_ticks[i] = 0;
+		continue;
+	    }
+	    ticks = stats[i].user_ticks + stats[i].kernel_ticks;
+	    total += ticks - last_ticks[i];
+	}
+
+	clear_row (0, HEAD_ATTRIB);
+	put_str (0, 0, "PID TTY  STATE CPU%     USER   KERNEL   SWTCH  VOLUNT  FORCED SYSCALL  NAME",
+		 HEAD_ATTRIB);
+
+	row = 1;
+	for (i = 0; i <= MAX_TASKS; i++) {
+	    if (present[i])
+		draw_task (row++, &stats[i], i, total);
+	}
+
+	/* rtc_read jitter of the tasks using the rtc, in RTC ticks (~1ms) */
+	clear_row (row, ATTRIB);
+	clear_row (++row, HEAD_ATTRIB);
+	put_str (row++, 0, "PID PRIO      0      1    2-3    4-7   8-15  16-31  32-63    64+  MISS NAME",
+		 HEAD_ATTRIB);
+	for (i = 0; i < MAX_TASKS && row < NUM_ROWS; i++) {
+	    if (present[i] && draw_latency (row, &stats[i]))
+		row++;
+	}
+	while (row < NUM_ROWS)
+	    clear_row (row++, ATTRIB);
+
+	/* rtc_read returns the periods elapsed, a slow round is not made up for */
+	for (i = 0; i < NUM_TICKS; i += garbage)
+	    ece391_read (rtc_fd, &garbage, 4);
+    }
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE     128
+#define CHUNK       4000        /* bytes per write, 50 lines of 80 */
+#define LINE_LEN    80
+#define DEFAULT_KB  256
+#define MAX_KB      (0xFFFFFFFF / 1024)     /* the byte count fits in 32 bits */
+
+static uint8_t chunk[CHUNK];
+
+/* 64 by 32 bit division (no libgcc), a quotient past 32 bits gives 0xFFFFFFFF */
+static uint32_t
+div_u64_u32 (uint64_t n, uint32_t d)
+{
+    uint32_t q, r;
+
+    /* divl would fault */
+    if ((uint32_t)(n >> 32) >= d)
+	return 0xFFFFFFFF;
+    asm ("divl %4" : "=a" (q), "=d" (r) : "a" ((uint32_t)n), "d" ((uint32_t)(n >> 32)), "rm" (d));
+    return q;
+}
+
+static void
+put_num (uint32_t value)
+{
+    uint8_t buf[12];
+
+    ece391_itoa (value, buf, 10);
+    ece391_fdputs (1, buf);
+}
+
+/*
+ * wbench [<kbytes>]
+ *   Terminal write throughput: write kbytes (256 by default) of 79 column
+ *   lines to the terminal in 4000 byte writes, then print the rate.
+ */
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    uint32_t total = DEFAULT_KB * 1024;
+    uint32_t left, n, us;
+    uint64_t start, ns;
+    int32_t i;
+
+    if (0 == ece391_getargs (buf, BUFSIZE)) {
+	total = 0;
+	for (i = 0; buf[i] >= '0' && buf[i] <= '9'; i++) {
+	    /* stop before total passes MAX_KB, it could wrap */
+	    if (total > (MAX_KB - (buf[i] - '0')) / 10)
+		break;
+	    total = total * 10 + (buf[i] - '0');
+	}
+	if (i == 0 || buf[i] != '\0' || total == 0) {
+	    ece391_fdputs (1, (uint8_t*)"usage: wbench [<kbytes>]\n");
+	    return 3;
+	}
+	total *= 1024;
+    }
+
+    /* printable columns that shift by one on every line */
+    for (i = 0; i < CHUNK; i++)
+	chunk[i] = (i % LINE_LEN == LINE_LEN - 1) ? '\n' : ' ' + 1 + (i / LINE_LEN + i % LINE_LEN) % 94;
+
+    start = ece391_clock_ns ();
+    /* counted down, counting up to total could wrap past 32 bits */
+    for (left = total; left > 0; left -= n) {
+	n = (left < CHUNK) ? left : CHUNK;
+	ece391_write (1, chunk, n);
+    }
+    ns = ece391_clock_ns () - start;
+
+    us = div_u64_u32 (ns, 1000);
+    if (us == 0)
+	us = 1;
+    ece391_fdputs (1, (uint8_t*)"\nwrote ");
+    put_num (total);
+    ece391_fdputs (1, (uint8_t*)" bytes in ");
+    put_num (us);
+    ece391_fdputs (1, (uint8_t*)" us: ");
+    put_num (div_u64_u32 ((uint64_t)total * 1000000, us));
+    ece391_fdputs (1, (uint8_t*)" bytes/s\n");
+    return 0;
+}